@@ -0,0 +1,557 @@
+// End-to-end load generator for ircserv.
+//
+//   ./bench/ircbench [options] <host> <port> <password>
+//
+// Runs four phases against a live server and prints one JSON object with
+// the results on stdout (progress goes to stderr):
+//   connect   open --clients sockets at once
+//   register  PASS/NICK/USER on every socket, wait for 001
+//   join      spread the clients over --channels channels, wait for 366
+//   fanout    --senders members per channel send --messages PRIVMSGs each;
+//             every line carries its send time, so receivers measure the
+//             delivery latency (same host, same monotonic clock)
+//
+// The client side is a single non-blocking event loop on the server's own
+// Poller, so one process can drive many thousands of connections.
+
+#include "../eventloop/poller.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+namespace {
+
+typedef unsigned long long Micros;
+
+// Connections opened between two passes over the event loop
+const size_t CONNECT_BATCH = 128;
+
+Micros nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<Micros>(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+double seconds(Micros elapsed) {
+    return static_cast<double>(elapsed) / 1e6;
+}
+
+struct Options {
+    std::string     host;
+    std::string     port;
+    std::string     password;
+    std::string     nickPrefix;     // Keeps concurrent runs from colliding
+    size_t          clients;
+    size_t          channels;
+    size_t          senders;        // Per channel
+    size_t          messages;       // Per sender
+    size_t          rate;           // Total PRIVMSGs per second (0 = as fast as possible)
+    size_t          timeout;        // Seconds per phase
+
+    Options() : nickPrefix("b"), clients(1000), channels(10), senders(1), messages(100),
+                rate(0), timeout(30) {}
+};
+
+struct Connection {
+    int             fd;
+    size_t          channel;        // Index of the channel it joins
+    bool            connected;
+    bool            registered;
+    bool            joined;
+    bool            failed;         // Connect error, EOF or ERROR line
+    std::string     input;
+    size_t          inputStart;     // First unparsed byte of input
+    std::string     output;
+    size_t          outputStart;    // First unsent byte of output
+    bool            writeArmed;
+
+    Connection() : fd(-1), channel(0), connected(false), registered(false), joined(false),
+                   failed(false), inputStart(0), outputStart(0), writeArmed(false) {}
+};
+
+struct Counters {
+    size_t              connected;
+    size_t              registered;
+    size_t              joined;
+    size_t              failed;
+    size_t              errors;         // ERROR lines received
+    size_t              sent;           // PRIVMSGs written
+    size_t              delivered;      // PRIVMSGs received
+    std::vector<Micros> latencies;
+
+    Counters() : connected(0), registered(0), joined(0), failed(0), errors(0), sent(0), delivered(0) {}
+};
+
+class LoadGenerator {
+private:
+    Options                     _options;
+    Poller*                     _poller;
+    std::vector<Connection>     _connections;
+    std::vector<int>            _byFd;      // fd -> index into _connections (-1 = none)
+    std::vector<PollEvent>      _events;
+    Counters                    _counters;
+
+    // Prevent copying
+    LoadGenerator(const LoadGenerator& other);
+    LoadGenerator& operator=(const LoadGenerator& other);
+
+    std::string nickname(size_t index) const {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%s%lu", _options.nickPrefix.c_str(),
+                 static_cast<unsigned long>(index));
+        return buffer;
+    }
+
+    std::string channelName(size_t index) const {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "#bench%lu", static_cast<unsigned long>(index));
+        return buffer;
+    }
+
+    void fail(Connection& conn) {
+        if (conn.failed) {
+            return;
+        }
+        conn.failed = true;
+        _counters.failed++;
+        _poller->remove(conn.fd);
+    }
+
+    void send(Connection& conn, const std::string& line) {
+        if (conn.failed) {
+            return;
+        }
+        conn.output += line;
+        conn.output += "\r\n";
+        flush(conn);
+    }
+
+    void flush(Connection& conn) {
+        while (conn.outputStart < conn.output.size()) {
+            ssize_t written = ::send(conn.fd, conn.output.data() + conn.outputStart,
+                                     conn.output.size() - conn.outputStart, 0);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                fail(conn);
+                return;
+            }
+            conn.outputStart += written;
+        }
+        if (conn.outputStart == conn.output.size()) {
+            conn.output.clear();
+            conn.outputStart = 0;
+        }
+        bool wantWrite = !conn.output.empty() || !conn.connected;
+        if (wantWrite != conn.writeArmed) {
+            conn.writeArmed = wantWrite;
+            _poller->modify(conn.fd, Poller::READABLE | (wantWrite ? Poller::WRITABLE : 0));
+        }
+    }
+
+    void handleLine(Connection& conn, const char* line, size_t length) {
+        std::string text(line, length);
+        if (text.compare(0, 5, "PING ") == 0) {
+            send(conn, "PONG " + text.substr(5));
+            return;
+        }
+        if (text.compare(0, 6, "ERROR ") == 0) {
+            _counters.errors++;
+            fail(conn);
+            return;
+        }
+
+        // [:prefix] command params...
+        size_t pos = 0;
+        if (!text.empty() && text[0] == ':') {
+            pos = text.find(' ');
+            if (pos == std::string::npos) {
+                return;
+            }
+            pos++;
+        }
+        size_t end = text.find(' ', pos);
+        std::string command = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+
+        if (command == "001" && !conn.registered) {
+            conn.registered = true;
+            _counters.registered++;
+        } else if (command == "366" && !conn.joined) {
+            conn.joined = true;
+            _counters.joined++;
+        } else if (command == "PRIVMSG") {
+            // Trailing is "bench <send time in us>"
+            size_t marker = text.find(" :bench ");
+            if (marker != std::string::npos) {
+                Micros sentAt = std::strtoull(text.c_str() + marker + 8, NULL, 10);
+                Micros now = nowMicros();
+                _counters.latencies.push_back(now > sentAt ? now - sentAt : 0);
+                _counters.delivered++;
+            }
+        }
+    }
+
+    void handleRead(Connection& conn) {
+        char buffer[16384];
+        while (!conn.failed) {
+            ssize_t received = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (received <= 0) {
+                fail(conn);
+                return;
+            }
+            conn.input.append(buffer, received);
+        }
+
+        size_t newline;
+        while ((newline = conn.input.find("\r\n", conn.inputStart)) != std::string::npos) {
+            handleLine(conn, conn.input.data() + conn.inputStart, newline - conn.inputStart);
+            conn.inputStart = newline + 2;
+        }
+        if (conn.inputStart > 0) {
+            conn.input.erase(0, conn.inputStart);
+            conn.inputStart = 0;
+        }
+    }
+
+    void handleWrite(Connection& conn) {
+        if (!conn.connected) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                fail(conn);
+                return;
+            }
+            conn.connected = true;
+            _counters.connected++;
+        }
+        flush(conn);
+    }
+
+    // Pump the event loop until `done` is reached or the phase times out
+    bool runUntil(size_t& counter, size_t done, const char* phase) {
+        Micros deadline = nowMicros() + _options.timeout * 1000000ULL;
+        while (counter + _counters.failed < done) {
+            if (nowMicros() >= deadline) {
+                fprintf(stderr, "%s: timed out at %lu/%lu\n", phase, static_cast<unsigned long>(counter),
+                        static_cast<unsigned long>(done));
+                return false;
+            }
+            pump(100);
+        }
+        return true;
+    }
+
+    void pump(int timeoutMs) {
+        if (_poller->wait(_events, timeoutMs) < 0) {
+            return;
+        }
+        for (size_t i = 0; i < _events.size(); i++) {
+            int fd = _events[i].fd;
+            if (fd < 0 || static_cast<size_t>(fd) >= _byFd.size() || _byFd[fd] == -1) {
+                continue;
+            }
+            Connection& conn = _connections[_byFd[fd]];
+            if (conn.failed) {
+                continue;
+            }
+            if (_events[i].events & (Poller::READABLE | Poller::ERROR)) {
+                handleRead(conn);
+            }
+            if ((_events[i].events & Poller::WRITABLE) && !conn.failed) {
+                handleWrite(conn);
+            }
+        }
+    }
+
+    bool connectAll() {
+        struct addrinfo hints;
+        struct addrinfo* address = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        int status = getaddrinfo(_options.host.c_str(), _options.port.c_str(), &hints, &address);
+        if (status != 0) {
+            fprintf(stderr, "%s: %s\n", _options.host.c_str(), gai_strerror(status));
+            return false;
+        }
+
+        _connections.resize(_options.clients);
+        for (size_t i = 0; i < _connections.size(); i++) {
+            Connection& conn = _connections[i];
+            conn.channel = i % _options.channels;
+            conn.fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (conn.fd == -1) {
+                fprintf(stderr, "socket: %s\n", strerror(errno));
+                freeaddrinfo(address);
+                return false;
+            }
+            fcntl(conn.fd, F_SETFL, fcntl(conn.fd, F_GETFL, 0) | O_NONBLOCK);
+            if (static_cast<size_t>(conn.fd) >= _byFd.size()) {
+                _byFd.resize(conn.fd + 1, -1);
+            }
+            _byFd[conn.fd] = static_cast<int>(i);
+            if (connect(conn.fd, address->ai_addr, address->ai_addrlen) == -1 && errno != EINPROGRESS) {
+                _poller->add(conn.fd, Poller::READABLE);
+                fail(conn);
+                continue;
+            }
+            conn.writeArmed = true;
+            _poller->add(conn.fd, Poller::READABLE | Poller::WRITABLE);
+            // Let the server keep up; an overflowing listen queue drops
+            // SYNs and stalls the run on the one-second retransmit
+            if (i % CONNECT_BATCH == CONNECT_BATCH - 1) {
+                pump(0);
+            }
+        }
+        freeaddrinfo(address);
+        return true;
+    }
+
+    void runFanout(size_t& expected) {
+        // Sender s of channel c is its s-th member, i.e. client c + s * channels
+        std::vector<size_t> senders;
+        for (size_t i = 0; i < _connections.size() && i < _options.channels * _options.senders; i++) {
+            if (!_connections[i].failed) {
+                senders.push_back(i);
+            }
+        }
+        std::vector<size_t> members(_options.channels, 0);
+        for (size_t i = 0; i < _connections.size(); i++) {
+            if (_connections[i].joined && !_connections[i].failed) {
+                members[_connections[i].channel]++;
+            }
+        }
+        expected = 0;
+        for (size_t i = 0; i < senders.size(); i++) {
+            expected += _options.messages * (members[_connections[senders[i]].channel] - 1);
+        }
+
+        size_t total = senders.size() * _options.messages;
+        Micros start = nowMicros();
+        Micros deadline = start + _options.timeout * 1000000ULL;
+        while (_counters.sent < total && nowMicros() < deadline) {
+            // How many messages the schedule allows by now
+            size_t allowed = total;
+            if (_options.rate > 0) {
+                allowed = std::min(total, static_cast<size_t>((nowMicros() - start) * _options.rate / 1000000ULL) + 1);
+            }
+            while (_counters.sent < allowed) {
+                Connection& conn = _connections[senders[_counters.sent % senders.size()]];
+                // Don't outrun the socket: let the loop drain a full buffer first
+                if (conn.output.size() > 65536) {
+                    break;
+                }
+                char line[128];
+                snprintf(line, sizeof(line), "PRIVMSG %s :bench %llu", channelName(conn.channel).c_str(),
+                         nowMicros());
+                send(conn, line);
+                _counters.sent++;
+            }
+            pump(_counters.sent < allowed ? 0 : 1);
+        }
+
+        // Wait for the stragglers; drops past the server's soft limit never arrive
+        size_t last = _counters.delivered;
+        Micros quietSince = nowMicros();
+        while (_counters.delivered < expected && nowMicros() < deadline) {
+            pump(100);
+            if (_counters.delivered != last) {
+                last = _counters.delivered;
+                quietSince = nowMicros();
+            } else if (nowMicros() - quietSince > 2000000ULL) {
+                break;
+            }
+        }
+    }
+
+    static Micros percentile(const std::vector<Micros>& sorted, double fraction) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+public:
+    explicit LoadGenerator(const Options& options)
+        : _options(options), _poller(Poller::create()) {}
+
+    ~LoadGenerator() {
+        for (size_t i = 0; i < _connections.size(); i++) {
+            if (_connections[i].fd != -1) {
+                close(_connections[i].fd);
+            }
+        }
+        delete _poller;
+    }
+
+    int run() {
+        Micros start = nowMicros();
+        if (!connectAll()) {
+            return 1;
+        }
+        runUntil(_counters.connected, _connections.size(), "connect");
+        Micros connectTime = nowMicros() - start;
+        fprintf(stderr, "connect: %lu in %.3fs\n", static_cast<unsigned long>(_counters.connected), seconds(connectTime));
+
+        start = nowMicros();
+        for (size_t i = 0; i < _connections.size(); i++) {
+            std::string nick = nickname(i);
+            send(_connections[i], "PASS " + _options.password);
+            send(_connections[i], "NICK " + nick);
+            send(_connections[i], "USER " + nick + " 0 * :ircbench");
+        }
+        runUntil(_counters.registered, _connections.size(), "register");
+        Micros registerTime = nowMicros() - start;
+        fprintf(stderr, "register: %lu in %.3fs\n", static_cast<unsigned long>(_counters.registered), seconds(registerTime));
+
+        start = nowMicros();
+        size_t joining = _counters.failed;
+        for (size_t i = 0; i < _connections.size(); i++) {
+            if (_connections[i].registered && !_connections[i].failed) {
+                send(_connections[i], "JOIN " + channelName(_connections[i].channel));
+                joining++;
+            }
+        }
+        runUntil(_counters.joined, joining, "join");
+        Micros joinTime = nowMicros() - start;
+        fprintf(stderr, "join: %lu in %.3fs\n", static_cast<unsigned long>(_counters.joined), seconds(joinTime));
+
+        size_t expected = 0;
+        start = nowMicros();
+        runFanout(expected);
+        Micros fanoutTime = nowMicros() - start;
+        fprintf(stderr, "fanout: sent %lu, delivered %lu/%lu in %.3fs\n", static_cast<unsigned long>(_counters.sent),
+                static_cast<unsigned long>(_counters.delivered), static_cast<unsigned long>(expected), seconds(fanoutTime));
+
+        std::sort(_counters.latencies.begin(), _counters.latencies.end());
+        const std::vector<Micros>& lat = _counters.latencies;
+        printf("{\"clients\":%lu,\"channels\":%lu,\"senders\":%lu,\"messages\":%lu,"
+               "\"connected\":%lu,\"registered\":%lu,\"joined\":%lu,\"failed\":%lu,\"errors\":%lu,"
+               "\"connect_seconds\":%.6f,\"connects_per_sec\":%.1f,"
+               "\"register_seconds\":%.6f,\"registrations_per_sec\":%.1f,"
+               "\"join_seconds\":%.6f,"
+               "\"fanout_seconds\":%.6f,\"sent\":%lu,\"expected\":%lu,\"delivered\":%lu,"
+               "\"deliveries_per_sec\":%.1f,"
+               "\"latency_us\":{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+               static_cast<unsigned long>(_options.clients), static_cast<unsigned long>(_options.channels),
+               static_cast<unsigned long>(_options.senders), static_cast<unsigned long>(_options.messages),
+               static_cast<unsigned long>(_counters.connected), static_cast<unsigned long>(_counters.registered),
+               static_cast<unsigned long>(_counters.joined), static_cast<unsigned long>(_counters.failed),
+               static_cast<unsigned long>(_counters.errors),
+               seconds(connectTime), connectTime ? _counters.connected / seconds(connectTime) : 0.0,
+               seconds(registerTime), registerTime ? _counters.registered / seconds(registerTime) : 0.0,
+               seconds(joinTime),
+               seconds(fanoutTime), static_cast<unsigned long>(_counters.sent),
+               static_cast<unsigned long>(expected), static_cast<unsigned long>(_counters.delivered),
+               fanoutTime ? _counters.delivered / seconds(fanoutTime) : 0.0,
+               percentile(lat, 0.50), percentile(lat, 0.99), percentile(lat, 0.999),
+               lat.empty() ? 0ULL : lat.back());
+        return _counters.delivered == expected && _counters.failed == 0 ? 0 : 2;
+    }
+};
+
+void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options] <host> <port> <password>\n"
+            "  --clients N     connections to open (default 1000)\n"
+            "  --channels N    channels to spread them over (default 10)\n"
+            "  --senders N     senders per channel (default 1)\n"
+            "  --messages N    PRIVMSGs per sender (default 100)\n"
+            "  --rate N        total PRIVMSGs per second, 0 = unthrottled (default 0)\n"
+            "  --timeout N     seconds allowed per phase (default 30)\n"
+            "  --prefix S      nickname prefix (default \"b\")\n",
+            name);
+}
+
+bool parseCount(const char* raw, size_t& value) {
+    char* end = NULL;
+    long parsed = std::strtol(raw, &end, 10);
+    if (!*raw || *end != '\0' || parsed < 0) {
+        return false;
+    }
+    value = static_cast<size_t>(parsed);
+    return true;
+}
+
+// Thousands of sockets need more than the usual 1024 descriptors
+void raiseFileLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t* target = NULL;
+        if (arg == "--clients") {
+            target = &options.clients;
+        } else if (arg == "--channels") {
+            target = &options.channels;
+        } else if (arg == "--senders") {
+            target = &options.senders;
+        } else if (arg == "--messages") {
+            target = &options.messages;
+        } else if (arg == "--rate") {
+            target = &options.rate;
+        } else if (arg == "--timeout") {
+            target = &options.timeout;
+        } else if (arg == "--prefix" && i + 1 < argc) {
+            options.nickPrefix = argv[++i];
+            continue;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            positional.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc || !parseCount(argv[++i], *target)) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (positional.size() != 3 || options.clients == 0 || options.channels == 0
+        || options.channels > options.clients || options.senders == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    options.host = positional[0];
+    options.port = positional[1];
+    options.password = positional[2];
+
+    raiseFileLimit();
+    signal(SIGPIPE, SIG_IGN); // Write errors are handled per connection
+    LoadGenerator generator(options);
+    return generator.run();
+}
@@ -0,0 +1,301 @@
+// Microbenchmarks for the message path, run in-process with no sockets.
+//
+//   ./bench/ircmicro [filter]
+//
+// Clients are wired to an OutputSink instead of a socket, so parsing,
+// framing, command dispatch, NAMES and channel fan-out are measured in
+// isolation. Each benchmark is repeated until it has run for a while;
+// results go to stdout as one JSON object, a readable table to stderr.
+// An optional argument runs only the benchmarks whose name contains it.
+
+#include "../server/server.hpp"
+#include "../client/client.hpp"
+#include "../channels/channels.hpp"
+#include "../parser/message.hpp"
+#include "../buffers/outputsink.hpp"
+#include "../logger/logger.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <time.h>
+
+namespace {
+
+typedef unsigned long long Nanos;
+
+Nanos nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<Nanos>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// Minimum measured time per benchmark
+const Nanos TARGET_NANOS = 300000000ULL;
+
+// Counts what would have been written to the socket
+class CountingSink : public OutputSink {
+public:
+    size_t  lines;
+    size_t  bytes;
+
+    CountingSink() : lines(0), bytes(0) {}
+
+    void deliver(const Payload& payload, OutputQueue::Priority priority) {
+        (void)priority;
+        lines++;
+        bytes += payload.size();
+    }
+};
+
+// Registered in-memory clients sharing one sink
+class Fixture {
+private:
+    std::vector<Client*>    _clients;
+
+    // Prevent copying
+    Fixture(const Fixture& other);
+    Fixture& operator=(const Fixture& other);
+
+public:
+    Server          server;
+    CountingSink    sink;
+
+    Fixture() : server(6667, "pw") {}
+
+    ~Fixture() {
+        for (size_t i = 0; i < _clients.size(); i++) {
+            delete _clients[i];
+        }
+    }
+
+    Client* addClient() {
+        Client* client = new Client(-1, &server, _clients.size() + 1);
+        client->setSink(&sink);
+        char nick[16];
+        snprintf(nick, sizeof(nick), "n%lu", static_cast<unsigned long>(_clients.size()));
+        feed(client, std::string("PASS pw\r\nNICK ") + nick + "\r\nUSER u 0 * :bench\r\n");
+        _clients.push_back(client);
+        return client;
+    }
+
+    // A channel with `members` clients; the first one is returned via `first`
+    Channel* addChannel(const std::string& name, size_t members, Client*& first) {
+        first = NULL;
+        for (size_t i = 0; i < members; i++) {
+            Client* client = addClient();
+            feed(client, "JOIN " + name + "\r\n");
+            if (!first) {
+                first = client;
+            }
+        }
+        return server.getChannel(name);
+    }
+
+    static void feed(Client* client, const std::string& bytes) {
+        client->receiveBytes(bytes.data(), bytes.size());
+    }
+};
+
+// One benchmark: `run` performs `batch` operations per call
+class Benchmark {
+public:
+    virtual ~Benchmark() {}
+    virtual const char* name() const = 0;
+    virtual size_t batch() const { return 1; }
+    virtual void run() = 0;
+};
+
+struct Result {
+    std::string name;
+    unsigned long long operations;
+    double      nanosPerOp;
+};
+
+// ---- Parser --------------------------------------------------------------
+
+class ParseBenchmark : public Benchmark {
+private:
+    const char*         _name;
+    std::string         _line;
+    std::vector<char>   _scratch;   // parseMessage() upper-cases in place
+
+public:
+    ParseBenchmark(const char* name, const std::string& line)
+        : _name(name), _line(line), _scratch(line.size() + 1) {}
+
+    const char* name() const { return _name; }
+
+    void run() {
+        memcpy(&_scratch[0], _line.data(), _line.size());
+        IrcMessage message;
+        if (!parseMessage(&_scratch[0], _line.size(), message)) {
+            fprintf(stderr, "%s: line did not parse\n", _name);
+        }
+    }
+};
+
+// ---- Framing and dispatch ------------------------------------------------
+
+// Feeds a fixed byte stream to one registered client, in `chunk`-byte recv()s
+class FeedBenchmark : public Benchmark {
+private:
+    const char*     _name;
+    Fixture         _fixture;
+    Client*         _client;
+    std::string     _bytes;
+    size_t          _lines;
+    size_t          _chunk;
+
+public:
+    FeedBenchmark(const char* name, const std::string& line, size_t lines, size_t chunk)
+        : _name(name), _client(NULL), _lines(lines), _chunk(chunk) {
+        for (size_t i = 0; i < lines; i++) {
+            _bytes += line;
+        }
+        _client = _fixture.addClient();
+        _fixture.addClient(); // Target "n1" for private messages
+    }
+
+    const char* name() const { return _name; }
+    size_t batch() const { return _lines; }
+
+    void run() {
+        for (size_t offset = 0; offset < _bytes.size(); offset += _chunk) {
+            size_t length = _bytes.size() - offset < _chunk ? _bytes.size() - offset : _chunk;
+            _client->receiveBytes(_bytes.data() + offset, length);
+        }
+    }
+};
+
+// ---- NAMES ---------------------------------------------------------------
+
+class NamesBenchmark : public Benchmark {
+private:
+    const char*     _name;
+    Fixture         _fixture;
+    Channel*        _channel;
+    bool            _rebuild;
+
+public:
+    NamesBenchmark(const char* name, size_t members, bool rebuild)
+        : _name(name), _channel(NULL), _rebuild(rebuild) {
+        Client* first;
+        _channel = _fixture.addChannel("#names", members, first);
+    }
+
+    const char* name() const { return _name; }
+
+    void run() {
+        if (_rebuild) {
+            _channel->invalidateNames();
+        }
+        if (_channel->getNamesChunks().empty()) {
+            fprintf(stderr, "%s: empty NAMES\n", _name);
+        }
+    }
+};
+
+// ---- Fan-out -------------------------------------------------------------
+
+class BroadcastBenchmark : public Benchmark {
+private:
+    const char*     _name;
+    Fixture         _fixture;
+    Channel*        _channel;
+    Client*         _sender;
+    std::string     _line;
+    bool            _viaCommand;    // Full PRIVMSG handling rather than the bare broadcast
+
+public:
+    BroadcastBenchmark(const char* name, size_t members, bool viaCommand)
+        : _name(name), _channel(NULL), _sender(NULL), _viaCommand(viaCommand) {
+        _channel = _fixture.addChannel("#fanout", members, _sender);
+        _line = viaCommand ? "PRIVMSG #fanout :hello everyone, this is a benchmark line\r\n"
+                           : ":n0!u@host PRIVMSG #fanout :hello everyone, this is a benchmark line";
+    }
+
+    const char* name() const { return _name; }
+
+    void run() {
+        if (_viaCommand) {
+            _sender->receiveBytes(_line.data(), _line.size());
+        } else {
+            _channel->broadcastMessage(_line, _sender);
+        }
+    }
+};
+
+Result measure(Benchmark& benchmark) {
+    // Warm up caches and pools, then grow the repetition count until the
+    // run is long enough to trust the clock
+    benchmark.run();
+    unsigned long long repetitions = 1;
+    Nanos elapsed = 0;
+    while (true) {
+        Nanos start = nowNanos();
+        for (unsigned long long i = 0; i < repetitions; i++) {
+            benchmark.run();
+        }
+        elapsed = nowNanos() - start;
+        if (elapsed >= TARGET_NANOS) {
+            break;
+        }
+        repetitions *= elapsed > 0 && TARGET_NANOS / elapsed < 10 ? 2 : 10;
+    }
+
+    Result result;
+    result.name = benchmark.name();
+    result.operations = repetitions * benchmark.batch();
+    result.nanosPerOp = static_cast<double>(elapsed) / result.operations;
+    return result;
+}
+
+std::string repeat(char c, size_t count) {
+    return std::string(count, c);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const char* filter = argc > 1 ? argv[1] : NULL;
+    Logger::instance().setLevel(LOG_LEVEL_ERROR); // Keep formatting out of the numbers
+
+    std::vector<Benchmark*> benchmarks;
+    benchmarks.push_back(new ParseBenchmark("parse/simple", "PRIVMSG #channel :hello world"));
+    benchmarks.push_back(new ParseBenchmark("parse/prefixed",
+                                            ":nick!user@host.example.org PRIVMSG #channel :hello world"));
+    benchmarks.push_back(new ParseBenchmark("parse/long_trailing",
+                                            "PRIVMSG #channel :" + repeat('x', 480)));
+    benchmarks.push_back(new ParseBenchmark("parse/15_params",
+                                            "MODE #channel +ooooovvvvvbbbb a b c d e f g h i j k l m :n"));
+    benchmarks.push_back(new FeedBenchmark("framing/pipelined_ping", "PING :token\r\n", 100, 65536));
+    benchmarks.push_back(new FeedBenchmark("framing/trickled_ping", "PING :token\r\n", 100, 7));
+    benchmarks.push_back(new FeedBenchmark("dispatch/privmsg_user",
+                                           "PRIVMSG n1 :hello there, how are you?\r\n", 100, 65536));
+    benchmarks.push_back(new FeedBenchmark("dispatch/unknown_command", "FOO bar baz\r\n", 100, 65536));
+    benchmarks.push_back(new NamesBenchmark("names/cached_1000", 1000, false));
+    benchmarks.push_back(new NamesBenchmark("names/rebuild_1000", 1000, true));
+    benchmarks.push_back(new BroadcastBenchmark("broadcast/channel_100", 100, false));
+    benchmarks.push_back(new BroadcastBenchmark("broadcast/channel_1000", 1000, false));
+    benchmarks.push_back(new BroadcastBenchmark("dispatch/privmsg_channel_1000", 1000, true));
+
+    std::vector<Result> results;
+    for (size_t i = 0; i < benchmarks.size(); i++) {
+        if (!filter || strstr(benchmarks[i]->name(), filter)) {
+            Result result = measure(*benchmarks[i]);
+            fprintf(stderr, "%-32s %12.1f ns/op %14llu ops\n", result.name.c_str(), result.nanosPerOp,
+                    result.operations);
+            results.push_back(result);
+        }
+        delete benchmarks[i];
+    }
+
+    printf("{\"benchmarks\":[");
+    for (size_t i = 0; i < results.size(); i++) {
+        printf("%s{\"name\":\"%s\",\"operations\":%llu,\"ns_per_op\":%.2f}", i ? "," : "",
+               results[i].name.c_str(), results[i].operations, results[i].nanosPerOp);
+    }
+    printf("]}\n");
+    return 0;
+}
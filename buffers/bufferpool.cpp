@@ -0,0 +1,104 @@
+#include "bufferpool.hpp"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+const size_t MIN_CLASS_SHIFT = 6;   // 64 bytes
+const size_t MAX_CLASS_SHIFT = 14;  // 16 KiB
+const size_t CLASS_COUNT = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+
+// Idle bytes a class may hold before releases go back to free()
+const size_t RETAIN_BYTES = 1024 * 1024;
+
+struct FreeBlock {
+    FreeBlock*  next;
+};
+
+struct SizeClass {
+    int         lock;       // Spinlock, 0 = free
+    FreeBlock*  head;
+    size_t      count;      // Blocks on the list
+};
+
+// Zero-initialized before any constructor runs, so usable from static
+// initializers; never torn down, since payloads may outlive main()
+SizeClass g_classes[CLASS_COUNT];
+
+size_t classIndex(size_t size) {
+    size_t shift = MIN_CLASS_SHIFT;
+    while ((static_cast<size_t>(1) << shift) < size) {
+        ++shift;
+    }
+    return shift - MIN_CLASS_SHIFT;
+}
+
+size_t classSize(size_t index) {
+    return static_cast<size_t>(1) << (index + MIN_CLASS_SHIFT);
+}
+
+void lock(SizeClass& sizeClass) {
+    while (__atomic_exchange_n(&sizeClass.lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&sizeClass.lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+void unlock(SizeClass& sizeClass) {
+    __atomic_store_n(&sizeClass.lock, 0, __ATOMIC_RELEASE);
+}
+
+void* systemAllocate(size_t size) {
+    void* block = std::malloc(size);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+} // namespace
+
+void* bufferAllocate(size_t size) {
+    if (size > classSize(CLASS_COUNT - 1)) {
+        return systemAllocate(size);
+    }
+    size_t index = classIndex(size);
+    SizeClass& sizeClass = g_classes[index];
+
+    lock(sizeClass);
+    FreeBlock* block = sizeClass.head;
+    if (block) {
+        sizeClass.head = block->next;
+        --sizeClass.count;
+    }
+    unlock(sizeClass);
+
+    return block ? static_cast<void*>(block) : systemAllocate(classSize(index));
+}
+
+void bufferRelease(void* block, size_t size) {
+    if (!block) {
+        return;
+    }
+    if (size > classSize(CLASS_COUNT - 1)) {
+        std::free(block);
+        return;
+    }
+    size_t index = classIndex(size);
+    SizeClass& sizeClass = g_classes[index];
+    size_t retain = RETAIN_BYTES / classSize(index);
+
+    lock(sizeClass);
+    bool kept = sizeClass.count < retain;
+    if (kept) {
+        FreeBlock* node = static_cast<FreeBlock*>(block);
+        node->next = sizeClass.head;
+        sizeClass.head = node;
+        ++sizeClass.count;
+    }
+    unlock(sizeClass);
+
+    if (!kept) {
+        std::free(block);
+    }
+}
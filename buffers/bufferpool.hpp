@@ -0,0 +1,21 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <cstddef>
+
+// Size-classed free lists for I/O buffers: payload blocks, input buffers.
+// Requests are rounded up to a power of two between 64 bytes and 16 KiB
+// and served from the matching list, so steady-state messaging recycles
+// the same blocks instead of going through malloc. Blocks may be released
+// on a different thread than the one that allocated them (payloads end
+// their life in the I/O workers), so each list sits behind a spinlock;
+// critical sections are a couple of pointer moves. Larger requests go
+// straight to malloc. Each list keeps a bounded number of idle blocks and
+// returns the rest to the system.
+
+void* bufferAllocate(size_t size);
+
+// `size` must be the value passed to bufferAllocate()
+void bufferRelease(void* block, size_t size);
+
+#endif // BUFFERPOOL_HPP
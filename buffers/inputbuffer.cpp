@@ -0,0 +1,80 @@
+#include "inputbuffer.hpp"
+#include "bufferpool.hpp"
+#include <cstring>
+
+InputBuffer::InputBuffer(size_t capacity)
+    : _data(NULL), _capacity(capacity), _start(0), _end(0), _scan(0) {
+}
+
+InputBuffer::~InputBuffer() {
+    if (_data) {
+        bufferRelease(_data, _capacity);
+    }
+}
+
+void InputBuffer::reserve() {
+    if (!_data) {
+        _data = static_cast<char*>(bufferAllocate(_capacity));
+    }
+}
+
+void InputBuffer::compact() {
+    if (_start == 0) {
+        return;
+    }
+    size_t remaining = _end - _start;
+    if (remaining > 0) {
+        memmove(_data, _data + _start, remaining);
+    }
+    _scan -= _start;
+    _end = remaining;
+    _start = 0;
+}
+
+char* InputBuffer::writePtr() {
+    reserve();
+    if (_end == _capacity) {
+        compact();
+    }
+    return _data + _end;
+}
+
+size_t InputBuffer::writable() {
+    reserve();
+    if (_end == _capacity) {
+        compact();
+    }
+    return _capacity - _end;
+}
+
+void InputBuffer::commit(size_t length) {
+    _end += length;
+}
+
+bool InputBuffer::nextLine(char*& line, size_t& length) {
+    while (_scan < _end) {
+        char* newline = static_cast<char*>(memchr(_data + _scan, '\n', _end - _scan));
+        if (!newline) {
+            _scan = _end; // Nothing more to find until new data arrives
+            return false;
+        }
+        size_t pos = newline - _data;
+        _scan = pos + 1;
+        if (pos == _start || _data[pos - 1] != '\r') {
+            continue; // Bare LF: not a terminator, keep it in the line
+        }
+        line = _data + _start;
+        length = pos - 1 - _start;
+        _start = pos + 1;
+        if (_start == _end) {
+            // Everything consumed: restart at the front for free
+            _start = _end = _scan = 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+void InputBuffer::clear() {
+    _start = _end = _scan = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef INPUTBUFFER_HPP
+#define INPUTBUFFER_HPP
+
+#include <cstddef>
+
+// Fixed-capacity receive buffer with in-place line framing. recv() writes
+// straight into the free tail, complete lines are handed out as
+// (pointer, length) views into the buffer, and the CRLF scan resumes where
+// the previous one stopped. Consumed bytes are only reclaimed when the
+// tail runs out of room, by moving the (short) unconsumed remainder to the
+// front, so framing a burst of pipelined lines is linear in its size.
+// The storage is only taken from the pool on the first write, so clients
+// that never read (remote users behind a server link) do not hold any.
+class InputBuffer {
+private:
+    char*   _data;      // Storage, _capacity bytes (NULL until the first write)
+    size_t  _capacity;
+    size_t  _start;     // First unconsumed byte
+    size_t  _end;       // One past the last received byte
+    size_t  _scan;      // Where the next terminator search resumes
+
+    void compact();
+    void reserve();
+
+    // Prevent copying
+    InputBuffer(const InputBuffer& other);
+    InputBuffer& operator=(const InputBuffer& other);
+
+public:
+    explicit InputBuffer(size_t capacity);
+    ~InputBuffer();
+
+    // Free space for the next recv(); reclaims consumed bytes if needed.
+    // Invalidates line views returned earlier.
+    char* writePtr();
+    size_t writable();
+    void commit(size_t length);
+
+    // Next complete "\r\n"-terminated line, without the terminator. The
+    // view stays valid until the next writePtr()/writable()/clear().
+    bool nextLine(char*& line, size_t& length);
+
+    // Received bytes not handed out as lines yet (a partial line, or
+    // lines left unread), size() of them
+    const char* unconsumed() const { return _data ? _data + _start : ""; }
+    size_t size() const { return _end - _start; }
+    bool full() const { return size() == _capacity; }
+    void clear();
+};
+
+#endif // INPUTBUFFER_HPP
@@ -0,0 +1,22 @@
+#include "linebuilder.hpp"
+
+Payload LineBuilder::frame() const {
+    Payload payload;
+    char* out = payload.reserve(_size + 2);
+    for (size_t i = 0; i < _count; i++) {
+        memcpy(out, _pieces[i].data, _pieces[i].size);
+        out += _pieces[i].size;
+    }
+    out[0] = '\r';
+    out[1] = '\n';
+    return payload;
+}
+
+std::string LineBuilder::str() const {
+    std::string line;
+    line.reserve(_size);
+    for (size_t i = 0; i < _count; i++) {
+        line.append(_pieces[i].data, _pieces[i].size);
+    }
+    return line;
+}
@@ -0,0 +1,55 @@
+#ifndef LINEBUILDER_HPP
+#define LINEBUILDER_HPP
+
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include "payload.hpp"
+
+// Assembles one outgoing line from its pieces without temporary strings:
+//
+//     Payload line = (LineBuilder() << ":" << client->getPrefix() << " JOIN " << name).frame();
+//
+// Pieces are only referenced, so everything appended must outlive the
+// builder (one full expression, or named locals). frame() measures them,
+// takes one block from the buffer pool and copies each piece in, with
+// the CRLF, in a single pass.
+class LineBuilder {
+public:
+    static const size_t MAX_PIECES = 16;
+
+private:
+    struct Piece {
+        const char* data;
+        size_t      size;
+    };
+
+    Piece   _pieces[MAX_PIECES];
+    size_t  _count;
+    size_t  _size;      // Total bytes, without the CRLF
+
+public:
+    LineBuilder() : _count(0), _size(0) {}
+
+    LineBuilder& append(const char* data, size_t size) {
+        if (_count == MAX_PIECES) {
+            return *this; // Fixed-shape call sites never get here
+        }
+        _pieces[_count].data = data;
+        _pieces[_count].size = size;
+        _count++;
+        _size += size;
+        return *this;
+    }
+    LineBuilder& operator<<(const std::string& text) { return append(text.data(), text.size()); }
+    LineBuilder& operator<<(const char* text) { return append(text, strlen(text)); }
+
+    size_t size() const { return _size; }
+
+    // "<pieces>\r\n" as a shared payload
+    Payload frame() const;
+    // The same line unframed, for the few callers that keep it as a string
+    std::string str() const;
+};
+
+#endif // LINEBUILDER_HPP
@@ -0,0 +1,150 @@
+#include "outputqueue.hpp"
+#include "../metrics/metrics.hpp"
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+
+// Don't let a peer that went away kill the server with SIGPIPE
+#ifdef MSG_NOSIGNAL
+# define SEND_FLAGS MSG_NOSIGNAL
+#else
+# define SEND_FLAGS 0
+#endif
+
+// Chunks handed to the kernel per sendmsg() call
+#ifdef IOV_MAX
+static const size_t MAX_IOVECS = IOV_MAX;
+#else
+static const size_t MAX_IOVECS = 1024;
+#endif
+
+OutputQueue::OutputQueue() : _headOffset(0), _bytes(0), _gauge(NULL) {
+}
+
+OutputQueue::~OutputQueue() {
+    account(-static_cast<long>(_bytes));
+}
+
+void OutputQueue::setGauge(long* gauge) {
+    account(-static_cast<long>(_bytes));
+    _gauge = gauge;
+    account(static_cast<long>(_bytes));
+}
+
+void OutputQueue::account(long delta) {
+    if (_gauge && delta != 0) {
+        __atomic_add_fetch(_gauge, delta, __ATOMIC_RELAXED);
+    }
+}
+
+void OutputQueue::push(const Payload& message) {
+    if (!message.empty()) {
+        _messages.push_back(message);
+        _bytes += message.size();
+        account(static_cast<long>(message.size()));
+    }
+}
+
+void OutputQueue::clear() {
+    account(-static_cast<long>(_bytes));
+    _messages.clear();
+    _headOffset = 0;
+    _bytes = 0;
+}
+
+OutputQueue::Admission OutputQueue::admit(size_t size, Priority priority,
+                                          size_t softLimit, size_t hardLimit) const {
+    // A limit of 0 disables it
+    if (hardLimit > 0 && _bytes + size > hardLimit) {
+        return ADMIT_OVERFLOW;
+    }
+    if (priority == PRIORITY_LOW && softLimit > 0 && _bytes + size > softLimit) {
+        return ADMIT_DROP;
+    }
+    return ADMIT;
+}
+
+OutputQueue::FlushResult OutputQueue::flush(int fd) {
+    struct iovec iov[MAX_IOVECS];
+    
+    while (!_messages.empty()) {
+        // Gather as many queued chunks as one syscall accepts
+        size_t count = 0;
+        size_t total = 0;
+        for (std::deque<Payload>::const_iterator it = _messages.begin();
+             it != _messages.end() && count < MAX_IOVECS; ++it, ++count) {
+            size_t skip = (count == 0) ? _headOffset : 0;
+            iov[count].iov_base = const_cast<char*>(it->data() + skip);
+            iov[count].iov_len = it->size() - skip;
+            total += iov[count].iov_len;
+        }
+        
+        // sendmsg() rather than writev() so SEND_FLAGS can be passed
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t bytesSent = sendmsg(fd, &msg, SEND_FLAGS);
+        
+        if (bytesSent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                Metrics::instance().sendqDepth.record(_bytes);
+                return FLUSH_PENDING;  // Try again later
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return FLUSH_ERROR;
+        }
+        
+        consume(static_cast<size_t>(bytesSent));
+        if (static_cast<size_t>(bytesSent) < total) {
+            Metrics::instance().sendqDepth.record(_bytes);
+            return FLUSH_PENDING;  // Socket buffer is full
+        }
+    }
+    return FLUSH_DONE;
+}
+
+size_t OutputQueue::gather(char* buffer, size_t capacity) const {
+    size_t total = 0;
+    for (std::deque<Payload>::const_iterator it = _messages.begin();
+         it != _messages.end() && total < capacity; ++it) {
+        size_t skip = (it == _messages.begin()) ? _headOffset : 0;
+        size_t length = std::min(it->size() - skip, capacity - total);
+        memcpy(buffer + total, it->data() + skip, length);
+        total += length;
+    }
+    return total;
+}
+
+void OutputQueue::copy(std::string& out) const {
+    out.reserve(out.size() + _bytes);
+    for (std::deque<Payload>::const_iterator it = _messages.begin(); it != _messages.end(); ++it) {
+        size_t skip = (it == _messages.begin()) ? _headOffset : 0;
+        out.append(it->data() + skip, it->size() - skip);
+    }
+}
+
+void OutputQueue::consume(size_t sent) {
+    // Drop fully sent chunks, remember how far into the next one we got
+    if (_gauge) {
+        metricAdd(Metrics::instance().bytesSent, sent); // Client queues only
+    }
+    _bytes -= sent;
+    account(-static_cast<long>(sent));
+    while (sent > 0) {
+        size_t remaining = _messages.front().size() - _headOffset;
+        if (sent < remaining) {
+            _headOffset += sent;
+            break;
+        }
+        sent -= remaining;
+        _messages.pop_front();
+        _headOffset = 0;
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef OUTPUTQUEUE_HPP
+#define OUTPUTQUEUE_HPP
+
+#include <deque>
+#include "payload.hpp"
+
+// Framed lines waiting to be written to a socket. Used by Client in the
+// single-threaded loop and by IoWorker connections in threaded mode.
+// Entries are shared Payloads; flush() hands up to IOV_MAX of them to the
+// kernel in one vectored sendmsg(), and a partial write only advances an
+// offset into the head entry instead of copying the remainder.
+//
+// The queue also accounts its unsent bytes, which drives the send-queue
+// limits applied by admit() and, optionally, a shared gauge.
+class OutputQueue {
+private:
+    std::deque<Payload> _messages;      // Messages waiting to be sent
+    size_t              _headOffset;    // Bytes of the front message already sent
+    size_t              _bytes;         // Unsent bytes across all messages
+    long*               _gauge;         // Atomically tracks _bytes if set (metrics)
+
+    void account(long delta);
+
+    // Prevent copying: the gauge would be counted twice
+    OutputQueue(const OutputQueue& other);
+    OutputQueue& operator=(const OutputQueue& other);
+
+public:
+    enum FlushResult {
+        FLUSH_DONE,         // Everything was written
+        FLUSH_PENDING,      // Socket buffer full, wait for writability
+        FLUSH_ERROR         // Fatal socket error, connection is unusable
+    };
+
+    // Traffic classes for admit(): low-priority lines (channel chatter)
+    // are the first to go when a client falls behind
+    enum Priority {
+        PRIORITY_NORMAL,
+        PRIORITY_LOW
+    };
+
+    enum Admission {
+        ADMIT,              // Queue it
+        ADMIT_DROP,         // Past the soft limit: drop this low-priority line
+        ADMIT_OVERFLOW      // Past the hard limit: the client must be dropped
+    };
+
+    OutputQueue();
+    ~OutputQueue();
+
+    void setGauge(long* gauge);
+
+    void push(const Payload& message);
+    bool empty() const { return _messages.empty(); }
+    size_t size() const { return _messages.size(); }
+    size_t bytes() const { return _bytes; }
+    void clear();
+
+    // Send-queue policy for a message of `size` bytes
+    Admission admit(size_t size, Priority priority, size_t softLimit, size_t hardLimit) const;
+
+    // Write as much queued data as the socket accepts, vectored
+    FlushResult flush(int fd);
+
+    // For transports that cannot take an iovec (userspace TLS): copy up
+    // to `capacity` unsent bytes from the head into `buffer`, then mark
+    // how many of them were written
+    size_t gather(char* buffer, size_t capacity) const;
+    void consume(size_t bytes);
+
+    // Append every unsent byte to `out`, for another owner of the socket;
+    // the queue keeps them in case the handover fails
+    void copy(std::string& out) const;
+};
+
+#endif // OUTPUTQUEUE_HPP
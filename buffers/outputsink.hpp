@@ -0,0 +1,18 @@
+#ifndef OUTPUTSINK_HPP
+#define OUTPUTSINK_HPP
+
+#include "payload.hpp"
+#include "outputqueue.hpp"
+
+// Destination for a client's framed output other than its socket. A
+// Client with a sink hands every line to it instead of queueing for
+// send(), so command handling and channel fan-out can run against
+// in-memory clients (microbenchmarks, tooling) with no descriptors.
+class OutputSink {
+public:
+    virtual ~OutputSink() {}
+
+    virtual void deliver(const Payload& payload, OutputQueue::Priority priority) = 0;
+};
+
+#endif // OUTPUTSINK_HPP
@@ -0,0 +1,70 @@
+#include "payload.hpp"
+#include "bufferpool.hpp"
+#include <cstring>
+
+Payload::Block* Payload::allocate(size_t size) {
+    Block* block = static_cast<Block*>(bufferAllocate(offsetof(Block, data) + size));
+    block->refs = 1;
+    block->size = size;
+    return block;
+}
+
+void Payload::release() {
+    if (_block && __atomic_sub_fetch(&_block->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        bufferRelease(_block, offsetof(Block, data) + _block->size);
+    }
+    _block = NULL;
+}
+
+char* Payload::reserve(size_t size) {
+    release();
+    _block = allocate(size);
+    return _block->data;
+}
+
+Payload::Payload() : _block(NULL) {
+}
+
+Payload::Payload(const char* data, size_t size) : _block(NULL) {
+    if (size > 0) {
+        _block = allocate(size);
+        memcpy(_block->data, data, size);
+    }
+}
+
+Payload::Payload(const std::string& bytes) : _block(NULL) {
+    if (!bytes.empty()) {
+        _block = allocate(bytes.size());
+        memcpy(_block->data, bytes.data(), bytes.size());
+    }
+}
+
+Payload::Payload(const Payload& other) : _block(other._block) {
+    if (_block) {
+        __atomic_add_fetch(&_block->refs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+Payload& Payload::operator=(const Payload& other) {
+    if (_block != other._block) {
+        if (other._block) {
+            __atomic_add_fetch(&other._block->refs, 1, __ATOMIC_RELAXED);
+        }
+        release();
+        _block = other._block;
+    }
+    return *this;
+}
+
+Payload::~Payload() {
+    release();
+}
+
+Payload Payload::frame(const std::string& line) {
+    Payload payload;
+    char* out = payload.reserve(line.size() + 2);
+    memcpy(out, line.data(), line.size());
+    out[line.size()] = '\r';
+    out[line.size() + 1] = '\n';
+    return payload;
+}
@@ -0,0 +1,46 @@
+#ifndef PAYLOAD_HPP
+#define PAYLOAD_HPP
+
+#include <string>
+#include <cstddef>
+
+// Immutable, reference-counted byte buffer. A line is framed (CRLF
+// appended) once into a Payload and every recipient's output queue holds
+// a reference to the same bytes, so a broadcast costs one allocation no
+// matter how many members receive it. Blocks come from the size-classed
+// buffer pool. Copies only touch the refcount, which is atomic because
+// payloads cross into I/O worker threads.
+class Payload {
+private:
+    struct Block {
+        int     refs;       // Number of Payload handles sharing this block
+        size_t  size;       // Bytes in data
+        char    data[1];    // Actually `size` bytes
+    };
+
+    Block*  _block;         // NULL for the empty payload
+
+    static Block* allocate(size_t size);
+    void release();
+
+    // Fresh uninitialised block of `size` bytes, for LineBuilder to fill
+    char* reserve(size_t size);
+    friend class LineBuilder;
+
+public:
+    Payload();
+    Payload(const char* data, size_t size);
+    explicit Payload(const std::string& bytes);
+    Payload(const Payload& other);
+    Payload& operator=(const Payload& other);
+    ~Payload();
+
+    // Build "<line>\r\n" in a single allocation
+    static Payload frame(const std::string& line);
+
+    const char* data() const { return _block ? _block->data : ""; }
+    size_t size() const { return _block ? _block->size : 0; }
+    bool empty() const { return size() == 0; }
+};
+
+#endif // PAYLOAD_HPP
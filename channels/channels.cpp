@@ -1,24 +1,45 @@
 #include "channels.hpp"
 #include "../client/client.hpp"
-#include <algorithm>
+#include "../buffers/payload.hpp"
+#include "../utils/slabpool.hpp"
+#include "../server/handoff.hpp"
 #include <sstream>
 
-Channel::Channel(const std::string& name, Client* creator)
-    : _name(name), _userLimit(0), _inviteOnly(false), _topicRestricted(true) {
+namespace {
+
+const size_t CHANNELS_PER_SLAB = 64;
+
+SlabPool& channelPool() {
+    static SlabPool pool(sizeof(Channel), CHANNELS_PER_SLAB);
+    return pool;
+}
+
+} // namespace
+
+Channel::Channel(const std::string& name, Client* creator, size_t historyLines)
+    : _name(name), _userLimit(0), _inviteOnly(false), _topicRestricted(true), _namesValid(true),
+      _history(historyLines) {
     // Add creator as first client and operator
     addClient(creator);
     addOperator(creator);
 }
 
+void* Channel::operator new(size_t size) {
+    return channelPool().allocate(size);
+}
+
+void Channel::operator delete(void* channel, size_t size) {
+    channelPool().deallocate(channel, size);
+}
+
 Channel::~Channel() {
     // Remove all clients from the channel
-    std::vector<Client*> clientsCopy = _clients;
+    std::vector<Client*> clientsCopy = _members.items();
     for (std::vector<Client*>::iterator it = clientsCopy.begin(); it != clientsCopy.end(); ++it) {
         (*it)->leaveChannel(this);
     }
-    _clients.clear();
-    _operators.clear();
-    _invitedUsers.clear();
+    _members.clear();
+    _invites.clear();
 }
 
 const std::string& Channel::getName() const {
@@ -46,53 +67,55 @@ bool Channel::isTopicRestricted() const {
 }
 
 void Channel::addClient(Client* client) {
-    if (!hasClient(client)) {
-        _clients.push_back(client);
+    if (_members.insert(client) && _namesValid) {
+        // New members go last, so the cache is patched rather than rebuilt
+        appendName(client->getNickname());
     }
 }
 
 void Channel::removeClient(Client* client) {
-    std::vector<Client*>::iterator it = std::find(_clients.begin(), _clients.end(), client);
-    if (it != _clients.end()) {
-        _clients.erase(it);
+    // Operator status is a member flag and leaves with the member
+    if (_members.erase(client)) {
+        _namesValid = false;
     }
     
-    // Also remove from operators if they were one
-    removeOperator(client);
-    
     // If channel is empty, it should be deleted
     // This will be handled by the Server class
 }
 
 bool Channel::hasClient(Client* client) const {
-    return std::find(_clients.begin(), _clients.end(), client) != _clients.end();
+    return _members.contains(client);
 }
 
 const std::vector<Client*>& Channel::getClients() const {
-    return _clients;
+    return _members.items();
 }
 
 void Channel::addOperator(Client* client) {
-    // Only add as operator if they are in the channel
-    if (hasClient(client)) {
-        _operators.insert(client);
+    // Only members carry flags, so non-members are ignored
+    if (hasClient(client) && !isOperator(client)) {
+        _members.setFlags(client, MEMBER_OPERATOR, 0);
+        _namesValid = false;
     }
 }
 
 void Channel::removeOperator(Client* client) {
-    _operators.erase(client);
+    if (isOperator(client)) {
+        _members.setFlags(client, 0, MEMBER_OPERATOR);
+        _namesValid = false;
+    }
 }
 
 bool Channel::isOperator(Client* client) const {
-    return _operators.find(client) != _operators.end();
+    return (_members.flags(client) & MEMBER_OPERATOR) != 0;
 }
 
 void Channel::addInvite(Client* client) {
-    _invitedUsers.insert(client);
+    _invites.insert(client->getId());
 }
 
 bool Channel::isInvited(Client* client) const {
-    return _invitedUsers.find(client) != _invitedUsers.end();
+    return _invites.contains(client->getId());
 }
 
 void Channel::setTopic(const std::string& topic) {
@@ -116,32 +139,76 @@ void Channel::setTopicRestricted(bool restricted) {
 }
 
 void Channel::broadcastMessage(const std::string& message) {
-    for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        (*it)->sendData(message);
+    // Frame once; every member's queue shares the same buffer
+    Payload payload = Payload::frame(message);
+    const std::vector<Client*>& members = _members.items();
+    for (std::vector<Client*>::const_iterator it = members.begin(); it != members.end(); ++it) {
+        (*it)->sendPayload(payload);
     }
 }
 
-void Channel::broadcastMessage(const std::string& message, Client* except) {
-    for (std::vector<Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+void Channel::broadcastMessage(const std::string& message, Client* except, OutputQueue::Priority priority) {
+    broadcastPayload(Payload::frame(message), except, priority);
+}
+
+void Channel::broadcastPayload(const Payload& payload, Client* except, OutputQueue::Priority priority) {
+    // Already framed, e.g. a line relayed from a server link
+    const std::vector<Client*>& members = _members.items();
+    for (std::vector<Client*>::const_iterator it = members.begin(); it != members.end(); ++it) {
         if (*it != except) {
-            (*it)->sendData(message);
+            (*it)->sendPayload(payload, priority);
         }
     }
 }
 
-std::string Channel::getNamesList() const {
-    std::stringstream ss;
-    
-    for (std::vector<Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        // Add @ for operators
-        if (isOperator(*it)) {
-            ss << "@";
+void Channel::broadcastMarked(const Payload& payload, unsigned long mark, OutputQueue::Priority priority) {
+    const std::vector<Client*>& members = _members.items();
+    for (std::vector<Client*>::const_iterator it = members.begin(); it != members.end(); ++it) {
+        if ((*it)->markDelivered(mark)) {
+            (*it)->sendPayload(payload, priority);
         }
-        
-        ss << (*it)->getNickname() << " ";
     }
-    
-    return ss.str();
+}
+
+size_t Channel::namesBudget() const {
+    // 512 bytes minus CRLF, "353 <nick> = <channel> :" for the longest
+    // nickname, and room for a ":<server> " source prefix
+    const size_t SOURCE_RESERVE = 64;
+    size_t head = 4 + NICKNAME_MAX + 3 + _name.size() + 2;
+    if (head + SOURCE_RESERVE + NICKNAME_MAX + 1 > 510) {
+        return NICKNAME_MAX + 1; // Oversized channel name: one member per line
+    }
+    return 510 - SOURCE_RESERVE - head;
+}
+
+void Channel::appendName(const std::string& name) {
+    size_t budget = namesBudget();
+    if (_namesChunks.empty() || _namesChunks.back().size() + 1 + name.size() > budget) {
+        _namesChunks.push_back(std::string());
+        _namesChunks.back().reserve(budget);
+    } else {
+        _namesChunks.back() += ' ';
+    }
+    _namesChunks.back() += name;
+}
+
+const std::vector<std::string>& Channel::getNamesChunks() {
+    if (!_namesValid) {
+        _namesChunks.clear();
+        const std::vector<Client*>& members = _members.items();
+        std::string name;
+        for (size_t i = 0; i < members.size(); ++i) {
+            // Add @ for operators
+            name.clear();
+            if (_members.flagsAt(i) & MEMBER_OPERATOR) {
+                name += '@';
+            }
+            name += members[i]->getNickname();
+            appendName(name);
+        }
+        _namesValid = true;
+    }
+    return _namesChunks;
 }
 
 std::string Channel::getModeString() const {
@@ -169,4 +236,47 @@ std::string Channel::getModeString() const {
     }
     
     return modes + params;
-}
\ No newline at end of file
+}
+
+void Channel::saveState(SnapshotWriter& out) const {
+    out.putString(_topic);
+    out.putString(_password);
+    out.putU32(_userLimit);
+    out.putU8((_inviteOnly ? 1 : 0) | (_topicRestricted ? 2 : 0));
+    const std::vector<unsigned long>& invites = _invites.items();
+    out.putU32(static_cast<unsigned int>(invites.size()));
+    for (size_t i = 0; i < invites.size(); i++) {
+        out.putU64(invites[i]);
+    }
+    out.putU32(static_cast<unsigned int>(_history.size()));
+    for (size_t i = 0; i < _history.size(); i++) {
+        const ChannelHistory::Entry& entry = _history.at(i);
+        out.putU64(entry.time);
+        out.putU64(entry.id);
+        out.putBytes(entry.line.data(), entry.line.size());
+    }
+}
+
+bool Channel::restoreState(SnapshotReader& in, HistoryBudget& budget) {
+    _topic = in.getString();
+    _password = in.getString();
+    _userLimit = in.getU32();
+    unsigned int modes = in.getU8();
+    _inviteOnly = (modes & 1) != 0;
+    _topicRestricted = (modes & 2) != 0;
+    // Client ids carry over, so invites still name the same users
+    size_t invites = in.getU32();
+    for (size_t i = 0; i < invites && !in.failed(); i++) {
+        _invites.insert(static_cast<unsigned long>(in.getU64()));
+    }
+    size_t entries = in.getU32();
+    for (size_t i = 0; i < entries && !in.failed(); i++) {
+        WallMs time = in.getU64();
+        unsigned long id = static_cast<unsigned long>(in.getU64());
+        std::string line = in.getString();
+        if (!in.failed()) {
+            _history.restore(Payload(line), time, id, budget);
+        }
+    }
+    return !in.failed();
+}
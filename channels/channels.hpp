@@ -4,26 +4,45 @@
 
 #include <string>
 #include <vector>
-#include <set>
+#include "../utils/denseset.hpp"
+#include "../buffers/outputqueue.hpp"
+#include "../history/history.hpp"
 
 class Client;
+class SnapshotWriter;
+class SnapshotReader;
 
 class Channel {
+public:
+    // Per-member flag bits
+    enum {
+        MEMBER_OPERATOR = 1 << 0    // Channel operator (@)
+    };
+
 private:
     std::string _name;                // Channel name
     std::string _topic;               // Channel topic
     std::string _password;            // Channel password (for mode +k)
-    std::vector<Client*> _clients;    // Clients in the channel
-    std::set<Client*> _operators;     // Channel operators
+    DenseSet<Client*> _members;       // Clients in the channel, with MEMBER_* flags
     unsigned int _userLimit;          // User limit (for mode +l)
     bool _inviteOnly;                 // Invite-only flag (mode +i)
     bool _topicRestricted;            // Topic restricted to operators (mode +t)
-    std::set<Client*> _invitedUsers;  // Users invited to the channel
+    DenseSet<unsigned long> _invites; // Ids of invited non-members (ids are never reused)
+    std::vector<std::string> _namesChunks; // Cached 353 name lists, each fits one line
+    bool _namesValid;                 // _namesChunks matches the member list
+    ChannelHistory _history;          // Recent PRIVMSG/NOTICE lines, for CHATHISTORY
+
+    size_t namesBudget() const;
+    void appendName(const std::string& name);
 
 public:
-    Channel(const std::string& name, Client* creator);
+    Channel(const std::string& name, Client* creator, size_t historyLines = 0);
     ~Channel();
 
+    // Allocated from a slab pool, see utils/slabpool.hpp
+    static void* operator new(size_t size);
+    static void operator delete(void* channel, size_t size);
+
     // Getters
     const std::string& getName() const;
     const std::string& getTopic() const;
@@ -56,10 +75,29 @@ public:
 
     // Message operations
     void broadcastMessage(const std::string& message);
-    void broadcastMessage(const std::string& message, Client* except);
+    void broadcastMessage(const std::string& message, Client* except,
+                          OutputQueue::Priority priority = OutputQueue::PRIORITY_NORMAL);
+    void broadcastPayload(const Payload& payload, Client* except,
+                          OutputQueue::Priority priority = OutputQueue::PRIORITY_NORMAL);
+    // Only members not yet marked with `mark` (Server::nextDeliveryMark),
+    // so one fan-out over several channels reaches each member once
+    void broadcastMarked(const Payload& payload, unsigned long mark,
+                         OutputQueue::Priority priority = OutputQueue::PRIORITY_NORMAL);
     
+    // NAMES reply: member lists ("@op nick ...") chunked so that each 353
+    // line stays within 512 bytes. Joins append to the cache; parts, nick
+    // and operator changes invalidate it and the next call rebuilds it.
+    const std::vector<std::string>& getNamesChunks();
+    void invalidateNames() { _namesValid = false; }
+
+    ChannelHistory& getHistory() { return _history; }
+
+    // Hot restart: modes, invites and history (members are written by
+    // the server, which maps them to the clients it hands over)
+    void saveState(SnapshotWriter& out) const;
+    bool restoreState(SnapshotReader& in, HistoryBudget& budget);
+
     // Utility functions
-    std::string getNamesList() const;
     std::string getModeString() const;
 };
 
@@ -1,12 +1,92 @@
 #include "client.hpp"
 #include "../server/server.hpp"
 #include "../channels/channels.hpp"
-#include <iostream>
+#include "../eventloop/worker.hpp"
+#include "../parser/message.hpp"
+#include "../logger/logger.hpp"
+#include "../metrics/metrics.hpp"
+#include "../utils/slabpool.hpp"
+#include "../buffers/outputsink.hpp"
+#include "../buffers/linebuilder.hpp"
+#include "../links/linkmanager.hpp"
+#include "../tls/tls.hpp"
+#include "../server/handoff.hpp"
 #include <sstream>
 #include <algorithm>
 #include <unistd.h>
 #include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <sys/socket.h>
 
+namespace {
+
+// Connections come and go in bursts; one slab covers a typical wave
+const size_t CLIENTS_PER_SLAB = 256;
+
+// Threaded mode: input held back beyond this disconnects the client
+// ("Excess Flood"). Reading is paused as soon as input is held back, so
+// only what the worker read before it heard of it lands here.
+const size_t RECVQ_LIMIT = 256 * 1024;
+
+SlabPool& clientPool() {
+    static SlabPool pool(sizeof(Client), CLIENTS_PER_SLAB);
+    return pool;
+}
+
+// Fixed part of a numeric sent to every client: "<code> <nick><text>"
+struct NumericTemplate {
+    const char* code;       // "002 ", always four bytes
+    const char* text;
+    size_t      textLength;
+};
+
+#define NUMERIC_TEMPLATE(code, text) { code " ", text, sizeof(text) - 1 }
+
+// Registration burst after 001, which carries the prefix, and before
+// the 005 that depends on the configuration
+const NumericTemplate WELCOME_BURST[] = {
+    NUMERIC_TEMPLATE("002", " :Your host is ft_irc, running version 1.0"),
+    NUMERIC_TEMPLATE("003", " :This server was created today"),
+    NUMERIC_TEMPLATE("004", " ft_irc 1.0 o o"),
+};
+
+const NumericTemplate MOTD_MISSING = NUMERIC_TEMPLATE("422", " :MOTD File is missing");
+
+#undef NUMERIC_TEMPLATE
+
+// Batch references are per connection; one counter keeps them unique
+unsigned long g_nextBatch = 1;
+
+// Position of a CHATHISTORY reference ("timestamp=..." or "msgid=...")
+// in `history`: `before` entries are older, those from `after` on newer
+bool locateReference(const ChannelHistory& history, const std::string& reference,
+                     size_t& before, size_t& after) {
+    if (reference.compare(0, 10, "timestamp=") == 0) {
+        WallMs time;
+        if (!parseTimestamp(reference.substr(10), time)) {
+            return false;
+        }
+        before = history.firstAtOrAfter(time);
+        after = history.firstAfter(time);
+        return true;
+    }
+    if (reference.compare(0, 6, "msgid=") == 0) {
+        char* end = NULL;
+        unsigned long id = std::strtoul(reference.c_str() + 6, &end, 10);
+        if (reference.size() == 6 || *end != '\0') {
+            return false;
+        }
+        bool found;
+        before = history.findId(id, found);
+        after = found ? before + 1 : before;
+        return true;
+    }
+    return false;
+}
+
+} // namespace
 
 // Utility function to split a string by delimiters
 std::vector<std::string> split(const std::string& s, char delimiter) {
@@ -19,16 +99,33 @@ std::vector<std::string> split(const std::string& s, char delimiter) {
     return tokens;
 }
 
-Client::Client(int fd, Server* server)
-        : _fd(fd), _server(server), _authenticated(false), _isOperator(false), _disconnected(false) {
+Client::Client(int fd, Server* server, unsigned long id)
+        : _fd(fd), _socket(fd), _id(id), _sourceKey(0), _server(server), _authenticated(false), _isOperator(false), _disconnected(false),
+          _passwordValidated(false), _buffer(INPUT_BUFFER_SIZE), _worker(NULL), _sink(NULL), _tls(NULL), _link(NULL),
+          _flushScheduled(false), _writeArmed(false), _deliveryMark(0), _lastActivity(0), _lastCommand(0),
+          _pingSent(0), _awaitingPong(false), _floodClock(0), _inputRound(0), _roundLines(0),
+          _inputDeferred(false), _readStalled(false), _backlogged(false), _lookupDeadline(0),
+          _secure(false) {
+        _outgoingMessages.setGauge(&Metrics::instance().sendqBytes);
+        rebuildPrefix();
     }
     
+void* Client::operator new(size_t size) {
+    return clientPool().allocate(size);
+}
+
+void Client::operator delete(void* client, size_t size) {
+    clientPool().deallocate(client, size);
+}
+
 Client::~Client() {
     // Leave all channels
-    std::vector<Channel*> channelsCopy = _channels;
+    std::vector<Channel*> channelsCopy = _channels.items();
     for (std::vector<Channel*>::iterator it = channelsCopy.begin(); it != channelsCopy.end(); ++it) {
         leaveChannel(*it);
     }
+    // Before _socket closes the descriptor it writes to
+    delete _tls;
 }
 
 int Client::getFd() const {
@@ -47,6 +144,13 @@ const std::string& Client::getHostname() const {
     return _hostname;
 }
 
+void Client::rebuildPrefix() {
+    _prefix.clear();
+    _prefix.reserve(_nickname.size() + _username.size() + _hostname.size() + 2);
+    _prefix.append(_nickname).append(1, '!').append(_username).append(1, '@');
+    _prefix.append(_hostname.empty() ? std::string("host") : _hostname);
+}
+
 bool Client::isAuthenticated() const {
     return _authenticated;
 }
@@ -55,16 +159,40 @@ bool Client::isOperator() const {
     return _isOperator;
 }
 
+bool isValidNickname(const std::string& nickname) {
+    return !nickname.empty() && nickname.size() <= NICKNAME_MAX
+           && nickname.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789[]\\`_^{|}")
+                  == std::string::npos;
+}
+
 void Client::setNickname(const std::string& nickname) {
     _nickname = nickname;
+    rebuildPrefix();
+}
+
+bool Client::changeNickname(const std::string& nickname) {
+    // Constant-time collision check through the server's nickname index
+    if (!_server->claimNickname(this, nickname)) {
+        return false;
+    }
+    setNickname(nickname);
+    
+    // Cached NAMES replies hold the old spelling
+    const std::vector<Channel*>& channels = _channels.items();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        channels[i]->invalidateNames();
+    }
+    return true;
 }
 
 void Client::setUsername(const std::string& username) {
     _username = username;
+    rebuildPrefix();
 }
 
 void Client::setHostname(const std::string& hostname) {
     _hostname = hostname;
+    rebuildPrefix();
 }
 
 void Client::setAuthenticated(bool authenticated) {
@@ -76,117 +204,277 @@ void Client::setOperator(bool isOperator) {
 }
 
 void Client::joinChannel(Channel* channel) {
-    if (!isInChannel(channel)) {
-        _channels.push_back(channel);
+    if (_channels.insert(channel)) {
+        settleHostname(); // The members see our prefix from now on
         channel->addClient(this);
     }
 }
 
 void Client::leaveChannel(Channel* channel) {
-    std::vector<Channel*>::iterator it = std::find(_channels.begin(), _channels.end(), channel);
-    if (it != _channels.end()) {
-        _channels.erase(it);
+    if (_channels.erase(channel)) {
         channel->removeClient(this);
     }
 }
 
 bool Client::isInChannel(Channel* channel) const {
-    return std::find(_channels.begin(), _channels.end(), channel) != _channels.end();
+    return _channels.contains(channel);
 }
 
 const std::vector<Channel*>& Client::getChannels() const {
-    return _channels;
+    return _channels.items();
 }
 
 bool Client::receiveData() {
-    char buffer[4096]; // Larger buffer
-    ssize_t bytesRead = recv(_fd, buffer, sizeof(buffer) - 1, 0);
-    
-    if (bytesRead <= 0) {
-        if (bytesRead == 0) {
-            // Connection closed
-            std::cout << "Client " << _nickname << " disconnected" << std::endl;
-        } else {
-            // Error reading
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return true; // Not an error, just no data available
+    // The socket is edge-triggered: keep reading until the kernel buffer
+    // is drained, otherwise no further readiness event will be reported
+    while (!_disconnected) {
+        // TLS: finish the handshake first; it reads until EAGAIN as well
+        if (_tls && !_tls->established()) {
+            TlsStream::Handshake state = _tls->handshake();
+            if (state == TlsStream::HANDSHAKE_FAILED) {
+                return false;
+            }
+            if (state == TlsStream::HANDSHAKE_WANT_WRITE && !_writeArmed) {
+                _writeArmed = true;
+                _server->setWriteInterest(_fd, true);
+            }
+            if (state != TlsStream::HANDSHAKE_DONE) {
+                return true;
             }
-            std::cerr << "Error receiving data: " << strerror(errno) << std::endl;
         }
-        return false;
+        
+        // Receive straight into the framing buffer, no intermediate copy.
+        // Full of lines that must wait: leave the rest in the socket
+        // (its window closes on the sender) until resumeInput().
+        size_t room = _buffer.writable();
+        if (room == 0 && _inputDeferred) {
+            _readStalled = true;
+            return true;
+        }
+        ssize_t bytesRead = _tls ? _tls->recv(_buffer.writePtr(), room) : recv(_fd, _buffer.writePtr(), room, 0);
+        
+        if (bytesRead <= 0) {
+            if (bytesRead == 0) {
+                // Connection closed
+                LOG_INFO("Client " << _nickname << " disconnected");
+            } else {
+                // Error reading
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true; // Not an error, just no data available
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOG_ERROR("Error receiving data: " << strerror(errno));
+            }
+            return false;
+        }
+        
+        LOG_DEBUG("Received from fd " << _fd << ": " << std::string(_buffer.writePtr(), bytesRead));
+        metricAdd(Metrics::instance().bytesReceived, static_cast<unsigned long>(bytesRead));
+        
+        _buffer.commit(bytesRead);
+        
+        // Process complete commands
+        processData();
     }
     
-    buffer[bytesRead] = '\0';
-    _buffer += buffer;
-    
-    // In receiveData():
-    std::cout << "Received data: " << buffer << std::endl;
-    
-    // Process complete commands
-    processData();
-    
     return true;
 }
 
-void Client::sendPendingData() {
-    while (!_outgoingMessages.empty()) {
-        std::string& message = _outgoingMessages.front();
-        
-        ssize_t bytesSent = send(_fd, message.c_str(), message.size(), -1);////////////////////////
-        
-        if (bytesSent < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return;  // Try again later
+void Client::receiveBytes(const char* data, size_t length) {
+    // Threaded mode: bytes were read by the I/O worker
+    LOG_DEBUG("Received from fd " << _fd << ": " << std::string(data, length));
+    
+    // Behind earlier bytes that are still waiting
+    if (!_spill.empty()) {
+        _spill.append(data, length);
+        drainSpill();
+        return;
+    }
+    
+    while (length > 0 && !_disconnected) {
+        size_t chunk = std::min(length, _buffer.writable());
+        if (chunk == 0) {
+            // Full of lines that must wait; the worker already read the
+            // socket, so keep what follows aside and stop it reading more
+            _spill.assign(data, length);
+            if (_worker && !_readStalled) {
+                _readStalled = true;
+                _worker->pauseReading(_fd, _id);
             }
-            // Error case
-            setDisconnected();
+            drainSpill();
             return;
         }
-        else if (static_cast<size_t>(bytesSent) < message.size()) {
-            // Keep remainder in queue
-            message = message.substr(bytesSent);
-            return;
+        memcpy(_buffer.writePtr(), data, chunk);
+        _buffer.commit(chunk);
+        data += chunk;
+        length -= chunk;
+        
+        // Process complete commands
+        processData();
+    }
+}
+
+void Client::drainSpill() {
+    size_t offset = 0;
+    while (offset < _spill.size() && !_disconnected) {
+        size_t chunk = std::min(_spill.size() - offset, _buffer.writable());
+        if (chunk == 0) {
+            break;
         }
-        else {
-            // Message fully sent
-            _outgoingMessages.pop();
+        memcpy(_buffer.writePtr(), _spill.data() + offset, chunk);
+        _buffer.commit(chunk);
+        offset += chunk;
+        processData();
+    }
+    _spill.erase(0, offset);
+    if (_spill.empty() && _readStalled && _worker) {
+        _readStalled = false;
+        _worker->resumeReading(_fd, _id);
+    }
+    
+    if (_spill.size() > RECVQ_LIMIT) {
+        LOG_WARNING("Excess flood from fd " << _fd << " (" << _spill.size() << " bytes waiting)");
+        metricIncrement(Metrics::instance().floodEvicted);
+        _spill.clear();
+        sendData("ERROR :Excess Flood");
+        setDisconnected();
+    }
+}
+
+void Client::resumeInput() {
+    _backlogged = false;
+    if (_disconnected || !_inputDeferred) {
+        return;
+    }
+    processLines();
+    if (!_spill.empty()) {
+        drainSpill();
+    } else if (_readStalled && !_inputDeferred && !_worker) {
+        // Room again: pick up what the socket kept for us
+        _readStalled = false;
+        if (!receiveData()) {
+            setDisconnected();
         }
     }
 }
 
+OutputQueue::FlushResult Client::flushOutput() {
+    return _tls ? _tls->flush(_outgoingMessages) : _outgoingMessages.flush(_fd);
+}
+
+void Client::sendPendingData() {
+    _flushScheduled = false;
+    if (_tls && !_tls->established() && _writeArmed) {
+        // Writability the handshake was waiting for
+        _writeArmed = false;
+        _server->setWriteInterest(_fd, false);
+        if (!receiveData()) {
+            setDisconnected();
+        }
+        return;
+    }
+    OutputQueue::FlushResult result = flushOutput();
+    
+    if (result == OutputQueue::FLUSH_ERROR) {
+        LOG_ERROR("Error sending to client " << _nickname << ": " << strerror(errno));
+        setDisconnected();
+        _outgoingMessages.clear();
+    }
+    else if (result == OutputQueue::FLUSH_PENDING && !_writeArmed) {
+        // Socket buffer full, wait for writability
+        _writeArmed = true;
+        _server->setWriteInterest(_fd, true);
+    }
+    else if (result == OutputQueue::FLUSH_DONE && _writeArmed) {
+        // Queue drained: stop asking for write notifications
+        _writeArmed = false;
+        _server->setWriteInterest(_fd, false);
+    }
+}
+
+void Client::setDisconnected() {
+    if (!_disconnected) {
+        _disconnected = true;
+        _server->scheduleRemoval(this);
+    }
+}
+
+bool Client::isHandshaking() const {
+    return _tls && !_tls->established();
+}
+
+void Client::flushBeforeClose() {
+    if (!_worker) {
+        flushOutput();
+    }
+}
+
 void Client::sendData(const std::string& message) {
     if (_disconnected) {
         return;  // Don't try to send to disconnected clients
     }
+    sendPayload(Payload::frame(message));
+}
 
-    std::string fullMessage = message + "\r\n";
+void Client::sendPayload(const Payload& payload, OutputQueue::Priority priority) {
+    // Remote users are served by their own server, which gets the
+    // relayed line through the LinkManager instead
+    if (_disconnected || _link) {
+        return;
+    }
     
-    // Try immediate send if no queued messages
-    if (_outgoingMessages.empty()) {
-        ssize_t bytesSent = send(_fd, fullMessage.c_str(), fullMessage.size(), -1);
-        
-        if (bytesSent < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // Socket buffer full, queue for later
-                _outgoingMessages.push(fullMessage);
-                return;
-            }
-            // Real error occurred
-            std::cerr << "Error sending to client " << _nickname << ": " << strerror(errno) << std::endl;
-            setDisconnected();
-            return;
-        }
-        else if (static_cast<size_t>(bytesSent) < fullMessage.size()) {
-            // Partial send, queue remainder
-            _outgoingMessages.push(fullMessage.substr(bytesSent));
+    if (_sink) {
+        _sink->deliver(payload, priority);
+        return;
+    }
+    
+    // Threaded mode: the owning worker writes it out and enforces the limits
+    if (_worker) {
+        _worker->enqueue(_fd, _id, payload, priority);
+        return;
+    }
+    
+    const ServerConfig& config = _server->getConfig();
+    
+    // Corked output counts against the limits too: write it out early
+    // rather than penalise a client for a burst within one iteration
+    if (!_writeArmed && _outgoingMessages.bytes() + payload.size() > config.sendqSoftLimit) {
+        sendPendingData();
+        if (_disconnected) {
             return;
         }
-        // Full message sent successfully
+    }
+    
+    switch (_outgoingMessages.admit(payload.size(), priority, config.sendqSoftLimit, config.sendqHardLimit)) {
+    case OutputQueue::ADMIT_DROP:
+        metricIncrement(Metrics::instance().sendqDropped);
+        return;
+    case OutputQueue::ADMIT_OVERFLOW:
+        overflowSendQueue();
         return;
+    case OutputQueue::ADMIT:
+        break;
     }
     
-    // Already have queued messages, just add to queue
-    _outgoingMessages.push(fullMessage);
+    // Queue and flush once at the end of the loop iteration, so a burst of
+    // replies leaves in one vectored write. While write interest is armed
+    // the next writability event flushes instead.
+    _outgoingMessages.push(payload);
+    if (!_flushScheduled && !_writeArmed) {
+        _flushScheduled = true;
+        _server->scheduleFlush(this);
+    }
+}
+
+void Client::overflowSendQueue() {
+    // Slow consumer: give up on its backlog, tell it why and drop it
+    LOG_WARNING("SendQ exceeded for fd " << _fd << " (" << _outgoingMessages.bytes() << " bytes queued)");
+    metricIncrement(Metrics::instance().sendqEvicted);
+    _outgoingMessages.clear();
+    _outgoingMessages.push(Payload::frame("ERROR :SendQ exceeded"));
+    setDisconnected();
 }
 
 // void Client::sendData(const std::string& message) {
@@ -214,158 +502,230 @@ void Client::sendData(const std::string& message) {
 // }
 // }
 
-void Client::parseAndHandleCommand(const std::string& line) {
-    // Parse command
-    std::string prefix = "";
-    std::string command;
-    std::vector<std::string> params;
-    
-    // Extract prefix if present
-    size_t start = 0;
-    if (line[0] == ':') {
-        size_t prefixEnd = line.find(' ');
-        if (prefixEnd == std::string::npos) {
-            return; // Invalid format
-        }
-        prefix = line.substr(1, prefixEnd - 1);
-        start = prefixEnd + 1;
-        while (start < line.size() && line[start] == ' ') {
-            start++;
-        }
+void Client::parseAndHandleCommand(char* line, size_t length) {
+    // Parse into views over the input buffer; no allocation
+    IrcMessage message;
+    if (!parseMessage(line, length, message)) {
+        return; // Invalid format
     }
     
-    // Extract command
-    size_t cmdEnd = line.find(' ', start);
-    if (cmdEnd == std::string::npos) {
-        command = line.substr(start);
-    } else {
-        command = line.substr(start, cmdEnd - start);
-        // std::cout << "Processing command: " << command << std::endl;
-        
-        // Extract parameters
-        size_t paramStart = cmdEnd + 1;
-        while (paramStart < line.size() && line[paramStart] == ' ') {
-            paramStart++;
-        }
-        
-        // Handle trailing parameter (starts with :)
-        size_t trailingStart = line.find(" :", paramStart);
-        if (trailingStart != std::string::npos) {
-            // Extract space-separated parameters before the trailing parameter
-            std::string normalParams = line.substr(paramStart, trailingStart - paramStart);
-            if (!normalParams.empty()) {
-                std::istringstream iss(normalParams);
-                std::string param;
-                while (iss >> param) {
-                    params.push_back(param);
-                }
-            }
-            
-            // Add trailing parameter
-            params.push_back(line.substr(trailingStart + 2));
-        } else {
-            // Extract all space-separated parameters
-            std::istringstream iss(line.substr(paramStart));
-            std::string param;
-            while (iss >> param) {
-                params.push_back(param);
-            }
-        }
-        
-        // In parseAndHandleCommand():
+    // Paid up front, so a command that disconnects still counts
+    chargeLine(message);
     
-    }
+    // Handle the command, timed per command for the metrics endpoint
+    unsigned long long start = monotonicNanos();
+    handleCommand(message);
+    Metrics::instance().commandNanos[message.commandId].record(monotonicNanos() - start);
+}
+
+void Client::processData() {
+    // Any traffic proves the connection is alive
+    _lastActivity = _server->now();
+    _awaitingPong = false;
     
-    // Convert command to uppercase for case-insensitive comparison
-    std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+    processLines();
     
-    // Handle the command
-    handleCommand(command, params);
+    // Handle buffer overflow protection - if the buffer fills up without
+    // a \r\n, the client might be sending malformed data (a buffer full
+    // of lines waiting their turn is fine)
+    if (_buffer.full() && !_inputDeferred) { // 8KB limit
+        sendData("ERROR :Client exceeded buffer size limit");
+        _buffer.clear();
+    }
 }
 
-void Client::processData() {
-    size_t pos;
-    // Process as many complete commands as possible
-    while ((pos = _buffer.find("\r\n")) != std::string::npos) {
-        std::string line = _buffer.substr(0, pos);
-        _buffer.erase(0, pos + 2); // Remove processed command
-        
+void Client::processLines() {
+    char* line;
+    size_t length;
+    
+    // Process as many complete commands as flood control and the line
+    // budget allow; lines are views into the input buffer, valid until
+    // the next receive
+    _inputDeferred = false;
+    while (!_disconnected && admitLine() && _buffer.nextLine(line, length)) {
         // Skip empty lines
-        if (line.empty()) {
+        if (length == 0) {
             continue;
         }
         
         // Parse and handle command
-        parseAndHandleCommand(line);
+        _roundLines++;
+        metricIncrement(Metrics::instance().linesParsed);
+        parseAndHandleCommand(line, length);
     }
+}
+
+bool Client::admitLine() {
+    if (_buffer.size() == 0) {
+        return true; // Nothing to hold back; nextLine() ends the loop
+    }
+    const ServerConfig& config = _server->getConfig();
     
-    // Handle buffer overflow protection - if buffer gets too large without
-    // finding a \r\n, the client might be sending malformed data
-    if (_buffer.size() > 8192) { // 8KB limit
-        sendData("ERROR :Client exceeded buffer size limit");
-        _buffer.clear();
+    // Fairness: at most linesPerWakeup lines per loop iteration, the rest
+    // run in the next one after every other client had its turn
+    if (config.linesPerWakeup > 0) {
+        if (_inputRound != _server->iteration()) {
+            _inputRound = _server->iteration();
+            _roundLines = 0;
+        }
+        if (_roundLines >= config.linesPerWakeup) {
+            _inputDeferred = true;
+            metricIncrement(Metrics::instance().linesDeferred);
+            if (!_backlogged) {
+                _backlogged = true;
+                _server->scheduleBacklog(this);
+            }
+            return false;
+        }
+    }
+    
+    // Flood control: a token bucket kept as a virtual clock that runs
+    // ahead of real time by the cost spent and not yet paid back. Lines
+    // wait while it is more than the burst ahead; the timer resumes them.
+    if (config.floodRate > 0 && _authenticated) {
+        unsigned long long now = _server->now() * 1000ULL;
+        if (_floodClock > now + config.floodBurst * 1000000ULL / config.floodRate) {
+            _inputDeferred = true;
+            metricIncrement(Metrics::instance().linesDeferred);
+            _server->armTimer(this, nextDeadline());
+            return false;
+        }
     }
+    return true;
+}
+
+void Client::chargeLine(const IrcMessage& message) {
+    const ServerConfig& config = _server->getConfig();
+    if (config.floodRate == 0 || !_authenticated) {
+        return;
+    }
+    // Lists ("JOIN #a,#b,#c") pay for every target
+    const CommandSpec& spec = commandSpec(message.commandId);
+    size_t cost = spec.cost;
+    if ((spec.flags & CMD_COST_PER_TARGET) && message.paramCount > 0) {
+        const StringView& targets = message.params[0];
+        cost *= 1 + std::count(targets.data, targets.data + targets.length, ',');
+    }
+    unsigned long long now = _server->now() * 1000ULL;
+    _floodClock = std::max(_floodClock, now) + cost * 1000000ULL / config.floodRate;
 }
 
 void Client::completeRegistration() {
+    // A lookup still in flight does not hold the welcome up: it goes out
+    // with the address, which the answer may replace later (hostnameResolved)
     _authenticated = true;
     
-    // Send welcome messages
-    sendData("001 " + _nickname + " :Welcome to the Internet Relay Network " + _nickname + "!" + _username + "@host");
-    sendData("002 " + _nickname + " :Your host is ft_irc, running version 1.0");
-    sendData("003 " + _nickname + " :This server was created today");
-    sendData("004 " + _nickname + " ft_irc 1.0 o o");
+    // Replace the registration deadline with keepalive/idle tracking
+    _lastActivity = _lastCommand = _server->now();
+    _timer.unlink();
+    TimeMs next = nextDeadline();
+    if (next) {
+        _server->armTimer(this, next);
+    }
     
-    // MOTD would go here
-    sendData("422 " + _nickname + " :MOTD File is missing");
+    // Linked servers learn about the user once it is registered
+    if (LinkManager* links = _server->getLinks()) {
+        settleHostname();
+        links->introduce(this);
+    }
+    
+    // Send welcome messages; the MOTD would go after 004, instead of 422
+    sendPayload((LineBuilder() << "001 " << _nickname << " :Welcome to the Internet Relay Network "
+                               << _prefix).frame());
+    for (size_t i = 0; i < sizeof(WELCOME_BURST) / sizeof(WELCOME_BURST[0]); i++) {
+        const NumericTemplate& numeric = WELCOME_BURST[i];
+        sendPayload((LineBuilder().append(numeric.code, 4) << _nickname)
+                        .append(numeric.text, numeric.textLength).frame());
+    }
+    size_t historyLines = _server->getConfig().historyLines;
+    if (historyLines > 0) {
+        std::ostringstream isupport;
+        isupport << "005 " << _nickname << " CHATHISTORY=" << historyLines
+                 << " MSGREFTYPES=timestamp,msgid :are supported by this server";
+        sendData(isupport.str());
+    }
+    sendPayload((LineBuilder().append(MOTD_MISSING.code, 4) << _nickname)
+                    .append(MOTD_MISSING.text, MOTD_MISSING.textLength).frame());
+}
+
+void Client::hostnameResolved(const std::string& hostname) {
+    // Late, or others already know us by the address: the answer only
+    // went into the resolver's cache
+    if (!_lookupDeadline || _server->now() > _lookupDeadline) {
+        _lookupDeadline = 0;
+        return;
+    }
+    _lookupDeadline = 0;
+    setHostname(hostname);
 }
 
-void Client::handleCommand(const std::string& command, const std::vector<std::string>& params) {
-    // This is where you'd implement handling of different IRC commands
-    // For now, just print the command and parameters
-    bool _passwordValidated = false;
-    std::cout << "Command: " << command << std::endl;
-    std::cout << "Parameters: ";
-    for (size_t i = 0; i < params.size(); i++) {
-        std::cout << "[" << params[i] << "] ";
+// Indexed by CommandId; NULL for commands that are recognised (so the
+// registration check applies) but not implemented yet
+const Client::CommandHandler Client::_commandHandlers[CMD_COUNT] = {
+    NULL,                   // CMD_UNKNOWN
+    &Client::handlePass,    // CMD_PASS
+    &Client::handleNick,    // CMD_NICK
+    &Client::handleUser,    // CMD_USER
+    &Client::handleJoin,    // CMD_JOIN
+    &Client::handleTopic,   // CMD_TOPIC
+    &Client::handlePrivmsg, // CMD_PRIVMSG
+    &Client::handleNotice,  // CMD_NOTICE
+    &Client::handlePart,    // CMD_PART
+    NULL,                   // CMD_MODE
+    NULL,                   // CMD_INVITE
+    NULL,                   // CMD_KICK
+    NULL,                   // CMD_QUIT
+    &Client::handlePing,    // CMD_PING
+    &Client::handlePong,    // CMD_PONG
+    &Client::handleNames,   // CMD_NAMES
+    &Client::handleChathistory // CMD_CHATHISTORY
+};
+
+void Client::handleCommand(const IrcMessage& message) {
+    LOG_DEBUG("Command from fd " << _fd << ": " << message.command.str() << " (" << message.paramCount << " parameters)");
+    
+    // The command was interned by the parser: no string compares from here on
+    const CommandSpec& spec = commandSpec(message.commandId);
+    if (spec.id == CMD_UNKNOWN) {
+        return;
     }
-    std::cout << std::endl;
     
-    // First check for commands that require authentication
-    if (command == "JOIN" || command == "PRIVMSG" || command == "PART" || 
-        command == "MODE" || command == "TOPIC" || command == "INVITE") {
-        if (!_authenticated) {
-            sendData("451 :You have not registered");
-            return;
-        }
+    if ((spec.flags & CMD_NEEDS_REGISTRATION) && !_authenticated) {
+        sendData("451 :You have not registered");
+        return;
     }
-    // Basic command handling examples:
-    if (command == "PASS") {
-    if (_authenticated) {
+    
+    if ((spec.flags & CMD_REGISTRATION_ONLY) && _authenticated) {
         sendData("462 :You may not reregister");
         return;
     }
     
-    if (params.size() < 1) {
-        sendData("461 PASS :Not enough parameters");
+    if (message.paramCount < spec.minParams) {
+        sendData("461 " + (_nickname.empty() ? std::string("*") : _nickname) + " " + spec.name + " :Not enough parameters");
         return;
     }
     
-    if (_server->checkPassword(params[0])) {
+    if (spec.id != CMD_PING && spec.id != CMD_PONG) {
+        _lastCommand = _server->now();
+    }
+    
+    CommandHandler handler = _commandHandlers[spec.id];
+    if (handler) {
+        (this->*handler)(message);
+    }
+}
+
+void Client::handlePass(const IrcMessage& message) {
+    if (_server->checkPassword(message.param(0))) {
         _passwordValidated = true;
     } else {
         sendData("464 :Password incorrect");
         setDisconnected();
     }
 }
-    // Add this to Client::handleCommand
-    else if (command == "TOPIC") {
-        if (params.size() < 1) {
-            sendData("461 " + _nickname + " TOPIC :Not enough parameters");
-        return;
-    }
-    
-    std::string channelName = params[0];
+
+void Client::handleTopic(const IrcMessage& message) {
+    std::string channelName = message.param(0);
     Channel* channel = _server->getChannel(channelName);
     
     if (!channel) {
@@ -380,7 +740,7 @@ void Client::handleCommand(const std::string& command, const std::vector<std::st
     }
     
     // If no second parameter, return the topic
-    if (params.size() == 1) {
+    if (message.paramCount == 1) {
         const std::string& topic = channel->getTopic();
         if (!topic.empty()) {
             sendData("332 " + _nickname + " " + channelName + " :" + topic);
@@ -397,66 +757,62 @@ void Client::handleCommand(const std::string& command, const std::vector<std::st
     }
     
     // Set the new topic
-    channel->setTopic(params[1]);
+    channel->setTopic(message.param(1));
     
-    // Notify all clients in the channel
-    channel->broadcastMessage(":" + _nickname + "!" + _username + "@host TOPIC " + channelName + " :" + params[1]);
+    // Notify all clients in the channel, here and on linked servers
+    Payload line = (LineBuilder() << ":" << _prefix << " TOPIC " << channelName << " :" << channel->getTopic()).frame();
+    channel->broadcastPayload(line, NULL);
+    if (LinkManager* links = _server->getLinks()) {
+        links->propagate(line);
+    }
 }
-    else if (command == "NICK") {
-    if (params.size() < 1) {
+
+void Client::handleNick(const IrcMessage& message) {
+    if (message.paramCount < 1) {
         sendData("431 :No nickname given");
         return;
     }
     
-    std::string newNick = params[0];
+    std::string newNick = message.param(0);
     
     // Validate nickname format
-    if (newNick.empty() || newNick.size() > 9 || 
-        newNick.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789[]\\`_^{|}") != std::string::npos) {
+    if (!isValidNickname(newNick)) {
         sendData("432 " + newNick + " :Erroneous nickname");
         return;
     }
     
-    // TODO: Check if nickname is already in use
-    
-    _nickname = newNick;
+    if (newNick == _nickname) {
+        return;
+    }
     
-    // If we have USER command and password, complete registration
-    if (!_username.empty() && _passwordValidated && !_authenticated) {
-        completeRegistration();
+    std::string oldPrefix = getPrefix();
+    if (!changeNickname(newNick)) {
+        sendData("433 " + (_nickname.empty() ? std::string("*") : _nickname) + " " + newNick + " :Nickname is already in use");
+        return;
     }
-}
-    // else if (command == "NICK") {
-    //     // Set nickname
-    //     if (params.size() < 1) {
-    //         sendData("431 :No nickname given");
-    //         return;
-    //     }
-        
-    //     std::string newNick = params[0];
-    //     // Check if nickname is valid and not already taken
-    //     // For simplicity, we're not implementing these checks here
-        
-    //     _nickname = newNick;
-    //     sendData(":" + _nickname + " NICK :" + _nickname);
-    // }
-    else if (command == "USER") {
+    
     if (_authenticated) {
-        sendData("462 :You may not reregister");
+        Payload line = (LineBuilder() << ":" << oldPrefix << " NICK :" << newNick).frame();
+        notifyPeers(line);
+        if (LinkManager* links = _server->getLinks()) {
+            links->propagate(line);
+        }
         return;
     }
     
+    // If we have USER command and password, complete registration
+    if (!_username.empty() && _passwordValidated) {
+        completeRegistration();
+    }
+}
+
+void Client::handleUser(const IrcMessage& message) {
     if (!_passwordValidated) {
         sendData("464 :Password required");
         return;
     }
     
-    if (params.size() < 4) {
-        sendData("461 USER :Not enough parameters");
-        return;
-    }
-    
-    _username = params[0];
+    setUsername(message.param(0));
     // params[1] and params[2] are mode and unused
     // params[3] is the real name
     
@@ -465,70 +821,480 @@ void Client::handleCommand(const std::string& command, const std::vector<std::st
         completeRegistration();
     }
 }
-    // else if (command == "USER") {
-    //     // Set username and realname
-    //     if (params.size() < 4) {
-    //         sendData("461 " + _nickname + " USER :Not enough parameters");
-    //         return;
-    //     }
-        
-    //     _username = params[0];
-    //     // params[1] and params[2] are mode and unused
-    //     // params[3] is the real name
-        
 
-    //     // If we have both nickname and username, complete registration
-    //     if (!_nickname.empty() && !_username.empty() && _passwordValidated) {
-    //         _authenticated = true;
-    //         std::cout << "HELLO\n";
-    //         // Send welcome messages
-    //         sendData("001 " + _nickname + " :Welcome to the Internet Relay Network " + _nickname + "!" + _username + "@host");
-    //         sendData("002 " + _nickname + " :Your host is ft_irc, running version 1.0");
-    //         sendData("003 " + _nickname + " :This server was created today");
-    //         sendData("004 " + _nickname + " ft_irc 1.0 o o");
-    //     }
-    // }
-    else if (command == "JOIN") {
-        // Join a channel
-        if (params.size() < 1) {
-            sendData("461 " + _nickname + " JOIN :Not enough parameters");
-            return;
-        }
-        
-        std::string channelName = params[0];
-        
-        // Check if channel name is valid
-        if (channelName[0] != '#') {
-            sendData("403 " + _nickname + " " + channelName + " :No such channel");
-            return;
-        }
-        
-        // Get or create channel
+void Client::handleJoin(const IrcMessage& message) {
+    // "#a,#b": each channel is joined in turn, with its own replies
+    std::vector<StringView> names;
+    splitList(message.params[0], names);
+    for (size_t i = 0; i < names.size(); i++) {
+        enterChannel(names[i].str());
+    }
+}
+
+void Client::enterChannel(const std::string& channelName) {
+    // Check if channel name is valid
+    if (channelName[0] != '#') {
+        sendData("403 " + _nickname + " " + channelName + " :No such channel");
+        return;
+    }
+    
+    // Get or create channel
+    Channel* channel = _server->getChannel(channelName);
+    if (!channel) {
+        channel = _server->createChannel(channelName, this);
+    } else if (isInChannel(channel)) {
+        return;
+    }
+    
+    // Join channel
+    joinChannel(channel);
+    
+    // Notify clients in channel; linked servers track every membership
+    Payload line = (LineBuilder() << ":" << _prefix << " JOIN " << channelName).frame();
+    channel->broadcastPayload(line, NULL);
+    if (LinkManager* links = _server->getLinks()) {
+        links->propagate(line);
+    }
+    
+    // Send channel topic
+    const std::string& topic = channel->getTopic();
+    if (!topic.empty()) {
+        sendData("332 " + _nickname + " " + channelName + " :" + topic);
+    } else {
+        sendData("331 " + _nickname + " " + channelName + " :No topic is set");
+    }
+    
+    // Send names list
+    sendNames(channel);
+}
+
+void Client::handlePart(const IrcMessage& message) {
+    // Everything after the channel list is shared by each PART line
+    std::string tail = message.paramCount > 1 ? " :" + message.param(1) : std::string();
+    std::vector<StringView> names;
+    splitList(message.params[0], names);
+    for (size_t i = 0; i < names.size(); i++) {
+        std::string channelName = names[i].str();
         Channel* channel = _server->getChannel(channelName);
         if (!channel) {
-            channel = _server->createChannel(channelName, this);
+            sendData("403 " + _nickname + " " + channelName + " :No such channel");
+            continue;
+        }
+        if (!isInChannel(channel)) {
+            sendData("442 " + _nickname + " " + channelName + " :You're not on that channel");
+            continue;
         }
         
-        // Join channel
-        joinChannel(channel);
-        
-        // Notify clients in channel
-        channel->broadcastMessage(":" + _nickname + "!" + _username + "@host JOIN " + channelName);
-        
-        // Send channel topic
-        const std::string& topic = channel->getTopic();
-        if (!topic.empty()) {
-            sendData("332 " + _nickname + " " + channelName + " :" + topic);
+        Payload line = (LineBuilder() << ":" << _prefix << " PART " << channelName << tail).frame();
+        channel->broadcastPayload(line, NULL);
+        if (LinkManager* links = _server->getLinks()) {
+            links->propagate(line);
+        }
+        leaveChannel(channel);
+        if (channel->getClients().empty()) {
+            _server->removeChannel(channelName);
+        }
+    }
+}
+
+void Client::handleChathistory(const IrcMessage& message) {
+    // IRCv3 CHATHISTORY: <subcommand> <target> <reference>... <limit>
+    std::string subcommand = message.param(0);
+    for (size_t i = 0; i < subcommand.size(); i++) {
+        subcommand[i] = static_cast<char>(std::toupper(static_cast<unsigned char>(subcommand[i])));
+    }
+    const std::string& limitText = message.param(message.paramCount - 1);
+    char* end = NULL;
+    unsigned long limit = std::strtoul(limitText.c_str(), &end, 10);
+    if (limitText.empty() || *end != '\0' || limit == 0) {
+        sendData("FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " :Invalid limit");
+        return;
+    }
+    limit = std::min(limit, static_cast<unsigned long>(_server->getConfig().historyLines));
+    if (subcommand == "TARGETS") {
+        chathistoryTargets(message, limit);
+        return;
+    }
+    
+    const std::string& target = message.param(1);
+    Channel* channel = target[0] == '#' ? _server->getChannel(target) : NULL;
+    if (!channel || !isInChannel(channel)) {
+        sendData("FAIL CHATHISTORY INVALID_TARGET " + subcommand + " " + target
+                 + " :Messages could not be retrieved");
+        return;
+    }
+    const ChannelHistory& history = channel->getHistory();
+    
+    // References become positions: entries [0, before) are older than
+    // the reference, those from `after` on are newer
+    size_t before = 0;
+    size_t after = 0;
+    bool valid = true;
+    if (subcommand == "LATEST") {
+        if (message.param(2) == "*") {
+            after = 0;
         } else {
-            sendData("331 " + _nickname + " " + channelName + " :No topic is set");
+            valid = locateReference(history, message.param(2), before, after);
         }
-        
-        // Send names list
-        sendData("353 " + _nickname + " = " + channelName + " :" + channel->getNamesList());
-        sendData("366 " + _nickname + " " + channelName + " :End of /NAMES list");
+        if (valid) {
+            replayHistory(target, history, after, history.size(), limit, true);
+        }
+    } else if (subcommand == "BEFORE") {
+        valid = locateReference(history, message.param(2), before, after);
+        if (valid) {
+            replayHistory(target, history, 0, before, limit, true);
+        }
+    } else if (subcommand == "AFTER") {
+        valid = locateReference(history, message.param(2), before, after);
+        if (valid) {
+            replayHistory(target, history, after, history.size(), limit, false);
+        }
+    } else if (subcommand == "AROUND") {
+        valid = locateReference(history, message.param(2), before, after);
+        if (valid) {
+            size_t begin = before - std::min(before, static_cast<size_t>(limit / 2));
+            replayHistory(target, history, begin, history.size(), limit, false);
+        }
+    } else if (subcommand == "BETWEEN" && message.paramCount >= 5) {
+        size_t otherBefore = 0;
+        size_t otherAfter = 0;
+        valid = locateReference(history, message.param(2), before, after)
+                && locateReference(history, message.param(3), otherBefore, otherAfter);
+        if (valid && before <= otherBefore) {
+            replayHistory(target, history, after, std::max(after, otherBefore), limit, false);
+        } else if (valid) {
+            replayHistory(target, history, otherAfter, std::max(otherAfter, before), limit, true);
+        }
+    } else if (subcommand == "BETWEEN") {
+        valid = false;
+    } else {
+        sendData("FAIL CHATHISTORY UNKNOWN_COMMAND " + subcommand + " :Unknown command");
+        return;
+    }
+    if (!valid) {
+        sendData("FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " :Invalid message reference");
+    }
+}
+
+void Client::replayHistory(const std::string& target, const ChannelHistory& history, size_t begin,
+                           size_t end, size_t limit, bool newest) {
+    if (end - begin > limit) {
+        if (newest) {
+            begin = end - limit;
+        } else {
+            end = begin + limit;
+        }
+    }
+    
+    // Each line goes out as three shared pieces, "@batch=<id>;", its
+    // stored tags and the line as broadcast, gathered into one write
+    std::ostringstream id;
+    id << g_nextBatch++;
+    sendData("BATCH +" + id.str() + " chathistory " + target);
+    Payload batchTag("@batch=" + id.str() + ";");
+    for (size_t i = begin; i < end; i++) {
+        const ChannelHistory::Entry& entry = history.at(i);
+        sendPayload(batchTag);
+        sendPayload(entry.tags);
+        sendPayload(entry.line);
+    }
+    sendData("BATCH -" + id.str());
+}
+
+void Client::chathistoryTargets(const IrcMessage& message, size_t limit) {
+    // Channels of ours with their latest line between the two timestamps
+    WallMs first;
+    WallMs second;
+    if (message.param(1).compare(0, 10, "timestamp=") != 0 || message.param(2).compare(0, 10, "timestamp=") != 0
+        || !parseTimestamp(message.param(1).substr(10), first)
+        || !parseTimestamp(message.param(2).substr(10), second)) {
+        sendData("FAIL CHATHISTORY INVALID_PARAMS TARGETS :Invalid timestamp");
+        return;
+    }
+    WallMs low = std::min(first, second);
+    WallMs high = std::max(first, second);
+    std::vector<std::pair<WallMs, Channel*> > latest;
+    const std::vector<Channel*>& channels = _channels.items();
+    for (size_t i = 0; i < channels.size(); i++) {
+        const ChannelHistory& history = channels[i]->getHistory();
+        if (!history.empty()) {
+            WallMs time = history.at(history.size() - 1).time;
+            if (time > low && time < high) {
+                latest.push_back(std::make_pair(time, channels[i]));
+            }
+        }
+    }
+    std::sort(latest.begin(), latest.end());
+    
+    std::ostringstream id;
+    id << g_nextBatch++;
+    sendData("BATCH +" + id.str() + " draft/chathistory-targets");
+    for (size_t i = 0; i < latest.size() && i < limit; i++) {
+        sendData("@batch=" + id.str() + " CHATHISTORY TARGETS " + latest[i].second->getName() + " timestamp="
+                 + formatTimestamp(latest[i].first));
+    }
+    sendData("BATCH -" + id.str());
+}
+
+void Client::handleNames(const IrcMessage& message) {
+    std::string channelName = message.param(0);
+    Channel* channel = _server->getChannel(channelName);
+    if (channel) {
+        sendNames(channel);
+        return;
+    }
+    sendData("366 " + _nickname + " " + channelName + " :End of /NAMES list");
+}
+
+void Client::sendNames(Channel* channel) {
+    // The chunks are cached by the channel and shared by every requester;
+    // only the per-recipient line head is built here
+    const std::vector<std::string>& chunks = channel->getNamesChunks();
+    std::string head = "353 " + _nickname + " = " + channel->getName() + " :";
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        sendData(head + chunks[i]);
+    }
+    sendData("366 " + _nickname + " " + channel->getName() + " :End of /NAMES list");
+}
+
+void Client::handlePrivmsg(const IrcMessage& message) {
+    deliverMessage(message, false);
+}
+
+void Client::handleNotice(const IrcMessage& message) {
+    deliverMessage(message, true);
+}
+
+void Client::deliverMessage(const IrcMessage& message, bool notice) {
+    // NOTICE never triggers error replies
+    const char* command = notice ? "NOTICE" : "PRIVMSG";
+    if (message.paramCount < 1) {
+        if (!notice) {
+            sendData("411 " + _nickname + " :No recipient given (" + command + ")");
+        }
+        return;
+    }
+    if (message.paramCount < 2 || message.params[1].empty()) {
+        if (!notice) {
+            sendData("412 " + _nickname + " :No text to send");
+        }
+        return;
     }
-    // // In handleCommand() for each command handler:
-    // std::cout << "Handling PASS command" << std::endl;
-    // Add more command handlers here (PRIVMSG, PART, QUIT, etc.)
+    
+    // "#a,#b,nick": one fan-out over every target, each recipient reached
+    // once even when it shares several of the channels (and never the
+    // sender). A recipient sees the line of the first target it is in.
+    std::vector<StringView> targets;
+    splitList(message.params[0], targets);
+    settleHostname(); // The recipients see our prefix
+    LineBuilder head;
+    head << ":" << _prefix << " " << command << " ";
+    const StringView& text = message.params[1];
+    unsigned long mark = _server->nextDeliveryMark();
+    markDelivered(mark);
+    
+    // Valid remote-bound targets, relayed as one line
+    std::vector<Channel*> channels;
+    std::vector<Client*> users;
+    std::string routed;
+    
+    for (size_t i = 0; i < targets.size(); i++) {
+        std::string target = targets[i].str();
+        if (target[0] == '#') {
+            Channel* channel = _server->getChannel(target);
+            if (!channel) {
+                if (!notice) {
+                    sendData("401 " + _nickname + " " + target + " :No such nick/channel");
+                }
+                continue;
+            }
+            if (!isInChannel(channel)) {
+                if (!notice) {
+                    sendData("404 " + _nickname + " " + target + " :Cannot send to channel");
+                }
+                continue;
+            }
+            // Chatter is the first thing shed for clients that fall behind
+            LineBuilder line = head;
+            line << target << " :";
+            Payload payload = line.append(text.data, text.length).frame();
+            channel->broadcastMarked(payload, mark, OutputQueue::PRIORITY_LOW);
+            _server->recordHistory(channel, payload);
+            channels.push_back(channel);
+        } else {
+            Client* recipient = _server->findClient(target);
+            if (!recipient || !recipient->isAuthenticated()) {
+                if (!notice) {
+                    sendData("401 " + _nickname + " " + target + " :No such nick/channel");
+                }
+                continue;
+            }
+            if (!recipient->markDelivered(mark)) {
+                continue;
+            }
+            if (!recipient->getLink()) {
+                LineBuilder line = head;
+                line << target << " :";
+                recipient->sendPayload(line.append(text.data, text.length).frame());
+                continue;
+            }
+            users.push_back(recipient);
+        }
+        routed += (routed.empty() ? "" : ",") + target;
+    }
+    
+    if (!routed.empty()) {
+        if (LinkManager* links = _server->getLinks()) {
+            LineBuilder line = head;
+            line << routed << " :";
+            links->routeMessage(channels, users, line.append(text.data, text.length).str());
+        }
+    }
+}
+
+void Client::notifyPeers(const std::string& message) {
+    notifyPeers(Payload::frame(message));
+}
+
+void Client::notifyPeers(const Payload& payload) {
+    unsigned long mark = _server->nextDeliveryMark();
+    markDelivered(mark);
+    sendPayload(payload);
+    const std::vector<Channel*>& channels = _channels.items();
+    for (std::vector<Channel*>::const_iterator chan = channels.begin(); chan != channels.end(); ++chan) {
+        (*chan)->broadcastMarked(payload, mark);
+    }
+}
 
-}
\ No newline at end of file
+void Client::handlePing(const IrcMessage& message) {
+    if (message.paramCount < 1) {
+        sendData("409 " + (_nickname.empty() ? std::string("*") : _nickname) + " :No origin specified");
+        return;
+    }
+    sendData("PONG ft_irc :" + message.param(0));
+}
+
+void Client::handlePong(const IrcMessage& message) {
+    // Receiving it already cleared the keepalive in processData
+    (void)message;
+}
+
+TimeMs Client::nextDeadline() const {
+    const ServerConfig& config = _server->getConfig();
+    TimeMs next = 0;
+    if (_awaitingPong) {
+        next = _pingSent + config.pingTimeout * 1000;
+    } else if (config.pingInterval > 0) {
+        next = _lastActivity + config.pingInterval * 1000;
+    }
+    if (config.idleTimeout > 0) {
+        TimeMs idle = _lastCommand + config.idleTimeout * 1000;
+        if (!next || idle < next) {
+            next = idle;
+        }
+    }
+    // Flood control holding lines back: when the bucket has room again
+    if (_inputDeferred && config.floodRate > 0) {
+        TimeMs release = (_floodClock - config.floodBurst * 1000000ULL / config.floodRate) / 1000 + 1;
+        if (!next || release < next) {
+            next = release;
+        }
+    }
+    return next;
+}
+
+void Client::saveState(SnapshotWriter& out) {
+    out.putU64(_sourceKey);
+    out.putString(_nickname);
+    out.putString(_username);
+    out.putString(_hostname);
+    out.putU8((_authenticated ? 1 : 0) | (_isOperator ? 2 : 0) | (_passwordValidated ? 4 : 0));
+
+    // Lines not run yet, in arrival order
+    std::string input(_buffer.unconsumed(), _buffer.size());
+    input.append(_spill);
+    out.putString(input);
+
+    std::string output;
+    if (_worker) {
+        _worker->copyOutput(_fd, _id, output);
+    } else {
+        _outgoingMessages.copy(output);
+    }
+    out.putString(output);
+}
+
+bool Client::restoreState(SnapshotReader& in, std::string& input) {
+    _sourceKey = static_cast<unsigned long>(in.getU64());
+    std::string nickname = in.getString();
+    _username = in.getString();
+    _hostname = in.getString();
+    unsigned int flags = in.getU8();
+    input = in.getString();
+    std::string output = in.getString();
+    if (in.failed() || (!nickname.empty() && !_server->claimNickname(this, nickname))) {
+        return false;
+    }
+    setNickname(nickname);
+    _authenticated = (flags & 1) != 0;
+    _isOperator = (flags & 2) != 0;
+    _passwordValidated = (flags & 4) != 0;
+
+    // Possibly the middle of a line: it goes out before anything else
+    if (!output.empty()) {
+        sendPayload(Payload(output));
+    }
+
+    // Deadlines restart from now; the registration timeout is already armed
+    if (_authenticated) {
+        _lastActivity = _lastCommand = _server->now();
+        _timer.unlink();
+        TimeMs next = nextDeadline();
+        if (next) {
+            _server->armTimer(this, next);
+        }
+    }
+    return true;
+}
+
+TimeMs Client::onTimer(TimeMs now) {
+    const ServerConfig& config = _server->getConfig();
+    if (_disconnected) {
+        return 0;
+    }
+    
+    // Only the registration deadline is armed before registration
+    if (!_authenticated) {
+        sendData("ERROR :Registration timeout");
+        setDisconnected();
+        return 0;
+    }
+    
+    // Lines held back by flood control; they count as activity
+    if (_inputDeferred) {
+        resumeInput();
+        if (_disconnected) {
+            return 0;
+        }
+    }
+    
+    if (config.idleTimeout > 0 && now >= _lastCommand + config.idleTimeout * 1000) {
+        sendData("ERROR :Idle timeout");
+        setDisconnected();
+        return 0;
+    }
+    
+    // Activity is checked lazily here instead of re-arming on every line
+    if (_awaitingPong) {
+        if (now >= _pingSent + config.pingTimeout * 1000) {
+            sendData("ERROR :Ping timeout");
+            setDisconnected();
+            return 0;
+        }
+    } else if (config.pingInterval > 0 && now >= _lastActivity + config.pingInterval * 1000) {
+        sendData("PING :ft_irc");
+        _awaitingPong = true;
+        _pingSent = now;
+    }
+    return nextDeadline();
+}
@@ -5,42 +5,121 @@
 #include <string>
 #include <vector>
 #include <map>
-#include <queue>
+#include <ctime>
+#include "../buffers/outputqueue.hpp"
+#include "../buffers/inputbuffer.hpp"
+#include "../commands/commands.hpp"
+#include "../utils/denseset.hpp"
+#include "../timers/timerwheel.hpp"
+#include "../utils/uniquefd.hpp"
 
 class Server;
 class Channel;
+class IoWorker;
+class OutputSink;
+class TlsStream;
+class ChannelHistory;
+class SnapshotWriter;
+class SnapshotReader;
+struct PeerLink;
+struct IrcMessage;
 // Add in Client class declaration, at the beginning of the class:
 
+// Longest run of input without a line terminator before the client is
+// considered to be sending garbage
+const size_t INPUT_BUFFER_SIZE = 8192;
+
+// RFC 1459 nickname length limit
+const size_t NICKNAME_MAX = 9;
+
+// Letters, digits and []\`_^{|}, at most NICKNAME_MAX; never a channel
+// name, a list separator or anything that splits a line
+bool isValidNickname(const std::string& nickname);
+
 class Client {
 // friend class Server; // Add this line to allow Server to access private members
 private:
     int _fd;                    // Client socket file descriptor
+    UniqueFd _socket;           // Owns _fd in single-threaded mode (the I/O worker does otherwise)
+    unsigned long _id;          // Unique connection id (fds get reused)
+    unsigned long _sourceKey;   // Peer address key for the connection throttle
     Server* _server;            // Reference to server
     std::string _nickname;      // Client nickname
     std::string _username;      // Client username
     std::string _hostname;      // Client hostname
-    std::string _buffer;        // Buffer for incoming data
+    std::string _prefix;        // Pre-rendered "nick!user@host", rebuilt when a part changes
     bool _authenticated;        // Whether client is authenticated
     bool _isOperator;           // Whether client is a server operator
     bool _disconnected;
-    // bool _passwordValidated;
-    std::vector<Channel*> _channels;  // Channels the client has joined
-    std::queue<std::string> _outgoingMessages; // For messages waiting to be sent
+    bool _passwordValidated;    // Whether a correct PASS was received
+    InputBuffer _buffer;        // Buffer for incoming data
+    DenseSet<Channel*> _channels;     // Channels the client has joined
+    OutputQueue _outgoingMessages; // For messages waiting to be sent
+    IoWorker* _worker;          // Owning I/O thread in threaded mode (NULL otherwise)
+    OutputSink* _sink;          // Replaces the socket for in-memory clients (NULL otherwise)
+    TlsStream* _tls;            // TLS layer over _socket, owned (NULL for plaintext or threaded mode)
+    PeerLink* _link;            // Server link leading to a remote user (NULL for local users)
+    bool _flushScheduled;       // Queued in the server's end-of-iteration flush list
+    bool _writeArmed;           // Write interest registered with the event loop
+    unsigned long _deliveryMark; // Last fan-out this client was included in
+    Timer _timer;               // Next registration/keepalive/idle deadline
+    TimeMs _lastActivity;       // Last time anything was received
+    TimeMs _lastCommand;        // Last command other than PING/PONG (idle tracking)
+    TimeMs _pingSent;           // When the outstanding keepalive PING was sent
+    bool _awaitingPong;         // Keepalive PING sent, nothing received since
+    unsigned long long _floodClock; // Flood control: when the cost spent so far is paid back (us)
+    unsigned long _inputRound;  // Server::iteration() the line budget was last reset in
+    size_t _roundLines;         // Lines run in that iteration
+    bool _inputDeferred;        // Complete lines are waiting on flood control or the budget
+    bool _readStalled;          // Socket (or worker) left unread while lines are waiting
+    bool _backlogged;           // Queued in the server's backlog for the next iteration
+    std::string _spill;         // Threaded mode: received bytes the input buffer has no room for yet
+    TimeMs _lookupDeadline;     // Hostname lookup in flight, its answer taken until then (0 = none)
+    bool _secure;               // Came in on a TLS listener (the session cannot move to another process)
 
 public:
-    Client(int fd, Server* server);
+    Client(int fd, Server* server, unsigned long id = 0);
     ~Client();
 
+    // Allocated from a slab pool, see utils/slabpool.hpp
+    static void* operator new(size_t size);
+    static void operator delete(void* client, size_t size);
+
     // Getters
     int getFd() const;
+    unsigned long getId() const { return _id; }
+    unsigned long getSourceKey() const { return _sourceKey; }
+    void setSourceKey(unsigned long key) { _sourceKey = key; }
+    IoWorker* getWorker() const { return _worker; }
+    // Threaded mode: the worker takes over the socket
+    void setWorker(IoWorker* worker) {
+        _worker = worker;
+        _socket.release();
+    }
+    // TLS listener: reads and writes go through `tls`, which the client owns
+    void setTls(TlsStream* tls) { _tls = tls; }
+    bool isSecure() const { return _secure; }
+    // Still in the TLS handshake, nothing can be written yet
+    bool isHandshaking() const;
+    void setSecure(bool secure) { _secure = secure; }
+    // In-memory client: output goes to `sink` instead of a socket
+    void setSink(OutputSink* sink) { _sink = sink; }
+    // Remote user: introduced by a linked server, reached through `link`
+    PeerLink* getLink() const { return _link; }
+    void setLink(PeerLink* link) { _link = link; }
     const std::string& getNickname() const;
     const std::string& getUsername() const;
     const std::string& getHostname() const;
     bool isAuthenticated() const;
     bool isOperator() const;
+    Timer& getTimer() { return _timer; }
+    // nick!user@host, as used in message sources; cached, not rebuilt per message
+    const std::string& getPrefix() const { return _prefix; }
 
     // Setters
     void setNickname(const std::string& nickname);
+    // Claim `nickname` in the server index and rename; false if it is taken
+    bool changeNickname(const std::string& nickname);
     void setUsername(const std::string& username);
     void setHostname(const std::string& hostname);
     void setAuthenticated(bool authenticated);
@@ -54,25 +133,94 @@ public:
 
     // Data handling
     bool receiveData();
+    void receiveBytes(const char* data, size_t length);
+    // Run lines held back by the line budget or flood control
+    void resumeInput();
     void sendData(const std::string& message);
+    void sendPayload(const Payload& payload,
+                     OutputQueue::Priority priority = OutputQueue::PRIORITY_NORMAL);
     void sendPendingData();
+    void flushBeforeClose();
     bool isDisconnected() const {
         return _disconnected;
     }
     
-    void setDisconnected() {
-        _disconnected = true;
-    }
+    // Reclaimed by the server at the end of the loop iteration
+    void setDisconnected();
     bool hasPendingMessages() const { return !_outgoingMessages.empty(); }
+    // True the first time it is called with a given Server::nextDeliveryMark()
+    bool markDelivered(unsigned long mark) {
+        if (_deliveryMark == mark) {
+            return false;
+        }
+        _deliveryMark = mark;
+        return true;
+    }
 
     void completeRegistration();
 
+    // Reverse DNS in flight: the client goes by its address meanwhile and
+    // takes the answer if it comes by `deadline`, and before anyone else
+    // has seen the prefix (a channel, a message, a server link)
+    void awaitHostname(TimeMs deadline) { _lookupDeadline = deadline; }
+    // Lookup finished (the address itself when unresolved)
+    void hostnameResolved(const std::string& hostname);
+    // Others are about to see the prefix: keep the hostname it has
+    void settleHostname() { _lookupDeadline = 0; }
+
+    // Once to ourselves and once to everyone sharing a channel with us
+    void notifyPeers(const std::string& message);
+    void notifyPeers(const Payload& payload);
+
+    // Called by the server when _timer fires; returns the next deadline
+    // (0 = none). Sends PINGs and drops clients that stopped answering.
+    TimeMs onTimer(TimeMs now);
+
+    // Hot restart: identity, registration state and the bytes in flight
+    // both ways. Unsent output is taken out of the queue; received input
+    // comes back in `input`, to run once every client and channel exists.
+    void saveState(SnapshotWriter& out);
+    bool restoreState(SnapshotReader& in, std::string& input);
+
 private:
     // Process received data
     void processData();
+    void rebuildPrefix();
+    void processLines();
+    bool admitLine();
+    void chargeLine(const IrcMessage& message);
+    void drainSpill();
     // Handle different IRC commands
-    void handleCommand(const std::string& command, const std::vector<std::string>& params);
-    void parseAndHandleCommand(const std::string& line);
+    void handleCommand(const IrcMessage& message);
+    void parseAndHandleCommand(char* line, size_t length);
+
+    // Command handlers, dispatched by CommandId once the registry checks
+    // (registration, minimum parameter count) have passed
+    typedef void (Client::*CommandHandler)(const IrcMessage& message);
+    static const CommandHandler _commandHandlers[CMD_COUNT];
+
+    void handlePass(const IrcMessage& message);
+    void handleNick(const IrcMessage& message);
+    void handleUser(const IrcMessage& message);
+    void handleJoin(const IrcMessage& message);
+    void handlePart(const IrcMessage& message);
+    void handleTopic(const IrcMessage& message);
+    void handleNames(const IrcMessage& message);
+    void handlePing(const IrcMessage& message);
+    void handlePong(const IrcMessage& message);
+    void handlePrivmsg(const IrcMessage& message);
+    void handleNotice(const IrcMessage& message);
+    void handleChathistory(const IrcMessage& message);
+
+    void enterChannel(const std::string& channelName);
+    void deliverMessage(const IrcMessage& message, bool notice);
+    void sendNames(Channel* channel);
+    void chathistoryTargets(const IrcMessage& message, size_t limit);
+    void replayHistory(const std::string& target, const ChannelHistory& history, size_t begin,
+                       size_t end, size_t limit, bool newest);
+    TimeMs nextDeadline() const;
+    void overflowSendQueue();
+    OutputQueue::FlushResult flushOutput();
 
 };
 
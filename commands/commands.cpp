@@ -0,0 +1,81 @@
+#include "commands.hpp"
+#include <cstring>
+
+namespace {
+
+// Indexed by CommandId
+const CommandSpec COMMAND_SPECS[] = {
+    { CMD_UNKNOWN,  "",         0, 0,                       1 },
+    { CMD_PASS,     "PASS",     1, CMD_REGISTRATION_ONLY,   1 },
+    { CMD_NICK,     "NICK",     0, 0,                       3 },    // 431 is sent by the handler
+    { CMD_USER,     "USER",     4, CMD_REGISTRATION_ONLY,   1 },
+    { CMD_JOIN,     "JOIN",     1, CMD_NEEDS_REGISTRATION | CMD_COST_PER_TARGET, 5 },
+    { CMD_TOPIC,    "TOPIC",    1, CMD_NEEDS_REGISTRATION,  2 },
+    { CMD_PRIVMSG,  "PRIVMSG",  0, CMD_NEEDS_REGISTRATION | CMD_COST_PER_TARGET, 1 },
+    { CMD_NOTICE,   "NOTICE",   0, CMD_NEEDS_REGISTRATION | CMD_COST_PER_TARGET, 1 },
+    { CMD_PART,     "PART",     1, CMD_NEEDS_REGISTRATION | CMD_COST_PER_TARGET, 2 },
+    { CMD_MODE,     "MODE",     1, CMD_NEEDS_REGISTRATION,  2 },
+    { CMD_INVITE,   "INVITE",   2, CMD_NEEDS_REGISTRATION,  3 },
+    { CMD_KICK,     "KICK",     2, CMD_NEEDS_REGISTRATION,  2 },
+    { CMD_QUIT,     "QUIT",     0, 0,                       1 },
+    { CMD_PING,     "PING",     0, 0,                       1 },
+    { CMD_PONG,     "PONG",     0, 0,                       1 },
+    { CMD_NAMES,    "NAMES",    1, CMD_NEEDS_REGISTRATION,  5 },
+    { CMD_CHATHISTORY, "CHATHISTORY", 4, CMD_NEEDS_REGISTRATION, 5 }
+};
+
+typedef char specsMatchIds[(sizeof(COMMAND_SPECS) / sizeof(COMMAND_SPECS[0]) == CMD_COUNT) ? 1 : -1];
+
+// Open-addressing table from name hash to id, filled on first lookup
+const size_t TABLE_SIZE = 64;   // Power of two, well above CMD_COUNT
+
+CommandId   g_table[TABLE_SIZE];
+bool        g_tableReady = false;
+
+size_t hashName(const char* name, size_t length) {
+    // FNV-1a
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+void buildTable() {
+    for (size_t i = 0; i < TABLE_SIZE; i++) {
+        g_table[i] = CMD_UNKNOWN;
+    }
+    for (int id = CMD_UNKNOWN + 1; id < CMD_COUNT; id++) {
+        const char* name = COMMAND_SPECS[id].name;
+        size_t slot = hashName(name, strlen(name)) & (TABLE_SIZE - 1);
+        while (g_table[slot] != CMD_UNKNOWN) {
+            slot = (slot + 1) & (TABLE_SIZE - 1);
+        }
+        g_table[slot] = static_cast<CommandId>(id);
+    }
+    g_tableReady = true;
+}
+
+} // namespace
+
+CommandId lookupCommand(const char* name, size_t length) {
+    if (!g_tableReady) {
+        buildTable();
+    }
+    size_t slot = hashName(name, length) & (TABLE_SIZE - 1);
+    while (g_table[slot] != CMD_UNKNOWN) {
+        const char* candidate = COMMAND_SPECS[g_table[slot]].name;
+        if (strlen(candidate) == length && memcmp(candidate, name, length) == 0) {
+            return g_table[slot];
+        }
+        slot = (slot + 1) & (TABLE_SIZE - 1);
+    }
+    return CMD_UNKNOWN;
+}
+
+const CommandSpec& commandSpec(CommandId id) {
+    if (id < CMD_UNKNOWN || id >= CMD_COUNT) {
+        id = CMD_UNKNOWN;
+    }
+    return COMMAND_SPECS[id];
+}
@@ -0,0 +1,49 @@
+#ifndef COMMANDS_HPP
+#define COMMANDS_HPP
+
+#include <cstddef>
+
+// Interned command names. Ids index the registry and the handler table in
+// Client, so new commands are added at the end, before CMD_COUNT.
+enum CommandId {
+    CMD_UNKNOWN = 0,
+    CMD_PASS,
+    CMD_NICK,
+    CMD_USER,
+    CMD_JOIN,
+    CMD_TOPIC,
+    CMD_PRIVMSG,
+    CMD_NOTICE,
+    CMD_PART,
+    CMD_MODE,
+    CMD_INVITE,
+    CMD_KICK,
+    CMD_QUIT,
+    CMD_PING,
+    CMD_PONG,
+    CMD_NAMES,
+    CMD_CHATHISTORY,
+    CMD_COUNT
+};
+
+enum CommandFlags {
+    CMD_NEEDS_REGISTRATION  = 1 << 0,   // 451 ERR_NOTREGISTERED before registration
+    CMD_REGISTRATION_ONLY   = 1 << 1,   // 462 ERR_ALREADYREGISTRED after registration
+    CMD_COST_PER_TARGET     = 1 << 2    // Cost is charged per entry of a params[0] target list
+};
+
+// Dispatch metadata, checked before the handler runs
+struct CommandSpec {
+    CommandId       id;
+    const char*     name;
+    size_t          minParams;  // 461 ERR_NEEDMOREPARAMS below this
+    unsigned int    flags;
+    unsigned int    cost;       // Flood-control units (IRCSERV_FLOOD_RATE); expensive commands cost more
+};
+
+// Id of an upper-cased command name, CMD_UNKNOWN if it is not registered
+CommandId lookupCommand(const char* name, size_t length);
+
+const CommandSpec& commandSpec(CommandId id);
+
+#endif // COMMANDS_HPP
@@ -0,0 +1,345 @@
+#include "poller.hpp"
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+# define IRC_HAVE_EPOLL 1
+# include <sys/epoll.h>
+#endif
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+    defined(__NetBSD__) || defined(__DragonFly__)
+# define IRC_HAVE_KQUEUE 1
+# include <sys/types.h>
+# include <sys/event.h>
+# include <sys/time.h>
+#endif
+
+Poller::~Poller() {
+}
+
+namespace {
+
+// Initial size of the buffer handed to epoll_wait()/kevent(); grown when
+// a wakeup fills it completely
+const size_t INITIAL_EVENT_CAPACITY = 256;
+
+#ifdef IRC_HAVE_EPOLL
+
+class EpollPoller : public Poller {
+private:
+    int                             _epfd;      // epoll instance
+    std::vector<struct epoll_event> _buffer;    // Kernel-filled ready list
+
+    static unsigned int toEpoll(unsigned int events) {
+        unsigned int mask = 0;
+        if (events & READABLE) {
+            mask |= EPOLLIN | EPOLLRDHUP;
+        }
+        if (events & WRITABLE) {
+            mask |= EPOLLOUT;
+        }
+        if (events & EDGE_TRIGGERED) {
+            mask |= EPOLLET;
+        }
+        return mask;
+    }
+
+    bool control(int op, int fd, unsigned int events) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = toEpoll(events);
+        ev.data.fd = fd;
+        return epoll_ctl(_epfd, op, fd, &ev) == 0;
+    }
+
+public:
+    EpollPoller() : _epfd(epoll_create(1)), _buffer(INITIAL_EVENT_CAPACITY) {
+        if (_epfd != -1) {
+            fcntl(_epfd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+
+    ~EpollPoller() {
+        if (_epfd != -1) {
+            close(_epfd);
+        }
+    }
+
+    bool isValid() const { return _epfd != -1; }
+    const char* name() const { return "epoll"; }
+
+    bool add(int fd, unsigned int events) { return control(EPOLL_CTL_ADD, fd, events); }
+    bool modify(int fd, unsigned int events) { return control(EPOLL_CTL_MOD, fd, events); }
+
+    void remove(int fd) {
+        struct epoll_event ev; // Ignored, but required by kernels before 2.6.9
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, &ev);
+    }
+
+    int wait(std::vector<PollEvent>& ready, int timeoutMs) {
+        ready.clear();
+        int count = epoll_wait(_epfd, &_buffer[0], static_cast<int>(_buffer.size()), timeoutMs);
+        if (count < 0) {
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            PollEvent event;
+            event.fd = _buffer[i].data.fd;
+            event.events = 0;
+            if (_buffer[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                event.events |= READABLE;
+            }
+            if (_buffer[i].events & EPOLLOUT) {
+                event.events |= WRITABLE;
+            }
+            if (_buffer[i].events & (EPOLLERR | EPOLLHUP)) {
+                event.events |= ERROR;
+            }
+            ready.push_back(event);
+        }
+        // A full buffer means more descriptors may be ready: grow for next time
+        if (static_cast<size_t>(count) == _buffer.size()) {
+            _buffer.resize(_buffer.size() * 2);
+        }
+        return count;
+    }
+};
+
+#endif // IRC_HAVE_EPOLL
+
+#ifdef IRC_HAVE_KQUEUE
+
+class KqueuePoller : public Poller {
+private:
+    int                         _kqfd;      // kqueue instance
+    std::vector<struct kevent>  _buffer;    // Kernel-filled ready list
+    std::vector<unsigned int>   _interest;  // Registered events, indexed by fd
+
+    bool change(int fd, short filter, unsigned short flags) {
+        struct kevent change;
+        EV_SET(&change, fd, filter, flags, 0, 0, NULL);
+        return kevent(_kqfd, &change, 1, NULL, 0, NULL) == 0;
+    }
+
+    unsigned int& interest(int fd) {
+        if (static_cast<size_t>(fd) >= _interest.size()) {
+            _interest.resize(fd + 1, 0);
+        }
+        return _interest[fd];
+    }
+
+public:
+    KqueuePoller() : _kqfd(kqueue()), _buffer(INITIAL_EVENT_CAPACITY) {
+        if (_kqfd != -1) {
+            fcntl(_kqfd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+
+    ~KqueuePoller() {
+        if (_kqfd != -1) {
+            close(_kqfd);
+        }
+    }
+
+    bool isValid() const { return _kqfd != -1; }
+    const char* name() const { return "kqueue"; }
+
+    bool add(int fd, unsigned int events) {
+        interest(fd) = 0;
+        return modify(fd, events);
+    }
+
+    bool modify(int fd, unsigned int events) {
+        unsigned int& current = interest(fd);
+        unsigned short clear = (events & EDGE_TRIGGERED) ? EV_CLEAR : 0;
+        bool ok = true;
+
+        if ((events & READABLE) && !(current & READABLE)) {
+            ok = change(fd, EVFILT_READ, EV_ADD | clear) && ok;
+        } else if (!(events & READABLE) && (current & READABLE)) {
+            ok = change(fd, EVFILT_READ, EV_DELETE) && ok;
+        }
+        if ((events & WRITABLE) && !(current & WRITABLE)) {
+            ok = change(fd, EVFILT_WRITE, EV_ADD | clear) && ok;
+        } else if (!(events & WRITABLE) && (current & WRITABLE)) {
+            ok = change(fd, EVFILT_WRITE, EV_DELETE) && ok;
+        }
+        current = events;
+        return ok;
+    }
+
+    void remove(int fd) {
+        modify(fd, 0);
+    }
+
+    int wait(std::vector<PollEvent>& ready, int timeoutMs) {
+        ready.clear();
+        struct timespec timeout;
+        struct timespec* timeoutPtr = NULL;
+        if (timeoutMs >= 0) {
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+            timeoutPtr = &timeout;
+        }
+
+        int count = kevent(_kqfd, NULL, 0, &_buffer[0], static_cast<int>(_buffer.size()), timeoutPtr);
+        if (count < 0) {
+            return -1;
+        }
+        // kqueue reports read and write filters separately; an fd that is
+        // both readable and writable shows up twice
+        for (int i = 0; i < count; i++) {
+            PollEvent event;
+            event.fd = static_cast<int>(_buffer[i].ident);
+            event.events = 0;
+            if (_buffer[i].flags & EV_ERROR) {
+                event.events |= ERROR;
+            } else if (_buffer[i].filter == EVFILT_READ) {
+                event.events |= READABLE; // EOF is seen by recv() returning 0
+            } else if (_buffer[i].filter == EVFILT_WRITE) {
+                event.events |= (_buffer[i].flags & EV_EOF) ? ERROR : WRITABLE;
+            }
+            ready.push_back(event);
+        }
+        if (static_cast<size_t>(count) == _buffer.size()) {
+            _buffer.resize(_buffer.size() * 2);
+        }
+        return count;
+    }
+};
+
+#endif // IRC_HAVE_KQUEUE
+
+// Portable fallback: level-triggered, scans the whole array on each wakeup.
+// Entries are located through an fd-indexed slot table and removed by
+// swapping with the last one, so add/modify/remove are constant time.
+class PollPoller : public Poller {
+private:
+    std::vector<pollfd> _pollfds;   // Collection of file descriptors for poll()
+    std::vector<int>    _slots;     // fd -> index into _pollfds (-1 = not registered)
+
+    static short toPoll(unsigned int events) {
+        short mask = 0;
+        if (events & READABLE) {
+            mask |= POLLIN;
+        }
+        if (events & WRITABLE) {
+            mask |= POLLOUT;
+        }
+        return mask;
+    }
+
+    int slot(int fd) const {
+        if (fd < 0 || static_cast<size_t>(fd) >= _slots.size()) {
+            return -1;
+        }
+        return _slots[fd];
+    }
+
+public:
+    const char* name() const { return "poll"; }
+
+    bool add(int fd, unsigned int events) {
+        if (fd < 0) {
+            return false;
+        }
+        if (slot(fd) != -1) {
+            return modify(fd, events);
+        }
+        if (static_cast<size_t>(fd) >= _slots.size()) {
+            _slots.resize(fd + 1, -1);
+        }
+        pollfd entry;
+        entry.fd = fd;
+        entry.events = toPoll(events);
+        entry.revents = 0;
+        _slots[fd] = static_cast<int>(_pollfds.size());
+        _pollfds.push_back(entry);
+        return true;
+    }
+
+    bool modify(int fd, unsigned int events) {
+        int index = slot(fd);
+        if (index == -1) {
+            return false;
+        }
+        _pollfds[index].events = toPoll(events);
+        return true;
+    }
+
+    void remove(int fd) {
+        int index = slot(fd);
+        if (index == -1) {
+            return;
+        }
+        // Move the last entry into the hole instead of shifting the array
+        int last = static_cast<int>(_pollfds.size()) - 1;
+        if (index != last) {
+            _pollfds[index] = _pollfds[last];
+            _slots[_pollfds[index].fd] = index;
+        }
+        _pollfds.pop_back();
+        _slots[fd] = -1;
+    }
+
+    int wait(std::vector<PollEvent>& ready, int timeoutMs) {
+        ready.clear();
+        if (poll(_pollfds.empty() ? NULL : &_pollfds[0], _pollfds.size(), timeoutMs) < 0) {
+            return -1;
+        }
+        // Collect first so that handlers may add/remove descriptors safely
+        for (size_t i = 0; i < _pollfds.size(); i++) {
+            short revents = _pollfds[i].revents;
+            if (revents == 0) {
+                continue;
+            }
+            PollEvent event;
+            event.fd = _pollfds[i].fd;
+            event.events = 0;
+            if (revents & POLLIN) {
+                event.events |= READABLE;
+            }
+            if (revents & POLLOUT) {
+                event.events |= WRITABLE;
+            }
+            if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                event.events |= ERROR;
+            }
+            ready.push_back(event);
+        }
+        return static_cast<int>(ready.size());
+    }
+};
+
+} // namespace
+
+Poller* Poller::create(const char* preferred) {
+    std::string choice = preferred ? preferred : "";
+
+#ifdef IRC_HAVE_EPOLL
+    if (choice.empty() || choice == "epoll") {
+        EpollPoller* poller = new EpollPoller();
+        if (poller->isValid()) {
+            return poller;
+        }
+        delete poller;
+    }
+#endif
+
+#ifdef IRC_HAVE_KQUEUE
+    if (choice.empty() || choice == "kqueue") {
+        KqueuePoller* poller = new KqueuePoller();
+        if (poller->isValid()) {
+            return poller;
+        }
+        delete poller;
+    }
+#endif
+
+    return new PollPoller();
+}
@@ -0,0 +1,46 @@
+#ifndef POLLER_HPP
+#define POLLER_HPP
+
+#include <vector>
+#include <cstddef>
+
+// One readiness notification returned by Poller::wait()
+struct PollEvent {
+    int             fd;         // Ready file descriptor
+    unsigned int    events;     // Combination of Poller::READABLE/WRITABLE/ERROR
+};
+
+// Event-loop backend driven by Server::run(). Only descriptors that are
+// actually ready are reported, so the cost of one iteration depends on the
+// amount of activity rather than on the number of registered descriptors
+// (except for the poll() fallback, which has to scan its whole array).
+class Poller {
+public:
+    enum {
+        READABLE        = 1 << 0,   // Data (or EOF) available for reading
+        WRITABLE        = 1 << 1,   // Socket send buffer has room
+        ERROR           = 1 << 2,   // Error or hangup (reported only)
+        EDGE_TRIGGERED  = 1 << 3    // Notify on state changes only (registration only)
+    };
+
+    virtual ~Poller();
+
+    // Backend name, for logging
+    virtual const char* name() const = 0;
+
+    // Register, update or unregister interest in a descriptor
+    virtual bool add(int fd, unsigned int events) = 0;
+    virtual bool modify(int fd, unsigned int events) = 0;
+    virtual void remove(int fd) = 0;
+
+    // Wait up to timeoutMs milliseconds (-1 = forever) and fill `ready`.
+    // Returns the number of events, or -1 with errno set.
+    virtual int wait(std::vector<PollEvent>& ready, int timeoutMs) = 0;
+
+    // Create the best backend available on this platform: epoll on Linux,
+    // kqueue on BSD/macOS, poll() elsewhere. `preferred` ("epoll", "kqueue"
+    // or "poll") overrides the choice when that backend is available.
+    static Poller* create(const char* preferred = NULL);
+};
+
+#endif // POLLER_HPP
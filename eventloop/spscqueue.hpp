@@ -0,0 +1,85 @@
+#ifndef SPSCQUEUE_HPP
+#define SPSCQUEUE_HPP
+
+#include <cstddef>
+
+// Unbounded lock-free single-producer/single-consumer queue, used as the
+// inbox/outbox between the main loop and each IoWorker. Exactly one thread
+// may call push() and exactly one (other) thread may call pop().
+//
+// Consumed nodes are recycled by the producer, so a queue in steady state
+// does not allocate.
+template <typename T>
+class SpscQueue {
+private:
+    struct Node {
+        Node*   next;
+        T       value;
+    };
+
+    // Consumer side
+    Node*   _tail;      // Last consumed node; _tail->next is the next item
+
+    // Producer side
+    Node*   _head;      // Most recently pushed node
+    Node*   _first;     // Oldest node available for recycling
+    Node*   _tailCopy;  // Producer's cached view of _tail
+
+    Node* allocNode() {
+        if (_first != _tailCopy) {
+            Node* node = _first;
+            _first = _first->next;
+            return node;
+        }
+        _tailCopy = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+        if (_first != _tailCopy) {
+            Node* node = _first;
+            _first = _first->next;
+            return node;
+        }
+        return new Node();
+    }
+
+    // Prevent copying
+    SpscQueue(const SpscQueue& other);
+    SpscQueue& operator=(const SpscQueue& other);
+
+public:
+    SpscQueue() {
+        Node* node = new Node();
+        node->next = NULL;
+        _tail = _head = _first = _tailCopy = node;
+    }
+
+    ~SpscQueue() {
+        Node* node = _first;
+        while (node) {
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    // Producer only
+    void push(const T& value) {
+        Node* node = allocNode();
+        node->next = NULL;
+        node->value = value;
+        __atomic_store_n(&_head->next, node, __ATOMIC_RELEASE);
+        _head = node;
+    }
+
+    // Consumer only; returns false when the queue is empty
+    bool pop(T& value) {
+        Node* next = __atomic_load_n(&_tail->next, __ATOMIC_ACQUIRE);
+        if (!next) {
+            return false;
+        }
+        value = next->value;
+        next->value = T(); // Release resources held by the slot before recycling
+        __atomic_store_n(&_tail, next, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+
+#endif // SPSCQUEUE_HPP
@@ -0,0 +1,590 @@
+#include "worker.hpp"
+#include "../logger/logger.hpp"
+#include "../metrics/metrics.hpp"
+#include "../tls/tls.hpp"
+#include "../server/listener.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+namespace {
+
+bool makePipe(int fds[2]) {
+    if (pipe(fds) == -1) {
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return true;
+}
+
+void drainPipe(int fd) {
+    char buffer[64];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+// Write one wakeup byte unless one is already pending for the reader
+void signalReader(int fd, int* flag) {
+    if (__atomic_exchange_n(flag, 1, __ATOMIC_ACQ_REL) == 0) {
+        ssize_t ret = write(fd, "x", 1);
+        (void)ret; // A full pipe already guarantees a wakeup
+    }
+}
+
+} // namespace
+
+IoWorker::IoWorker(int index, const char* pollerBackend, int notifyFd, int* notifyFlag,
+                   size_t sendqSoftLimit, size_t sendqHardLimit)
+    : _index(index), _poller(Poller::create(pollerBackend)), _started(false), _running(false),
+      _wakeFlag(0), _sendqSoftLimit(sendqSoftLimit), _sendqHardLimit(sendqHardLimit), _notifyFd(notifyFd), _notifyFlag(notifyFlag), _needsWake(false), _posted(false),
+      _draining(false), _lingering(0), _drained(0) {
+    _wakePipe[0] = -1;
+    _wakePipe[1] = -1;
+}
+
+IoWorker::~IoWorker() {
+    stop();
+    for (size_t fd = 0; fd < _connections.size(); ++fd) {
+        if (_connections[fd]) {
+            closeConnection(_connections[fd]);
+        }
+    }
+    for (size_t i = 0; i < _listeners.size(); ++i) {
+        ::close(_listeners[i].fd);
+    }
+    if (_wakePipe[0] != -1) {
+        ::close(_wakePipe[0]);
+        ::close(_wakePipe[1]);
+    }
+    delete _poller;
+}
+
+bool IoWorker::addListener(int fd, bool tls) {
+    Listener listener;
+    listener.fd = fd;
+    listener.tls = tls;
+    _listeners.push_back(listener);
+    // Level-triggered, like the main loop's listeners
+    if (!_poller->add(fd, Poller::READABLE)) {
+        LOG_ERROR("Worker " << _index << ": error registering listener: " << strerror(errno));
+        return false;
+    }
+    if (!_spareFd.valid()) {
+        _spareFd.reset(open("/dev/null", O_RDONLY | O_CLOEXEC));
+    }
+    return true;
+}
+
+bool IoWorker::start() {
+    // Started again after an abandoned hot restart: the pipe is still there
+    if (_wakePipe[0] == -1) {
+        if (!makePipe(_wakePipe)) {
+            LOG_ERROR("Worker " << _index << ": error creating wakeup pipe: " << strerror(errno));
+            return false;
+        }
+        if (!_poller->add(_wakePipe[0], Poller::READABLE)) {
+            LOG_ERROR("Worker " << _index << ": error registering wakeup pipe: " << strerror(errno));
+            return false;
+        }
+    }
+    _running = true;
+    if (pthread_create(&_thread, NULL, &IoWorker::threadMain, this) != 0) {
+        LOG_ERROR("Worker " << _index << ": error starting thread");
+        return false;
+    }
+    _started = true;
+    return true;
+}
+
+void IoWorker::stop() {
+    if (!_started) {
+        return;
+    }
+    WorkerCommand command;
+    command.type = WorkerCommand::STOP;
+    post(command);
+    wake();
+    pthread_join(_thread, NULL);
+    _started = false;
+}
+
+void* IoWorker::threadMain(void* arg) {
+    static_cast<IoWorker*>(arg)->run();
+    return NULL;
+}
+
+void IoWorker::run() {
+    // Restarted: read what arrived while stopped, edge-triggered sockets
+    // raise no new event for it
+    for (size_t fd = 0; fd < _connections.size(); fd++) {
+        Connection* conn = _connections[fd];
+        if (conn && !conn->hungUp && !conn->paused) {
+            handleRead(conn);
+        }
+    }
+    if (_posted) {
+        _posted = false;
+        signalReader(_notifyFd, _notifyFlag);
+    }
+
+    while (_running) {
+        int activity = _poller->wait(_events, -1);
+        if (activity < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Worker " << _index << ": poll error: " << strerror(errno));
+            break;
+        }
+
+        for (size_t i = 0; i < _events.size(); i++) {
+            int fd = _events[i].fd;
+            unsigned int events = _events[i].events;
+
+            if (fd == _wakePipe[0]) {
+                // Re-arm before reading the inbox so no command can be missed
+                drainPipe(fd);
+                __atomic_store_n(&_wakeFlag, 0, __ATOMIC_RELEASE);
+                processInbox();
+                continue;
+            }
+
+            if (fd < 0 || static_cast<size_t>(fd) >= _connections.size() || !_connections[fd]) {
+                for (size_t j = 0; j < _listeners.size(); j++) {
+                    if (_listeners[j].fd == fd) {
+                        acceptConnections(_listeners[j]);
+                    }
+                }
+                continue;
+            }
+            Connection* conn = _connections[fd];
+            if (events & Poller::ERROR) {
+                hangUp(conn);
+            } else {
+                if (events & Poller::READABLE) {
+                    handleRead(conn);
+                }
+                if ((events & Poller::WRITABLE) && !conn->hungUp) {
+                    handleWrite(conn);
+                }
+            }
+            if (_draining) {
+                lingerOrClose(conn);
+            }
+        }
+
+        // One wakeup for the main loop per iteration, however many events
+        if (_posted) {
+            _posted = false;
+            signalReader(_notifyFd, _notifyFlag);
+        }
+    }
+}
+
+void IoWorker::processInbox() {
+    WorkerCommand command;
+    while (_inbox.pop(command)) {
+        switch (command.type) {
+        case WorkerCommand::ATTACH: {
+            if (static_cast<size_t>(command.fd) >= _connections.size()) {
+                _connections.resize(command.fd + 1, NULL);
+            }
+            Connection* conn = new Connection();
+            conn->socket.reset(command.fd);
+            conn->id = command.id;
+            conn->tls = command.tls;
+            conn->hungUp = false;
+            conn->paused = false;
+            conn->dirty = false;
+            conn->writeArmed = false;
+            conn->output.setGauge(&Metrics::instance().sendqBytes);
+            _connections[command.fd] = conn;
+            if (!_poller->add(command.fd, Poller::READABLE | Poller::EDGE_TRIGGERED)) {
+                hangUp(conn);
+            }
+            break;
+        }
+        case WorkerCommand::SEND: {
+            Connection* conn = getConnection(command.fd, command.id);
+            if (!conn || conn->hungUp) {
+                break;
+            }
+            queueOutput(conn, command.payload, command.priority);
+            break;
+        }
+        case WorkerCommand::CLOSE: {
+            Connection* conn = getConnection(command.fd, command.id);
+            if (!conn) {
+                break;
+            }
+            if (conn->dirty) {
+                // Unlink from _dirty, the connection is flushed and freed below
+                for (size_t i = 0; i < _dirty.size(); i++) {
+                    if (_dirty[i] == conn) {
+                        _dirty[i] = _dirty.back();
+                        _dirty.pop_back();
+                        break;
+                    }
+                }
+            }
+            // Best effort: deliver whatever the socket buffer accepts
+            if (!conn->hungUp) {
+                flushOutput(conn);
+            }
+            closeConnection(conn);
+            break;
+        }
+        case WorkerCommand::PAUSE:
+        case WorkerCommand::RESUME: {
+            Connection* conn = getConnection(command.fd, command.id);
+            if (!conn || conn->hungUp) {
+                break;
+            }
+            conn->paused = command.type == WorkerCommand::PAUSE;
+            if (!conn->paused && _running) {
+                handleRead(conn); // Edge-triggered: no new event for data already queued
+            }
+            break;
+        }
+        case WorkerCommand::DRAIN:
+            startDrain();
+            break;
+        case WorkerCommand::STOP:
+            _running = false;
+            break;
+        }
+    }
+
+    flushDirty();
+}
+
+void IoWorker::flushDirty() {
+    // Coalesced flush: one write pass per connection per batch of commands
+    for (size_t i = 0; i < _dirty.size(); i++) {
+        _dirty[i]->dirty = false;
+        if (!_dirty[i]->hungUp) {
+            handleWrite(_dirty[i]);
+        }
+    }
+    _dirty.clear();
+}
+
+void IoWorker::startDrain() {
+    // The main loop has posted its last lines and waits for drained()
+    for (size_t i = 0; i < _listeners.size(); i++) {
+        _poller->remove(_listeners[i].fd);
+        ::close(_listeners[i].fd);
+    }
+    _listeners.clear();
+    // Send the final lines now: connections may close below
+    flushDirty();
+    _draining = true;
+    for (size_t fd = 0; fd < _connections.size(); fd++) {
+        if (_connections[fd]) {
+            _connections[fd]->paused = true;
+            _lingering++;
+        }
+    }
+    for (size_t fd = 0; fd < _connections.size(); fd++) {
+        if (_connections[fd]) {
+            lingerOrClose(_connections[fd]);
+        }
+    }
+    if (_lingering == 0) {
+        __atomic_store_n(&_drained, 1, __ATOMIC_RELEASE);
+        _posted = true; // Wakes the main loop
+    }
+}
+
+void IoWorker::lingerOrClose(Connection* conn) {
+    // Nothing more will be written during a handshake
+    if (conn->hungUp || conn->output.empty() || (conn->tls && !conn->tls->established())) {
+        closeConnection(conn);
+    }
+}
+
+void IoWorker::finish() {
+    // Stopped: _running is false, so RESUME leaves the data in the socket
+    // for the process taking it over
+    processInbox();
+}
+
+bool IoWorker::copyOutput(int fd, unsigned long id, std::string& out) {
+    Connection* conn = getConnection(fd, id);
+    if (!conn || conn->hungUp || conn->tls) {
+        return false;
+    }
+    conn->output.copy(out);
+    return true;
+}
+
+void IoWorker::listeners(std::vector<std::pair<int, bool> >& out) const {
+    for (size_t i = 0; i < _listeners.size(); i++) {
+        out.push_back(std::make_pair(_listeners[i].fd, _listeners[i].tls));
+    }
+}
+
+void IoWorker::acceptConnections(const Listener& listener) {
+    // Same loop as Server::handleNewConnection; the throttle and the
+    // client state live on the main loop, so sockets only pass through
+    for (size_t accepted = 0; accepted < ACCEPT_BATCH; accepted++) {
+        struct sockaddr_storage address;
+        int fd = acceptSocket(listener.fd, address);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && _spareFd.valid()) {
+                LOG_WARNING("Worker " << _index << ": error accepting connection: " << strerror(errno));
+                _spareFd.reset();
+                UniqueFd shed(acceptSocket(listener.fd, address));
+                shed.reset();
+                _spareFd.reset(open("/dev/null", O_RDONLY | O_CLOEXEC));
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR("Worker " << _index << ": error accepting connection: " << strerror(errno));
+            }
+            return;
+        }
+        WorkerEvent event;
+        event.type = WorkerEvent::ACCEPTED;
+        event.fd = fd;
+        event.data = formatAddress(address);
+        event.sourceKey = sourceKeyOf(address);
+        event.tls = listener.tls;
+        _outbox.push(event);
+        _posted = true;
+    }
+}
+
+void IoWorker::handleRead(Connection* conn) {
+    char buffer[4096];
+    std::string data;
+    
+    // Paused: the socket keeps the data (and its window closes on the
+    // sender) until RESUME
+    if (conn->paused) {
+        return;
+    }
+
+    // TLS: the handshake drains the socket too, data may follow it
+    if (conn->tls && !conn->tls->established()) {
+        TlsStream::Handshake state = conn->tls->handshake();
+        if (state == TlsStream::HANDSHAKE_FAILED) {
+            hangUp(conn);
+            return;
+        }
+        if (state == TlsStream::HANDSHAKE_WANT_WRITE && !conn->writeArmed) {
+            conn->writeArmed = true;
+            _poller->modify(conn->socket.get(), Poller::READABLE | Poller::WRITABLE | Poller::EDGE_TRIGGERED);
+        }
+        if (state != TlsStream::HANDSHAKE_DONE) {
+            return;
+        }
+    }
+    
+    // Edge-triggered: drain the socket before waiting again
+    while (true) {
+        ssize_t bytesRead = conn->tls ? conn->tls->recv(buffer, sizeof(buffer))
+                                      : recv(conn->socket.get(), buffer, sizeof(buffer), 0);
+        if (bytesRead > 0) {
+            metricAdd(Metrics::instance().bytesReceived, static_cast<unsigned long>(bytesRead));
+            data.append(buffer, bytesRead);
+            continue;
+        }
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (!data.empty()) {
+            postEvent(WorkerEvent::DATA, conn, data);
+        }
+        if (bytesRead == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            hangUp(conn);
+        }
+        return;
+    }
+}
+
+OutputQueue::FlushResult IoWorker::flushOutput(Connection* conn) {
+    return conn->tls ? conn->tls->flush(conn->output) : conn->output.flush(conn->socket.get());
+}
+
+void IoWorker::handleWrite(Connection* conn) {
+    if (conn->tls && !conn->tls->established()) {
+        // Writability the handshake was waiting for
+        if (conn->writeArmed) {
+            conn->writeArmed = false;
+            _poller->modify(conn->socket.get(), Poller::READABLE | Poller::EDGE_TRIGGERED);
+            handleRead(conn);
+        }
+        return;
+    }
+    
+    // Write interest is only armed while output is pending
+    switch (flushOutput(conn)) {
+    case OutputQueue::FLUSH_DONE:
+        if (conn->writeArmed) {
+            conn->writeArmed = false;
+            _poller->modify(conn->socket.get(), Poller::READABLE | Poller::EDGE_TRIGGERED);
+        }
+        break;
+    case OutputQueue::FLUSH_PENDING:
+        if (!conn->writeArmed) {
+            conn->writeArmed = true;
+            _poller->modify(conn->socket.get(), Poller::READABLE | Poller::WRITABLE | Poller::EDGE_TRIGGERED);
+        }
+        break;
+    case OutputQueue::FLUSH_ERROR:
+        hangUp(conn);
+        break;
+    }
+}
+
+void IoWorker::queueOutput(Connection* conn, const Payload& payload, OutputQueue::Priority priority) {
+    // Same policy as Client::sendPayload in the single-threaded loop
+    if (!conn->writeArmed && conn->output.bytes() + payload.size() > _sendqSoftLimit) {
+        handleWrite(conn);
+        if (conn->hungUp) {
+            return;
+        }
+    }
+    
+    switch (conn->output.admit(payload.size(), priority, _sendqSoftLimit, _sendqHardLimit)) {
+    case OutputQueue::ADMIT_DROP:
+        metricIncrement(Metrics::instance().sendqDropped);
+        return;
+    case OutputQueue::ADMIT_OVERFLOW:
+        LOG_WARNING("SendQ exceeded for fd " << conn->socket.get() << " (" << conn->output.bytes() << " bytes queued)");
+        metricIncrement(Metrics::instance().sendqEvicted);
+        conn->output.clear();
+        conn->output.push(Payload::frame("ERROR :SendQ exceeded"));
+        flushOutput(conn);
+        hangUp(conn); // The main loop removes the client and releases the fd
+        return;
+    case OutputQueue::ADMIT:
+        break;
+    }
+    
+    conn->output.push(payload);
+    if (!conn->dirty) {
+        conn->dirty = true;
+        _dirty.push_back(conn);
+    }
+}
+
+void IoWorker::hangUp(Connection* conn) {
+    if (conn->hungUp) {
+        return;
+    }
+    // Stop watching the socket but keep the fd open until the main loop
+    // releases it, so the number cannot be reused while a Client owns it
+    conn->hungUp = true;
+    conn->output.clear();
+    _poller->remove(conn->socket.get());
+    postEvent(WorkerEvent::HANGUP, conn, "");
+}
+
+void IoWorker::closeConnection(Connection* conn) {
+    if (!conn->hungUp) {
+        _poller->remove(conn->socket.get());
+    }
+    _connections[conn->socket.get()] = NULL;
+    delete conn->tls;
+    delete conn; // Closes the socket
+    if (_draining && --_lingering == 0) {
+        __atomic_store_n(&_drained, 1, __ATOMIC_RELEASE);
+        _posted = true; // Wakes the main loop
+    }
+}
+
+void IoWorker::postEvent(WorkerEvent::Type type, Connection* conn, const std::string& data) {
+    WorkerEvent event;
+    event.type = type;
+    event.fd = conn->socket.get();
+    event.id = conn->id;
+    event.data = data;
+    _outbox.push(event);
+    _posted = true;
+}
+
+IoWorker::Connection* IoWorker::getConnection(int fd, unsigned long id) {
+    if (fd < 0 || static_cast<size_t>(fd) >= _connections.size()) {
+        return NULL;
+    }
+    Connection* conn = _connections[fd];
+    if (!conn || conn->id != id) {
+        return NULL;
+    }
+    return conn;
+}
+
+void IoWorker::post(const WorkerCommand& command) {
+    _inbox.push(command);
+    _needsWake = true;
+}
+
+void IoWorker::attach(int fd, unsigned long id, TlsStream* tls) {
+    WorkerCommand command;
+    command.type = WorkerCommand::ATTACH;
+    command.fd = fd;
+    command.id = id;
+    command.tls = tls;
+    post(command);
+}
+
+void IoWorker::enqueue(int fd, unsigned long id, const Payload& payload, OutputQueue::Priority priority) {
+    WorkerCommand command;
+    command.type = WorkerCommand::SEND;
+    command.fd = fd;
+    command.id = id;
+    command.payload = payload;
+    command.priority = priority;
+    post(command);
+}
+
+void IoWorker::release(int fd, unsigned long id) {
+    WorkerCommand command;
+    command.type = WorkerCommand::CLOSE;
+    command.fd = fd;
+    command.id = id;
+    post(command);
+}
+
+void IoWorker::drain() {
+    WorkerCommand command;
+    command.type = WorkerCommand::DRAIN;
+    post(command);
+}
+
+void IoWorker::pauseReading(int fd, unsigned long id) {
+    WorkerCommand command;
+    command.type = WorkerCommand::PAUSE;
+    command.fd = fd;
+    command.id = id;
+    post(command);
+}
+
+void IoWorker::resumeReading(int fd, unsigned long id) {
+    WorkerCommand command;
+    command.type = WorkerCommand::RESUME;
+    command.fd = fd;
+    command.id = id;
+    post(command);
+}
+
+void IoWorker::wake() {
+    if (!_needsWake) {
+        return;
+    }
+    _needsWake = false;
+    signalReader(_wakePipe[1], &_wakeFlag);
+}
+
+bool IoWorker::pollEvent(WorkerEvent& event) {
+    return _outbox.pop(event);
+}
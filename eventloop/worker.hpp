@@ -0,0 +1,155 @@
+#ifndef WORKER_HPP
+#define WORKER_HPP
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "poller.hpp"
+#include "spscqueue.hpp"
+#include "../buffers/outputqueue.hpp"
+#include "../utils/uniquefd.hpp"
+
+class TlsStream;
+
+// Request posted by the main loop to an IoWorker
+struct WorkerCommand {
+    enum Type {
+        ATTACH,     // Take ownership of a freshly accepted socket
+        SEND,       // Queue framed output for a connection
+        CLOSE,      // Flush what the socket accepts, then close it
+        PAUSE,      // Stop reading: the main loop is holding back the client's input
+        RESUME,     // Read again, starting with what the socket kept meanwhile
+        DRAIN,      // Shutdown: stop accepting and reading, close each connection once its output is out
+        STOP        // Leave the worker loop
+    };
+    Type            type;
+    int             fd;
+    unsigned long   id;         // Client id, guards against fd reuse
+    Payload         payload;    // SEND only; shared with other recipients
+    OutputQueue::Priority priority; // SEND only; send-queue admission class
+    TlsStream*      tls;        // ATTACH only; TLS layer handed over with the socket
+
+    WorkerCommand() : type(STOP), fd(-1), id(0), priority(OutputQueue::PRIORITY_NORMAL), tls(NULL) {}
+};
+
+// Notification posted by an IoWorker back to the main loop
+struct WorkerEvent {
+    enum Type {
+        DATA,       // Bytes received from the socket
+        HANGUP,     // Peer closed the connection or a socket error occurred
+        ACCEPTED    // New socket on a sharded listener, awaiting the main loop's ATTACH
+    };
+    Type            type;
+    int             fd;
+    unsigned long   id;
+    std::string     data;       // ACCEPTED: peer address
+    unsigned long   sourceKey;  // ACCEPTED only; throttle key of the peer
+    bool            tls;        // ACCEPTED only; came in on a TLS listener
+
+    WorkerEvent() : type(HANGUP), fd(-1), id(0), sourceKey(0), tls(false) {}
+};
+
+// Socket I/O loop running on its own thread (threaded mode). Each accepted
+// client fd is pinned to one worker, which owns its reads, writes and
+// close. Channel and client state stays on the main loop; the two sides
+// only talk through lock-free SPSC queues, so a channel broadcast costs
+// one queue push per member and one wakeup per worker.
+//
+// With sharded listeners (IRCSERV_REUSEPORT) each worker also accepts on
+// its own SO_REUSEPORT sockets. Accepted fds go to the main loop, which
+// admits them and attaches them back to the same worker.
+class IoWorker {
+private:
+    struct Connection {
+        UniqueFd        socket;     // Owned from ATTACH until the connection is freed
+        unsigned long   id;
+        OutputQueue     output;     // Data waiting for socket buffer space
+        TlsStream*      tls;        // Owned; NULL for plaintext
+        bool            hungUp;     // HANGUP already reported, ignore the socket
+        bool            paused;     // Reads held off until RESUME
+        bool            dirty;      // Has unflushed output from this batch
+        bool            writeArmed; // Write interest registered with the poller
+    };
+
+    struct Listener {
+        int             fd;         // Owned
+        bool            tls;
+    };
+
+    int                         _index;         // Worker number, for logging
+    Poller*                     _poller;        // This worker's event-loop backend
+    pthread_t                   _thread;
+    bool                        _started;
+    bool                        _running;       // Worker thread only
+    int                         _wakePipe[2];   // Main loop -> worker wakeup
+    int                         _wakeFlag;      // Set while a wakeup byte is in flight
+    size_t                      _sendqSoftLimit; // See ServerConfig
+    size_t                      _sendqHardLimit;
+    int                         _notifyFd;      // Worker -> main loop wakeup (write end)
+    int*                        _notifyFlag;    // Shared by all workers, owned by Server
+    bool                        _needsWake;     // Main loop only: commands posted since last wake()
+    bool                        _posted;        // Worker only: events posted in this iteration
+    bool                        _draining;      // Worker only: DRAIN received
+    size_t                      _lingering;     // Worker only: connections left to drain
+    int                         _drained;       // Atomic: DRAIN done, no connection left
+    SpscQueue<WorkerCommand>    _inbox;
+    SpscQueue<WorkerEvent>      _outbox;
+    std::vector<Connection*>    _connections;   // Indexed by fd
+    std::vector<Connection*>    _dirty;         // Connections to flush after the inbox
+    std::vector<PollEvent>      _events;
+    std::vector<Listener>       _listeners;     // Sharded listeners, fixed before start()
+    UniqueFd                    _spareFd;       // Reserve descriptor for shedding connections at EMFILE
+
+    static void* threadMain(void* arg);
+    void run();
+    void processInbox();
+    void flushDirty();
+    void acceptConnections(const Listener& listener);
+    void handleRead(Connection* conn);
+    void handleWrite(Connection* conn);
+    OutputQueue::FlushResult flushOutput(Connection* conn);
+    void queueOutput(Connection* conn, const Payload& payload, OutputQueue::Priority priority);
+    void hangUp(Connection* conn);
+    void closeConnection(Connection* conn);
+    void startDrain();
+    void lingerOrClose(Connection* conn);
+    void postEvent(WorkerEvent::Type type, Connection* conn, const std::string& data);
+    Connection* getConnection(int fd, unsigned long id);
+    void post(const WorkerCommand& command);
+
+    // Prevent copying
+    IoWorker(const IoWorker& other);
+    IoWorker& operator=(const IoWorker& other);
+
+public:
+    IoWorker(int index, const char* pollerBackend, int notifyFd, int* notifyFlag,
+             size_t sendqSoftLimit, size_t sendqHardLimit);
+    ~IoWorker();
+
+    // Accept on `fd` too (takes ownership); only before start()
+    bool addListener(int fd, bool tls);
+    bool start();                       // Again after stop() to carry on
+    void stop();
+
+    // Main loop side
+    void attach(int fd, unsigned long id, TlsStream* tls = NULL);
+    void enqueue(int fd, unsigned long id, const Payload& payload, OutputQueue::Priority priority);
+    void release(int fd, unsigned long id);
+    void pauseReading(int fd, unsigned long id);
+    void resumeReading(int fd, unsigned long id);
+    void drain();                       // Shutdown, after the last SEND; see WorkerCommand::DRAIN
+    bool drained() const { return __atomic_load_n(&_drained, __ATOMIC_ACQUIRE) != 0; }
+    void wake();                        // Deliver the commands posted so far
+    bool pollEvent(WorkerEvent& event); // Fetch the next event for the main loop
+
+    // Hot restart, once stop() returned: run the commands posted since on
+    // the calling thread (sockets are no longer read), then collect what
+    // the connections and listeners are handed over with
+    void finish();
+    // Unsent output of a connection, left queued; false if it is gone or speaks TLS
+    bool copyOutput(int fd, unsigned long id, std::string& out);
+    // Sharded listeners, (fd, tls); they stay owned by the worker
+    void listeners(std::vector<std::pair<int, bool> >& out) const;
+};
+
+#endif // WORKER_HPP
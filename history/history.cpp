@@ -0,0 +1,250 @@
+#include "history.hpp"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sys/time.h>
+
+namespace {
+
+// Stale budget records tolerated before they are swept out
+const size_t STALE_RECORD_SLACK = 1024;
+
+// "2026-10-14T12:34:56.789Z" into `text`, returns the length
+int renderTimestamp(WallMs time, char* text, size_t size) {
+    time_t seconds = static_cast<time_t>(time / 1000);
+    struct tm parts;
+    gmtime_r(&seconds, &parts);
+    return snprintf(text, size, "%04d-%02d-%02dT%02d:%02d:%02d.%03uZ", parts.tm_year + 1900,
+                    parts.tm_mon + 1, parts.tm_mday, parts.tm_hour, parts.tm_min, parts.tm_sec,
+                    static_cast<unsigned int>(time % 1000));
+}
+
+// "time=2026-10-14T12:34:56.789Z;msgid=42 "
+Payload renderTags(WallMs time, unsigned long id) {
+    char text[80] = "time=";
+    int length = 5 + renderTimestamp(time, text + 5, sizeof(text) - 5);
+    length += snprintf(text + length, sizeof(text) - length, ";msgid=%lu ", id);
+    return Payload(text, static_cast<size_t>(length));
+}
+
+} // namespace
+
+WallMs wallClockMs() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return static_cast<WallMs>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+}
+
+std::string formatTimestamp(WallMs time) {
+    char text[40];
+    return std::string(text, renderTimestamp(time, text, sizeof(text)));
+}
+
+bool parseTimestamp(const std::string& text, WallMs& out) {
+    struct tm parts;
+    memset(&parts, 0, sizeof(parts));
+    unsigned int millis = 0;
+    int consumed = 0;
+    if (sscanf(text.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%n", &parts.tm_year, &parts.tm_mon, &parts.tm_mday,
+               &parts.tm_hour, &parts.tm_min, &parts.tm_sec, &consumed) != 6) {
+        return false;
+    }
+    const char* rest = text.c_str() + consumed;
+    if (*rest == '.') {
+        int digits = 0;
+        for (rest++; *rest >= '0' && *rest <= '9'; rest++, digits++) {
+            if (digits < 3) {
+                millis = millis * 10 + (*rest - '0');
+            }
+        }
+        for (; digits < 3; digits++) {
+            millis *= 10;
+        }
+    }
+    if (rest[0] != 'Z' || rest[1] != '\0') {
+        return false;
+    }
+    parts.tm_year -= 1900;
+    parts.tm_mon -= 1;
+    time_t seconds = timegm(&parts);
+    if (seconds == static_cast<time_t>(-1) || seconds < 0) {
+        return false;
+    }
+    out = static_cast<WallMs>(seconds) * 1000 + millis;
+    return true;
+}
+
+ChannelHistory::ChannelHistory(size_t capacity)
+    : _start(0), _count(0), _capacity(capacity), _budget(NULL), _ringId(0) {
+}
+
+ChannelHistory::~ChannelHistory() {
+    while (_count > 0) {
+        dropOldest();
+    }
+    freeSlots();
+    if (_budget) {
+        _budget->detach(_ringId);
+    }
+}
+
+void ChannelHistory::record(const Payload& line, HistoryBudget& budget) {
+    if (_capacity == 0) {
+        return;
+    }
+    // A clock stepped back must not unsort the ring
+    WallMs now = wallClockMs();
+    if (_count > 0 && now < at(_count - 1).time) {
+        now = at(_count - 1).time;
+    }
+    append(line, now, budget.nextEntryId(), budget);
+}
+
+void ChannelHistory::restore(const Payload& line, WallMs time, unsigned long id, HistoryBudget& budget) {
+    // Both orders still hold for what the previous process recorded
+    if (_capacity == 0 || (_count > 0 && (time < at(_count - 1).time || id <= at(_count - 1).id))) {
+        return;
+    }
+    budget.reserveEntryIds(id + 1);
+    append(line, time, id, budget);
+}
+
+void ChannelHistory::append(const Payload& line, WallMs time, unsigned long id, HistoryBudget& budget) {
+    if (!_budget) {
+        _budget = &budget;
+        _ringId = budget.attach(this);
+    }
+    if (_ring.empty()) {
+        // Charged while still empty: eviction has nothing here to take back
+        _ring.resize(_capacity);
+        budget.chargeSlots(_capacity * sizeof(Entry));
+    }
+    if (_count == _capacity) {
+        dropOldest();
+    }
+    Entry& entry = _ring[(_start + _count) % _ring.size()];
+    entry.time = time;
+    entry.id = id;
+    entry.tags = renderTags(entry.time, entry.id);
+    entry.line = line;
+    _count++;
+    budget.charge(_ringId, entry.id, entry.tags.size() + entry.line.size());
+}
+
+void ChannelHistory::dropOldest() {
+    Entry& entry = _ring[_start];
+    _budget->release(entry.tags.size() + entry.line.size());
+    entry.tags = Payload();
+    entry.line = Payload();
+    _start = (_start + 1) % _ring.size();
+    _count--;
+}
+
+void ChannelHistory::freeSlots() {
+    if (_ring.empty()) {
+        return;
+    }
+    _budget->releaseSlots(_capacity * sizeof(Entry));
+    std::vector<Entry>().swap(_ring);
+    _start = 0;
+}
+
+size_t ChannelHistory::firstAtOrAfter(WallMs time) const {
+    size_t low = 0;
+    size_t high = _count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (at(middle).time < time) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+size_t ChannelHistory::firstAfter(WallMs time) const {
+    return time == ~static_cast<WallMs>(0) ? _count : firstAtOrAfter(time + 1);
+}
+
+size_t ChannelHistory::findId(unsigned long id, bool& found) const {
+    // Ids are consecutive within the budget, not within a ring
+    size_t low = 0;
+    size_t high = _count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (at(middle).id < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    found = low < _count && at(low).id == id;
+    return low;
+}
+
+HistoryBudget::HistoryBudget(size_t limit)
+    : _bytes(0), _limit(limit), _entries(0), _nextRing(1), _nextEntry(1) {
+}
+
+unsigned long HistoryBudget::attach(ChannelHistory* ring) {
+    _rings.insert(_nextRing, ring);
+    return _nextRing++;
+}
+
+void HistoryBudget::detach(unsigned long ringId) {
+    _rings.erase(ringId);
+}
+
+bool HistoryBudget::live(const Record& record) const {
+    ChannelHistory* const* ring = _rings.find(record.ring);
+    return ring && !(*ring)->empty() && record.entry >= (*ring)->at(0).id;
+}
+
+void HistoryBudget::charge(unsigned long ringId, unsigned long entryId, size_t bytes) {
+    Record record;
+    record.ring = ringId;
+    record.entry = entryId;
+    _order.push_back(record);
+    _bytes += bytes;
+    _entries++;
+    evict();
+
+    // Lines rings dropped themselves (full ring, channel gone) leave
+    // records behind; sweep them once they outnumber the live ones
+    if (_order.size() > 2 * _entries + STALE_RECORD_SLACK) {
+        std::deque<Record> kept;
+        for (size_t i = 0; i < _order.size(); i++) {
+            if (live(_order[i])) {
+                kept.push_back(_order[i]);
+            }
+        }
+        _order.swap(kept);
+    }
+}
+
+void HistoryBudget::chargeSlots(size_t bytes) {
+    _bytes += bytes;
+    evict();
+}
+
+void HistoryBudget::evict() {
+    // The front record, when live, is the oldest line of its ring; a ring
+    // left without lines gives its slots back too
+    while (_bytes > _limit && !_order.empty()) {
+        Record oldest = _order.front();
+        _order.pop_front();
+        if (live(oldest)) {
+            ChannelHistory* ring = *_rings.find(oldest.ring);
+            ring->dropOldest();
+            if (ring->empty()) {
+                ring->freeSlots();
+            }
+        }
+    }
+}
+
+void HistoryBudget::release(size_t bytes) {
+    _bytes -= bytes;
+    _entries--;
+}
@@ -0,0 +1,131 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <cstddef>
+#include "../buffers/payload.hpp"
+#include "../utils/flatmap.hpp"
+
+class HistoryBudget;
+
+// Wall-clock milliseconds since the epoch, for server-time tags
+typedef unsigned long long WallMs;
+
+WallMs wallClockMs();
+
+// "2026-10-14T12:34:56.789Z" (UTC, milliseconds optional); false if malformed
+bool parseTimestamp(const std::string& text, WallMs& out);
+std::string formatTimestamp(WallMs time);
+
+// Recent PRIVMSG/NOTICE lines of one channel, for CHATHISTORY. A fixed
+// ring of slots, allocated on the first line and given back when the
+// budget evicts the last one (the budget pays for it meanwhile); each
+// holds the framed line
+// as broadcast (the same shared payload the members' send queues got)
+// and its pre-rendered tags ("time=...;msgid=... "), so a replay queues
+// both by reference and the send path gathers them into one write.
+//
+// Entries are ordered by id and time alike: ids are handed out by the
+// budget as lines are recorded, and times never go back within a ring.
+class ChannelHistory {
+public:
+    struct Entry {
+        Payload         tags;       // "time=<ISO 8601>;msgid=<id> ", without the '@'
+        Payload         line;
+        WallMs          time;
+        unsigned long   id;         // msgid, unique on this server
+    };
+
+private:
+    std::vector<Entry>  _ring;      // _capacity slots while holding lines, else none
+    size_t              _start;     // Oldest entry
+    size_t              _count;
+    size_t              _capacity;  // Lines kept (0 = none)
+    HistoryBudget*      _budget;    // Set by the first record()
+    unsigned long       _ringId;    // Key in the budget
+
+    void append(const Payload& line, WallMs time, unsigned long id, HistoryBudget& budget);
+
+    // Prevent copying
+    ChannelHistory(const ChannelHistory& other);
+    ChannelHistory& operator=(const ChannelHistory& other);
+
+public:
+    explicit ChannelHistory(size_t capacity);
+    ~ChannelHistory();
+
+    // Keep `line`, dropping the oldest entry when full; the budget may
+    // drop more (here or in other channels) to stay under its limit
+    void record(const Payload& line, HistoryBudget& budget);
+    // Hot restart: an entry recorded by the previous process, oldest first
+    void restore(const Payload& line, WallMs time, unsigned long id, HistoryBudget& budget);
+    void dropOldest();
+    // Give the slots back to the budget; the ring must be empty
+    void freeSlots();
+
+    size_t size() const { return _count; }
+    bool empty() const { return _count == 0; }
+    // i = 0 is the oldest
+    const Entry& at(size_t i) const { return _ring[(_start + i) % _ring.size()]; }
+
+    // Positions, for resolving CHATHISTORY references: entries [0, pos)
+    // are older than the reference
+    size_t firstAtOrAfter(WallMs time) const;   // time >= `time`
+    size_t firstAfter(WallMs time) const;       // time > `time`
+    size_t findId(unsigned long id, bool& found) const;
+};
+
+// Process-wide bound on the memory held by all channel histories, in
+// bytes of recorded lines and tags and of the slot arrays of the rings
+// holding them. Over it, the oldest lines go first,
+// whichever channel they belong to; the budget keeps their order as
+// (ring, entry id) records and skips those that a ring dropped itself.
+class HistoryBudget {
+private:
+    struct Record {
+        unsigned long   ring;
+        unsigned long   entry;
+    };
+
+    FlatMap<unsigned long, ChannelHistory*> _rings;
+    std::deque<Record>  _order;     // Oldest first, possibly stale
+    size_t              _bytes;
+    size_t              _limit;
+    size_t              _entries;   // Live entries, all rings
+    unsigned long       _nextRing;
+    unsigned long       _nextEntry;
+
+    bool live(const Record& record) const;
+    void evict();
+
+    // Prevent copying
+    HistoryBudget(const HistoryBudget& other);
+    HistoryBudget& operator=(const HistoryBudget& other);
+
+public:
+    explicit HistoryBudget(size_t limit);
+
+    unsigned long attach(ChannelHistory* ring);
+    void detach(unsigned long ringId);
+    unsigned long nextEntryId() { return _nextEntry++; }
+    // Hot restart: ids below `next` were handed out by the previous process
+    unsigned long peekEntryId() const { return _nextEntry; }
+    void reserveEntryIds(unsigned long next) {
+        if (next > _nextEntry) {
+            _nextEntry = next;
+        }
+    }
+
+    // Account for a recorded entry, evicting the oldest while over the limit
+    void charge(unsigned long ringId, unsigned long entryId, size_t bytes);
+    void release(size_t bytes);
+    // Account for the slot array of a ring, evicting as charge() does
+    void chargeSlots(size_t bytes);
+    void releaseSlots(size_t bytes) { _bytes -= bytes; }
+
+    size_t bytes() const { return _bytes; }
+};
+
+#endif // HISTORY_HPP
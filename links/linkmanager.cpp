@@ -0,0 +1,849 @@
+#include "linkmanager.hpp"
+#include "../server/server.hpp"
+#include "../client/client.hpp"
+#include "../channels/channels.hpp"
+#include "../parser/message.hpp"
+#include "../buffers/linebuilder.hpp"
+#include "../logger/logger.hpp"
+#include "../server/listener.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace {
+
+// Delay before reconnecting a configured peer
+const TimeMs LINK_RETRY_MS = 10000;
+
+// Time allowed to connect and exchange SERVER lines
+const TimeMs LINK_HANDSHAKE_MS = 30000;
+
+// Queued bytes past which a peer is considered stuck and the link dropped;
+// a burst of a large network has to fit
+const size_t LINK_SENDQ_LIMIT = 16 * 1024 * 1024;
+
+// Names per SJOIN line, well inside 512 bytes
+const size_t SJOIN_BUDGET = 400;
+
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1 && fcntl(fd, F_SETFD, FD_CLOEXEC) != -1;
+}
+
+// Nickname part of a "nick!user@host" source
+std::string sourceNick(const StringView& prefix) {
+    size_t length = 0;
+    while (length < prefix.length && prefix[length] != '!') {
+        length++;
+    }
+    return std::string(prefix.data, length);
+}
+
+} // namespace
+
+LinkManager::LinkManager(Server* server, Poller* poller)
+    : _server(server), _poller(poller), _reapPending(false) {
+}
+
+LinkManager::~LinkManager() {
+    // Shutdown: no netsplit fan-out, just free the remote users
+    for (size_t i = 0; i < _links.size(); i++) {
+        PeerLink* link = _links[i];
+        std::vector<Client*> users = link->users.items();
+        for (size_t j = 0; j < users.size(); j++) {
+            delete users[j];
+        }
+        _poller->remove(link->socket.get());
+        delete link;
+    }
+    for (size_t i = 0; i < 2; i++) {
+        if (_listeners[i].valid()) {
+            _poller->remove(_listeners[i].get());
+        }
+    }
+}
+
+bool LinkManager::setup() {
+    const ServerConfig& config = _server->getConfig();
+    if (config.linkPassword.empty()) {
+        LOG_ERROR("Server links need IRCSERV_LINK_PASSWORD");
+        return false;
+    }
+    if (!parsePeers(config.linkPeers)) {
+        return false;
+    }
+
+    if (config.linkPort > 0) {
+        // IPv4 is required, IPv6 only taken where the host has it
+        const char* wildcards[2] = { "0.0.0.0", "::" };
+        for (size_t i = 0; i < 2; i++) {
+            ListenerSpec spec;
+            spec.address = wildcards[i];
+            spec.port = static_cast<unsigned int>(config.linkPort);
+            spec.tls = false;
+            _listeners[i].reset(openListener(spec, 16, false));
+            if (_listeners[i].valid() && !_poller->add(_listeners[i].get(), Poller::READABLE)) {
+                _listeners[i].reset();
+            }
+        }
+        if (!_listeners[0].valid()) {
+            LOG_ERROR("Error setting up server link listener on port " << config.linkPort);
+            _listeners[1].reset();
+            return false;
+        }
+        if (!_listeners[1].valid()) {
+            LOG_WARNING("Server links accepted over IPv4 only");
+        }
+        // Held in reserve so links can still be turned away at EMFILE
+        _spareFd.reset(open("/dev/null", O_RDONLY | O_CLOEXEC));
+    }
+
+    for (size_t i = 0; i < _peers.size(); i++) {
+        connectPeer(i);
+    }
+    LOG_INFO("Server links enabled as " << config.serverName << " (port " << config.linkPort << ", "
+             << _peers.size() << " configured peers)");
+    return true;
+}
+
+bool LinkManager::parsePeers(const std::string& spec) {
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) {
+            end = spec.size();
+        }
+        std::string entry = spec.substr(start, end - start);
+        start = end + 1;
+        if (entry.empty()) {
+            continue;
+        }
+
+        // Same syntax as IRCSERV_LISTEN, the address required and no TLS
+        Peer peer;
+        ListenerSpec target;
+        if (!parseListenerSpec(entry, target) || target.tls || entry.find(':') == std::string::npos) {
+            LOG_ERROR("Invalid server link peer " << entry << " (expected ip:port or [ipv6]:port)");
+            return false;
+        }
+        if (!resolveListenerSpec(target, peer.sockaddr, peer.sockaddrLength)) {
+            return false;
+        }
+        peer.address = target.describe();
+        peer.link = NULL;
+        peer.retryAt = 0;
+        _peers.push_back(peer);
+    }
+    return true;
+}
+
+PeerLink* LinkManager::findLink(int fd) {
+    for (size_t i = 0; i < _links.size(); i++) {
+        if (_links[i]->socket.get() == fd) {
+            return _links[i];
+        }
+    }
+    return NULL;
+}
+
+// ---- Connections ---------------------------------------------------------
+
+bool LinkManager::handleEvent(int fd, unsigned int events) {
+    for (size_t i = 0; i < 2; i++) {
+        if (_listeners[i].valid() && fd == _listeners[i].get()) {
+            acceptLinks(fd);
+            return true;
+        }
+    }
+    PeerLink* link = findLink(fd);
+    if (!link) {
+        return false;
+    }
+    if (link->dead) {
+        return true;
+    }
+    if (link->state == PeerLink::CONNECTING) {
+        finishConnect(link);
+        return true;
+    }
+    // Read first: a closing peer's last lines (ERROR) come with the hangup
+    if (events & (Poller::READABLE | Poller::ERROR)) {
+        readLink(link);
+    }
+    if ((events & Poller::WRITABLE) && !link->dead) {
+        writeLink(link);
+    }
+    return true;
+}
+
+void LinkManager::acceptLinks(int listenFd) {
+    while (true) {
+        struct sockaddr_storage addr;
+        int fd = acceptSocket(listenFd, addr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && _spareFd.valid()) {
+                // Out of descriptors: shed one queued link through the
+                // reserve fd rather than spinning on a readable listener
+                LOG_WARNING("Error accepting server link: " << strerror(errno));
+                _spareFd.reset();
+                UniqueFd shed(acceptSocket(listenFd, addr));
+                shed.reset();
+                _spareFd.reset(open("/dev/null", O_RDONLY | O_CLOEXEC));
+            }
+            return;
+        }
+        if (!_poller->add(fd, Poller::READABLE)) {
+            close(fd);
+            continue;
+        }
+        LOG_INFO("Server link connection from " << formatAddress(addr));
+        _links.push_back(new PeerLink(fd, PeerLink::HANDSHAKE, -1, _server->now() + LINK_HANDSHAKE_MS));
+    }
+}
+
+void LinkManager::connectPeer(size_t index) {
+    Peer& peer = _peers[index];
+    peer.retryAt = _server->now() + LINK_RETRY_MS;
+
+    UniqueFd fd(socket(peer.sockaddr.ss_family, SOCK_STREAM, 0));
+    if (!fd.valid() || !setNonBlocking(fd.get())) {
+        LOG_ERROR("Error creating server link socket: " << strerror(errno));
+        return;
+    }
+    if (connect(fd.get(), reinterpret_cast<struct sockaddr*>(&peer.sockaddr), peer.sockaddrLength) == -1
+        && errno != EINPROGRESS) {
+        LOG_WARNING("Error connecting to server link " << peer.address << ": " << strerror(errno));
+        return;
+    }
+    // Writability reports the outcome of the connect
+    if (!_poller->add(fd.get(), Poller::READABLE | Poller::WRITABLE)) {
+        return;
+    }
+    PeerLink* link = new PeerLink(fd.release(), PeerLink::CONNECTING, static_cast<int>(index),
+                                  _server->now() + LINK_HANDSHAKE_MS);
+    link->writeArmed = true;
+    _links.push_back(link);
+    peer.link = link;
+}
+
+void LinkManager::finishConnect(PeerLink* link) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(link->socket.get(), SOL_SOCKET, SO_ERROR, &error, &length) == -1) {
+        error = errno;
+    }
+    if (error != 0) {
+        LOG_WARNING("Error connecting to server link " << _peers[link->peer].address << ": " << strerror(error));
+        closeLink(link, "");
+        return;
+    }
+    const ServerConfig& config = _server->getConfig();
+    link->state = PeerLink::HANDSHAKE;
+    sendLine(link, "SERVER " + config.serverName + " " + config.linkPassword);
+    writeLink(link);
+}
+
+void LinkManager::readLink(PeerLink* link) {
+    while (!link->dead) {
+        ssize_t bytesRead = recv(link->socket.get(), link->input.writePtr(), link->input.writable(), 0);
+        if (bytesRead <= 0) {
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            closeLink(link, bytesRead == 0 ? "Connection closed" : strerror(errno));
+            return;
+        }
+        link->input.commit(bytesRead);
+
+        char* line;
+        size_t length;
+        while (!link->dead && link->input.nextLine(line, length)) {
+            if (length > 0) {
+                handleLine(link, line, length);
+            }
+        }
+        if (link->input.full()) {
+            closeLink(link, "Line too long");
+        }
+    }
+}
+
+void LinkManager::writeLink(PeerLink* link) {
+    switch (link->output.flush(link->socket.get())) {
+    case OutputQueue::FLUSH_DONE:
+        if (link->writeArmed) {
+            link->writeArmed = false;
+            _poller->modify(link->socket.get(), Poller::READABLE);
+        }
+        break;
+    case OutputQueue::FLUSH_PENDING:
+        if (!link->writeArmed) {
+            link->writeArmed = true;
+            _poller->modify(link->socket.get(), Poller::READABLE | Poller::WRITABLE);
+        }
+        break;
+    case OutputQueue::FLUSH_ERROR:
+        closeLink(link, strerror(errno));
+        break;
+    }
+}
+
+void LinkManager::closeLink(PeerLink* link, const std::string& reason) {
+    if (link->dead) {
+        return;
+    }
+    // Removing the users behind it touches channels and other links, so it
+    // waits for reap(); nothing is relayed over the link from here on
+    link->dead = true;
+    _reapPending = true;
+    if (!reason.empty()) {
+        LOG_WARNING("Server link " << (link->name.empty() ? std::string("(unregistered)") : link->name)
+                    << " closed: " << reason);
+        if (link->state != PeerLink::CONNECTING) {
+            link->output.push(Payload::frame("ERROR :" + reason));
+            link->output.flush(link->socket.get());
+        }
+    }
+}
+
+void LinkManager::destroyLink(PeerLink* link) {
+    // Netsplit: the users behind the link quit for everyone else
+    std::string reason = _server->getConfig().serverName + " " + (link->name.empty() ? "*" : link->name);
+    std::vector<Client*> users = link->users.items();
+    for (size_t i = 0; i < users.size(); i++) {
+        Payload quit = (LineBuilder() << ":" << users[i]->getPrefix() << " QUIT :" << reason).frame();
+        removeRemoteUser(link, users[i], quit);
+        relay(quit, link);
+    }
+
+    if (link->peer >= 0) {
+        _peers[link->peer].link = NULL;
+        _peers[link->peer].retryAt = _server->now() + LINK_RETRY_MS;
+    }
+    for (size_t i = 0; i < _dirty.size(); i++) {
+        if (_dirty[i] == link) {
+            _dirty[i] = _dirty.back();
+            _dirty.pop_back();
+            break;
+        }
+    }
+    for (size_t i = 0; i < _links.size(); i++) {
+        if (_links[i] == link) {
+            _links[i] = _links.back();
+            _links.pop_back();
+            break;
+        }
+    }
+    _poller->remove(link->socket.get());
+    delete link;
+}
+
+void LinkManager::tick() {
+    TimeMs now = _server->now();
+    for (size_t i = 0; i < _links.size(); i++) {
+        if (_links[i]->state != PeerLink::ACTIVE && now >= _links[i]->deadline) {
+            closeLink(_links[i], "Handshake timeout");
+        }
+    }
+    for (size_t i = 0; i < _peers.size(); i++) {
+        if (!_peers[i].link && now >= _peers[i].retryAt) {
+            connectPeer(i);
+        }
+    }
+}
+
+int LinkManager::timeoutMs(int timeout) const {
+    if (_reapPending) {
+        return 0;
+    }
+    TimeMs now = _server->now();
+    TimeMs next = 0;
+    for (size_t i = 0; i < _links.size(); i++) {
+        if (_links[i]->state != PeerLink::ACTIVE && (!next || _links[i]->deadline < next)) {
+            next = _links[i]->deadline;
+        }
+    }
+    for (size_t i = 0; i < _peers.size(); i++) {
+        if (!_peers[i].link && (!next || _peers[i].retryAt < next)) {
+            next = _peers[i].retryAt;
+        }
+    }
+    if (!next) {
+        return timeout;
+    }
+    int wait = next > now ? static_cast<int>(next - now) : 0;
+    return timeout < 0 || wait < timeout ? wait : timeout;
+}
+
+void LinkManager::reap() {
+    if (!_reapPending) {
+        return;
+    }
+    _reapPending = false;
+    for (size_t i = 0; i < _links.size();) {
+        if (_links[i]->dead) {
+            destroyLink(_links[i]); // Swaps the last link into slot i
+        } else {
+            i++;
+        }
+    }
+}
+
+void LinkManager::closeAll(const std::string& reason) {
+    for (size_t i = 0; i < _links.size(); i++) {
+        closeLink(_links[i], reason);
+    }
+    reap();
+}
+
+void LinkManager::flush() {
+    // One vectored write per link per iteration, however many lines
+    for (size_t i = 0; i < _dirty.size(); i++) {
+        _dirty[i]->flushScheduled = false;
+        if (!_dirty[i]->dead && !_dirty[i]->writeArmed) {
+            writeLink(_dirty[i]);
+        }
+    }
+    _dirty.clear();
+}
+
+// ---- Output --------------------------------------------------------------
+
+void LinkManager::send(PeerLink* link, const Payload& payload) {
+    if (link->dead) {
+        return;
+    }
+    if (link->output.bytes() + payload.size() > LINK_SENDQ_LIMIT) {
+        link->output.clear();
+        closeLink(link, "SendQ exceeded");
+        return;
+    }
+    link->output.push(payload);
+    if (!link->flushScheduled) {
+        link->flushScheduled = true;
+        _dirty.push_back(link);
+    }
+}
+
+void LinkManager::sendLine(PeerLink* link, const std::string& line) {
+    send(link, Payload::frame(line));
+}
+
+void LinkManager::relay(const Payload& payload, PeerLink* except) {
+    for (size_t i = 0; i < _links.size(); i++) {
+        if (_links[i] != except && _links[i]->state == PeerLink::ACTIVE) {
+            send(_links[i], payload);
+        }
+    }
+}
+
+void LinkManager::sendBurst(PeerLink* link) {
+    // Everything known that is not already on the other side
+    std::vector<Client*> users;
+    _server->listUsers(users);
+    for (size_t i = 0; i < users.size(); i++) {
+        Client* user = users[i];
+        if (user->isAuthenticated() && user->getLink() != link) {
+            const std::string& host = user->getHostname();
+            sendLine(link, "UNICK " + user->getNickname() + " " + user->getUsername() + " "
+                           + (host.empty() ? std::string("host") : host));
+        }
+    }
+
+    std::vector<Channel*> channels;
+    _server->listChannels(channels);
+    for (size_t i = 0; i < channels.size(); i++) {
+        Channel* channel = channels[i];
+        const std::vector<Client*>& members = channel->getClients();
+        std::string head = "SJOIN " + channel->getName() + " :";
+        std::string names;
+        for (size_t j = 0; j < members.size(); j++) {
+            if (members[j]->getLink() == link) {
+                continue;
+            }
+            if (names.size() > SJOIN_BUDGET) {
+                sendLine(link, head + names);
+                names.clear();
+            }
+            if (!names.empty()) {
+                names += ' ';
+            }
+            if (channel->isOperator(members[j])) {
+                names += '@';
+            }
+            names += members[j]->getNickname();
+        }
+        if (!names.empty()) {
+            sendLine(link, head + names);
+        }
+        if (!channel->getTopic().empty()) {
+            sendLine(link, "STOPIC " + channel->getName() + " :" + channel->getTopic());
+        }
+    }
+}
+
+// ---- Input ---------------------------------------------------------------
+
+void LinkManager::handleLine(PeerLink* link, char* line, size_t length) {
+    IrcMessage message;
+    if (!parseMessage(line, length, message)) {
+        return;
+    }
+    LOG_DEBUG("Link " << link->name << ": " << std::string(line, length));
+
+    if (message.command == "ERROR") {
+        closeLink(link, "Closed by peer: " + message.param(0));
+        return;
+    }
+    if (link->state != PeerLink::ACTIVE) {
+        handleServer(link, message);
+        return;
+    }
+
+    // The line as received is what gets delivered and forwarded
+    Payload payload = Payload::frame(std::string(line, length));
+    if (message.commandId != CMD_UNKNOWN) {
+        handleUserLine(link, message, payload);
+    } else if (message.command == "UNICK") {
+        handleUserIntro(link, message, payload);
+    } else if (message.command == "SJOIN") {
+        handleChannelBurst(link, message, payload);
+    } else if (message.command == "STOPIC") {
+        Channel* channel = _server->getChannel(message.param(0));
+        if (channel && message.paramCount >= 2 && channel->getTopic().empty()) {
+            channel->setTopic(message.param(1));
+            relay(payload, link);
+        }
+    } else if (message.command == "KILL") {
+        handleKill(link, message, payload);
+    }
+}
+
+void LinkManager::handleServer(PeerLink* link, const IrcMessage& message) {
+    const ServerConfig& config = _server->getConfig();
+    if (message.command != "SERVER" || message.paramCount < 2) {
+        closeLink(link, "Not registered");
+        return;
+    }
+    if (message.param(1) != config.linkPassword) {
+        closeLink(link, "Bad link password");
+        return;
+    }
+    std::string name = message.param(0);
+    bool duplicate = name == config.serverName;
+    for (size_t i = 0; i < _links.size() && !duplicate; i++) {
+        duplicate = _links[i] != link && !_links[i]->dead && _links[i]->name == name;
+    }
+    if (duplicate) {
+        closeLink(link, "Server " + name + " already linked");
+        return;
+    }
+
+    link->name = name;
+    if (link->peer < 0) {
+        sendLine(link, "SERVER " + config.serverName + " " + config.linkPassword);
+    }
+    link->state = PeerLink::ACTIVE;
+    LOG_INFO("Server link to " << name << " established");
+    sendBurst(link);
+}
+
+void LinkManager::handleUserIntro(PeerLink* link, const IrcMessage& message, const Payload& payload) {
+    if (message.paramCount < 3 || message.params[0].empty()) {
+        return;
+    }
+    std::string nick = message.param(0);
+    if (!isValidNickname(nick)) {
+        // Local clients could not address it, and lists would split it
+        LOG_WARNING("Invalid nickname " << nick << " from server " << link->name);
+        sendLine(link, "KILL " + nick + " :Erroneous nickname");
+        return;
+    }
+    if (_server->findClient(nick)) {
+        // Both sides see the collision and kill the other's user
+        LOG_WARNING("Nick collision on " << nick << " with server " << link->name);
+        sendLine(link, "KILL " + nick + " :Nick collision");
+        return;
+    }
+
+    Client* user = new Client(-1, _server, _server->allocateClientId());
+    user->setLink(link);
+    user->setUsername(message.param(1));
+    user->setHostname(message.param(2));
+    user->setAuthenticated(true);
+    if (!user->changeNickname(nick)) {
+        delete user;
+        sendLine(link, "KILL " + nick + " :Nick collision");
+        return;
+    }
+    link->users.insert(user);
+    relay(payload, link);
+}
+
+void LinkManager::handleChannelBurst(PeerLink* link, const IrcMessage& message, const Payload& payload) {
+    if (message.paramCount < 2 || message.params[0].empty() || message.params[0][0] != '#') {
+        return;
+    }
+    std::string name = message.param(0);
+    const StringView& names = message.params[1];
+    size_t start = 0;
+    while (start < names.length) {
+        size_t end = start;
+        while (end < names.length && names[end] != ' ') {
+            end++;
+        }
+        bool op = names[start] == '@';
+        std::string nick(names.data + start + (op ? 1 : 0), end - start - (op ? 1 : 0));
+        start = end + 1;
+
+        Client* user = _server->findClient(nick);
+        if (!user || user->getLink() != link) {
+            continue; // Lost a collision, or not from that side
+        }
+        Channel* channel = joinRemote(link, user, name, op);
+        if (channel) {
+            channel->broadcastPayload((LineBuilder() << ":" << user->getPrefix() << " JOIN " << name).frame(), NULL);
+        }
+    }
+    relay(payload, link);
+}
+
+void LinkManager::handleKill(PeerLink* link, const IrcMessage& message, const Payload& payload) {
+    Client* user = _server->findClient(message.param(0));
+    if (!user) {
+        return;
+    }
+    if (!user->getLink()) {
+        // Ours: the disconnect is propagated as a regular QUIT
+        user->sendData("ERROR :Killed (" + message.param(1) + ")");
+        user->setDisconnected();
+    } else if (user->getLink() != link) {
+        send(user->getLink(), payload);
+    }
+}
+
+Client* LinkManager::sourceUser(PeerLink* link, const IrcMessage& message) const {
+    Client* user = _server->findClient(sourceNick(message.prefix));
+    // Lines about users elsewhere are stale (a collision already resolved)
+    return user && user->getLink() == link ? user : NULL;
+}
+
+void LinkManager::handleUserLine(PeerLink* link, const IrcMessage& message, const Payload& payload) {
+    Client* user = sourceUser(link, message);
+    if (!user) {
+        return;
+    }
+
+    switch (message.commandId) {
+    case CMD_NICK: {
+        if (message.paramCount < 1) {
+            return;
+        }
+        std::string nick = message.param(0);
+        bool valid = isValidNickname(nick);
+        if (!valid || !user->changeNickname(nick)) {
+            // The other side already goes by the new nick: settle it there,
+            // as in a burst, and drop the user here under the old one
+            const char* reason = valid ? "Nick collision" : "Erroneous nickname";
+            LOG_WARNING(reason << " on " << nick << " with server " << link->name);
+            sendLine(link, "KILL " + nick + " :" + reason);
+            Payload quit = (LineBuilder() << ":" << user->getPrefix() << " QUIT :" << reason).frame();
+            removeRemoteUser(link, user, quit);
+            relay(quit, link);
+            return;
+        }
+        user->notifyPeers(payload);
+        relay(payload, link);
+        return;
+    }
+    case CMD_JOIN: {
+        if (message.paramCount < 1 || message.params[0].empty() || message.params[0][0] != '#') {
+            return;
+        }
+        std::string name = message.param(0);
+        Channel* channel = joinRemote(link, user, name, !_server->getChannel(name));
+        if (channel) {
+            channel->broadcastPayload(payload, NULL);
+            relay(payload, link);
+        }
+        return;
+    }
+    case CMD_PART: {
+        Channel* channel = _server->getChannel(message.param(0));
+        if (channel && user->isInChannel(channel)) {
+            channel->broadcastPayload(payload, NULL);
+            partRemote(link, user, channel);
+            relay(payload, link);
+        }
+        return;
+    }
+    case CMD_QUIT:
+        removeRemoteUser(link, user, payload);
+        relay(payload, link);
+        return;
+    case CMD_TOPIC: {
+        Channel* channel = _server->getChannel(message.param(0));
+        if (channel && message.paramCount >= 2 && user->isInChannel(channel)) {
+            channel->setTopic(message.param(1));
+            channel->broadcastPayload(payload, NULL);
+            relay(payload, link);
+        }
+        return;
+    }
+    case CMD_PRIVMSG:
+    case CMD_NOTICE:
+        deliverRemoteMessage(link, message, payload);
+        return;
+    default:
+        return;
+    }
+}
+
+bool LinkManager::leadsTo(PeerLink* link, const std::vector<Channel*>& channels,
+                          const std::vector<Client*>& users) const {
+    if (link->state != PeerLink::ACTIVE) {
+        return false;
+    }
+    for (size_t i = 0; i < channels.size(); i++) {
+        if (link->members.contains(channels[i])) {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < users.size(); i++) {
+        if (users[i]->getLink() == link) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LinkManager::deliverRemoteMessage(PeerLink* link, const IrcMessage& message, const Payload& payload) {
+    if (message.paramCount < 2 || message.params[0].empty()) {
+        return;
+    }
+
+    // Same de-duplicated fan-out as Client::deliverMessage. A single
+    // target is delivered as received; a list is rebuilt per target.
+    std::vector<StringView> targets;
+    splitList(message.params[0], targets);
+    bool single = targets.size() == 1;
+    std::string head = single ? std::string() : ":" + message.prefix.str() + " " + message.command.str() + " ";
+    std::string tail = single ? std::string() : " :" + message.param(1);
+    unsigned long mark = _server->nextDeliveryMark();
+    std::vector<Channel*> channels;
+    std::vector<Client*> users;
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        std::string target = targets[i].str();
+        if (target[0] == '#') {
+            Channel* channel = _server->getChannel(target);
+            if (channel) {
+                Payload line = single ? payload : Payload::frame(head + target + tail);
+                channel->broadcastMarked(line, mark, OutputQueue::PRIORITY_LOW);
+                _server->recordHistory(channel, line);
+                channels.push_back(channel);
+            }
+            continue;
+        }
+        Client* recipient = _server->findClient(target);
+        if (!recipient || !recipient->markDelivered(mark)) {
+            continue;
+        }
+        if (!recipient->getLink()) {
+            recipient->sendPayload(single ? payload : Payload::frame(head + target + tail));
+        } else {
+            users.push_back(recipient);
+        }
+    }
+
+    // Onwards, once per link, to the links leading to the other recipients
+    for (size_t i = 0; i < _links.size(); i++) {
+        if (_links[i] != link && leadsTo(_links[i], channels, users)) {
+            send(_links[i], payload);
+        }
+    }
+}
+
+// ---- Remote state --------------------------------------------------------
+
+Channel* LinkManager::joinRemote(PeerLink* link, Client* user, const std::string& name, bool op) {
+    Channel* channel = _server->getChannel(name);
+    bool created = !channel;
+    if (created) {
+        channel = _server->createChannel(name, user);
+    } else if (user->isInChannel(channel)) {
+        return NULL;
+    }
+    user->joinChannel(channel);
+    if (op) {
+        channel->addOperator(user);
+    } else if (created) {
+        channel->removeOperator(user);
+    }
+
+    size_t* count = link->members.find(channel);
+    if (count) {
+        ++*count;
+    } else {
+        link->members.insert(channel, 1);
+    }
+    return channel;
+}
+
+void LinkManager::partRemote(PeerLink* link, Client* user, Channel* channel) {
+    user->leaveChannel(channel);
+    size_t* count = link->members.find(channel);
+    if (count && --*count == 0) {
+        link->members.erase(channel);
+    }
+    if (channel->getClients().empty()) {
+        _server->removeChannel(channel->getName());
+    }
+}
+
+void LinkManager::removeRemoteUser(PeerLink* link, Client* user, const Payload& quit) {
+    const std::vector<Channel*>& channels = user->getChannels();
+    for (size_t i = 0; i < channels.size(); i++) {
+        size_t* count = link->members.find(channels[i]);
+        if (count && --*count == 0) {
+            link->members.erase(channels[i]);
+        }
+    }
+    _server->detachClient(user, quit);
+    link->users.erase(user);
+    delete user;
+}
+
+// ---- Local events --------------------------------------------------------
+
+void LinkManager::introduce(Client* user) {
+    const std::string& host = user->getHostname();
+    propagate("UNICK " + user->getNickname() + " " + user->getUsername() + " "
+              + (host.empty() ? std::string("host") : host));
+}
+
+void LinkManager::propagate(const Payload& line) {
+    relay(line, NULL);
+}
+
+void LinkManager::routeMessage(const std::vector<Channel*>& channels, const std::vector<Client*>& users,
+                               const std::string& line) {
+    // Framed only if some link leads to a recipient
+    Payload payload;
+    for (size_t i = 0; i < _links.size(); i++) {
+        if (leadsTo(_links[i], channels, users)) {
+            if (payload.empty()) {
+                payload = Payload::frame(line);
+            }
+            send(_links[i], payload);
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef LINKMANAGER_HPP
+#define LINKMANAGER_HPP
+
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include "peerlink.hpp"
+#include "../eventloop/poller.hpp"
+#include "../buffers/payload.hpp"
+
+class Server;
+struct IrcMessage;
+
+// Server-to-server links. Nodes form a spanning tree (the topology is not
+// checked for cycles, only for duplicate names on direct links, so each
+// link is configured in IRCSERV_LINK_PEERS on one side only); every
+// node knows every user and channel membership, and each link knows which
+// of them lie behind it.
+//
+// Wire protocol, after both sides sent "SERVER <name> <password>":
+//   UNICK <nick> <user> <host>         introduce a user
+//   SJOIN <channel> :<[@]nick> ...     burst channel membership
+//   STOPIC <channel> :<topic>          burst a channel topic
+//   KILL <nick> :<reason>              nick collision, the owner drops it
+// Changes are relayed as the line clients see, sourced by the user
+// (":nick!user@host JOIN #chan", NICK, PART, QUIT, TOPIC, PRIVMSG,
+// NOTICE), so a relayed line is delivered locally and forwarded further
+// without being rebuilt. State changes reach every link; channel messages
+// only the links with members in the channel. A PRIVMSG/NOTICE to a
+// target list crosses each link once, with the targets that lie behind it
+// among the others.
+//
+// Remote users are Clients without a socket bound to their PeerLink;
+// sendPayload() ignores them, their own server renders what they see.
+class LinkManager {
+private:
+    struct Peer {
+        std::string             address;        // "ip:port" or "[ipv6]:port", for logging
+        struct sockaddr_storage sockaddr;
+        socklen_t               sockaddrLength;
+        PeerLink*               link;           // Current connection (NULL = none)
+        TimeMs                  retryAt;        // Next connect attempt while unlinked
+    };
+
+    Server*                 _server;
+    Poller*                 _poller;    // Not owned
+    UniqueFd                _listeners[2]; // IRCSERV_LINK_PORT over IPv4 and IPv6
+    UniqueFd                _spareFd;   // Reserve descriptor for shedding links at EMFILE
+    std::vector<Peer>       _peers;     // Configured outbound links
+    std::vector<PeerLink*>  _links;     // Few: searched linearly
+    std::vector<PeerLink*>  _dirty;     // Links with corked output
+    bool                    _reapPending; // Some link is dead
+
+    bool parsePeers(const std::string& spec);
+    PeerLink* findLink(int fd);
+    void acceptLinks(int listenFd);
+    void connectPeer(size_t index);
+    void finishConnect(PeerLink* link);
+    void readLink(PeerLink* link);
+    void writeLink(PeerLink* link);
+    void closeLink(PeerLink* link, const std::string& reason);
+    void destroyLink(PeerLink* link);
+
+    void send(PeerLink* link, const Payload& payload);
+    void sendLine(PeerLink* link, const std::string& line);
+    void relay(const Payload& payload, PeerLink* except);
+    void sendBurst(PeerLink* link);
+    bool leadsTo(PeerLink* link, const std::vector<Channel*>& channels, const std::vector<Client*>& users) const;
+
+    void handleLine(PeerLink* link, char* line, size_t length);
+    void handleServer(PeerLink* link, const IrcMessage& message);
+    void handleUserIntro(PeerLink* link, const IrcMessage& message, const Payload& payload);
+    void handleChannelBurst(PeerLink* link, const IrcMessage& message, const Payload& payload);
+    void handleKill(PeerLink* link, const IrcMessage& message, const Payload& payload);
+    void handleUserLine(PeerLink* link, const IrcMessage& message, const Payload& payload);
+    void deliverRemoteMessage(PeerLink* link, const IrcMessage& message, const Payload& payload);
+
+    Client* sourceUser(PeerLink* link, const IrcMessage& message) const;
+    Channel* joinRemote(PeerLink* link, Client* user, const std::string& name, bool op);
+    void partRemote(PeerLink* link, Client* user, Channel* channel);
+    void removeRemoteUser(PeerLink* link, Client* user, const Payload& quit);
+
+    // Prevent copying
+    LinkManager(const LinkManager& other);
+    LinkManager& operator=(const LinkManager& other);
+
+public:
+    LinkManager(Server* server, Poller* poller);
+    ~LinkManager();
+
+    // Start the link listener and the configured outbound connections
+    bool setup();
+
+    // Readiness for a link socket; false when `fd` is not one
+    bool handleEvent(int fd, unsigned int events);
+
+    // Reconnects and handshake deadlines; shortens `timeout` to the next one
+    void tick();
+    int timeoutMs(int timeout) const;
+
+    // End of loop iteration: tear down dead links, then write corked output
+    void reap();
+    void flush();
+
+    // Drop every link at once, as if each had failed: the peers get
+    // `reason` as ERROR and local users see the remote ones quit
+    void closeAll(const std::string& reason);
+
+    // Local events to propagate
+    void introduce(Client* user);
+    void propagate(const Payload& line);
+    void propagate(const std::string& line) { propagate(Payload::frame(line)); }
+    // PRIVMSG/NOTICE to a target list, one line per link leading to any
+    // of the channels' members or the users
+    void routeMessage(const std::vector<Channel*>& channels, const std::vector<Client*>& users,
+                      const std::string& line);
+};
+
+#endif // LINKMANAGER_HPP
@@ -0,0 +1,50 @@
+#ifndef PEERLINK_HPP
+#define PEERLINK_HPP
+
+#include <string>
+#include <cstddef>
+#include "../buffers/inputbuffer.hpp"
+#include "../buffers/outputqueue.hpp"
+#include "../utils/denseset.hpp"
+#include "../utils/flatmap.hpp"
+#include "../utils/uniquefd.hpp"
+#include "../timers/timerwheel.hpp"
+
+class Client;
+class Channel;
+
+// Server lines are longer and burstier than client lines (SJOIN, relayed
+// chatter for a whole subtree)
+const size_t LINK_INPUT_BUFFER_SIZE = 65536;
+
+// One connection to a neighbouring server, accepted or initiated. Besides
+// the socket it records what the rest of the network looks like through
+// it: the remote users it leads to and, per channel, how many of them are
+// members, so channel chatter is only forwarded where someone listens.
+// Output is corked and written once per loop iteration by LinkManager.
+struct PeerLink {
+    enum State {
+        CONNECTING,     // Outbound connect() in progress
+        HANDSHAKE,      // Waiting for the peer's SERVER line
+        ACTIVE          // Authenticated, burst sent
+    };
+
+    UniqueFd                    socket;
+    State                       state;
+    int                         peer;           // Index of the configured peer (-1 = accepted)
+    std::string                 name;           // Peer server name, once introduced
+    TimeMs                      deadline;       // Handshake must be over by then
+    bool                        dead;           // Torn down at the end of the iteration
+    bool                        flushScheduled; // In LinkManager's end-of-iteration list
+    bool                        writeArmed;     // Write interest registered with the poller
+    InputBuffer                 input;
+    OutputQueue                 output;
+    DenseSet<Client*>           users;          // Remote users reached through this link
+    FlatMap<Channel*, size_t>   members;        // Channel -> members reached through this link
+
+    PeerLink(int fd, State initial, int peerIndex, TimeMs handshakeDeadline)
+        : socket(fd), state(initial), peer(peerIndex), deadline(handshakeDeadline), dead(false),
+          flushScheduled(false), writeArmed(false), input(LINK_INPUT_BUFFER_SIZE) {}
+};
+
+#endif // PEERLINK_HPP
@@ -0,0 +1,202 @@
+#include "logger.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+// Writer back-off when the ring is empty; bounds how long a line can wait
+const useconds_t IDLE_SLEEP_US = 5000;
+
+const char* levelName(LogLevel level) {
+    switch (level) {
+    case LOG_LEVEL_DEBUG:   return "DEBUG";
+    case LOG_LEVEL_INFO:    return "INFO";
+    case LOG_LEVEL_WARNING: return "WARN";
+    case LOG_LEVEL_ERROR:   return "ERROR";
+    }
+    return "?";
+}
+
+void writeAll(int fd, const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t written = write(fd, data.data() + offset, data.size() - offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // Nowhere left to report it
+        }
+        offset += written;
+    }
+}
+
+} // namespace
+
+Logger::Logger()
+    : _enqueuePos(0), _dequeuePos(0), _level(LOG_LEVEL_INFO),
+      _dropped(0), _running(false), _started(false) {
+    for (size_t i = 0; i < RING_SIZE; i++) {
+        _ring[i].sequence = i;
+    }
+}
+
+Logger::~Logger() {
+    stop();
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+bool Logger::start() {
+    if (_started) {
+        return true;
+    }
+    __atomic_store_n(&_running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&_thread, NULL, &Logger::threadMain, this) != 0) {
+        _running = false;
+        return false;
+    }
+    _started = true;
+    return true;
+}
+
+void Logger::stop() {
+    if (_started) {
+        __atomic_store_n(&_running, false, __ATOMIC_RELEASE);
+        pthread_join(_thread, NULL);
+        _started = false;
+    }
+    // Whatever was logged after the writer exited, or without one
+    while (drain()) {
+    }
+}
+
+void* Logger::threadMain(void* arg) {
+    Logger* logger = static_cast<Logger*>(arg);
+    while (__atomic_load_n(&logger->_running, __ATOMIC_ACQUIRE)) {
+        if (!logger->drain()) {
+            usleep(IDLE_SLEEP_US);
+        }
+    }
+    return NULL;
+}
+
+bool Logger::submit(LogLevel level, const char* text, size_t length) {
+    // Bounded MPMC ring (Vyukov): claim a slot by advancing _enqueuePos
+    size_t pos = __atomic_load_n(&_enqueuePos, __ATOMIC_RELAXED);
+    Slot* slot;
+    while (true) {
+        slot = &_ring[pos & (RING_SIZE - 1)];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = static_cast<long>(sequence) - static_cast<long>(pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&_enqueuePos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_add_fetch(&_dropped, 1, __ATOMIC_RELAXED); // Full
+            return false;
+        } else {
+            pos = __atomic_load_n(&_enqueuePos, __ATOMIC_RELAXED);
+        }
+    }
+    slot->level = level;
+    slot->when = time(NULL);
+    slot->length = length < LOG_LINE_MAX ? length : LOG_LINE_MAX;
+    memcpy(slot->text, text, slot->length);
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool Logger::drain() {
+    bool any = false;
+    while (true) {
+        Slot& slot = _ring[_dequeuePos & (RING_SIZE - 1)];
+        if (__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) != _dequeuePos + 1) {
+            break;
+        }
+        format(slot);
+        __atomic_store_n(&slot.sequence, _dequeuePos + RING_SIZE, __ATOMIC_RELEASE);
+        ++_dequeuePos;
+        any = true;
+    }
+
+    size_t dropped = __atomic_exchange_n(&_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        char notice[64];
+        int length = snprintf(notice, sizeof(notice), "logger: %lu lines dropped\n",
+                              static_cast<unsigned long>(dropped));
+        _err.append(notice, length);
+    }
+
+    if (!_out.empty()) {
+        writeAll(STDOUT_FILENO, _out);
+        _out.clear();
+    }
+    if (!_err.empty()) {
+        writeAll(STDERR_FILENO, _err);
+        _err.clear();
+    }
+    return any;
+}
+
+void Logger::format(const Slot& slot) {
+    char stamp[32];
+    struct tm local;
+    localtime_r(&slot.when, &local);
+    size_t stampLength = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S ", &local);
+
+    std::string& target = slot.level >= LOG_LEVEL_WARNING ? _err : _out;
+    target.append(stamp, stampLength);
+    target.append(levelName(slot.level));
+    target.append(": ");
+    target.append(slot.text, slot.length);
+    target.append("\n");
+}
+
+bool Logger::parseLevel(const std::string& name, LogLevel& level) {
+    if (name == "debug") {
+        level = LOG_LEVEL_DEBUG;
+    } else if (name == "info") {
+        level = LOG_LEVEL_INFO;
+    } else if (name == "warning" || name == "warn") {
+        level = LOG_LEVEL_WARNING;
+    } else if (name == "error") {
+        level = LOG_LEVEL_ERROR;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+LogLine& LogLine::append(const char* data, size_t length) {
+    size_t room = LOG_LINE_MAX - _length;
+    if (length > room) {
+        length = room;
+    }
+    memcpy(_text + _length, data, length);
+    _length += length;
+    return *this;
+}
+
+LogLine& LogLine::operator<<(const char* text) {
+    return append(text, strlen(text));
+}
+
+LogLine& LogLine::operator<<(long value) {
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%ld", value);
+    return append(digits, length);
+}
+
+LogLine& LogLine::operator<<(unsigned long value) {
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%lu", value);
+    return append(digits, length);
+}
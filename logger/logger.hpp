@@ -0,0 +1,123 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <string>
+#include <cstddef>
+#include <ctime>
+#include <pthread.h>
+
+// Leveled, non-blocking logger. LOG_* macros format into a fixed buffer
+// on the calling thread and push the line into a bounded lock-free ring;
+// a background thread drains it to stdout (DEBUG/INFO) and stderr
+// (WARNING/ERROR) in batched writes. When the ring is full the line is
+// dropped and counted: logging never blocks the event loop.
+//
+// LOG_DEBUG is compiled out unless IRC_LOG_DEBUG is defined, e.g.
+// `make CPPFLAGS=-DIRC_LOG_DEBUG`.
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR
+};
+
+// Longest line kept; longer ones are truncated
+const size_t LOG_LINE_MAX = 240;
+
+class Logger {
+private:
+    struct Slot {
+        size_t      sequence;   // Vyukov ring sequence number
+        LogLevel    level;
+        time_t      when;
+        size_t      length;
+        char        text[LOG_LINE_MAX];
+    };
+
+    static const size_t RING_SIZE = 4096;   // Power of two
+
+    Slot        _ring[RING_SIZE];   // Static storage: threads may log during exit
+    size_t      _enqueuePos;    // Producers
+    size_t      _dequeuePos;    // Writer only
+    int         _level;         // Minimum level recorded at runtime
+    size_t      _dropped;       // Lines lost to a full ring
+    bool        _running;
+    bool        _started;
+    pthread_t   _thread;
+    std::string _out;           // Writer batches, one write() per pass
+    std::string _err;
+
+    Logger();
+    ~Logger();
+
+    static void* threadMain(void* arg);
+    bool drain();
+    void format(const Slot& slot);
+
+    // Prevent copying
+    Logger(const Logger& other);
+    Logger& operator=(const Logger& other);
+
+public:
+    static Logger& instance();
+
+    // Start the writer thread; lines logged before start() are kept
+    bool start();
+    // Write out everything still queued and join the writer thread
+    void stop();
+
+    void setLevel(LogLevel level) { __atomic_store_n(&_level, level, __ATOMIC_RELAXED); }
+    bool enabled(LogLevel level) const { return level >= __atomic_load_n(&_level, __ATOMIC_RELAXED); }
+
+    // Thread-safe, never blocks; returns false when the line was dropped
+    bool submit(LogLevel level, const char* text, size_t length);
+
+    // "debug", "info", "warning" or "error"; false if unrecognised
+    static bool parseLevel(const std::string& name, LogLevel& level);
+};
+
+// One line being formatted; submitted to the Logger when destroyed
+class LogLine {
+private:
+    LogLevel    _level;
+    size_t      _length;
+    char        _text[LOG_LINE_MAX];
+
+    // Prevent copying
+    LogLine(const LogLine& other);
+    LogLine& operator=(const LogLine& other);
+
+public:
+    explicit LogLine(LogLevel level) : _level(level), _length(0) {}
+    ~LogLine() { Logger::instance().submit(_level, _text, _length); }
+
+    LogLine& append(const char* data, size_t length);
+
+    LogLine& operator<<(const char* text);
+    LogLine& operator<<(const std::string& text) { return append(text.data(), text.size()); }
+    LogLine& operator<<(char c) { return append(&c, 1); }
+    LogLine& operator<<(int value) { return *this << static_cast<long>(value); }
+    LogLine& operator<<(unsigned int value) { return *this << static_cast<unsigned long>(value); }
+    LogLine& operator<<(long value);
+    LogLine& operator<<(unsigned long value);
+};
+
+#define IRC_LOG(level, expr) \
+    do { \
+        if (Logger::instance().enabled(level)) { \
+            LogLine ircLogLine(level); \
+            ircLogLine << expr; \
+        } \
+    } while (0)
+
+#ifdef IRC_LOG_DEBUG
+# define LOG_DEBUG(expr)    IRC_LOG(LOG_LEVEL_DEBUG, expr)
+#else
+# define LOG_DEBUG(expr)    do { } while (0)
+#endif
+#define LOG_INFO(expr)      IRC_LOG(LOG_LEVEL_INFO, expr)
+#define LOG_WARNING(expr)   IRC_LOG(LOG_LEVEL_WARNING, expr)
+#define LOG_ERROR(expr)     IRC_LOG(LOG_LEVEL_ERROR, expr)
+
+#endif // LOGGER_HPP
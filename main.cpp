@@ -2,15 +2,19 @@
 #include <iostream>
 #include <cstdlib>
 #include <signal.h>
+#include <unistd.h>
 
 Server* g_server = NULL; // Global pointer for signal handling
 
 void signalHandler(int signum) {
-    std::cout << "\nSignal (" << signum << ") received. Shutting down server..." << std::endl;
-    if (g_server) {
-        g_server->stop();
+    // Only async-signal-safe calls here: the event loop does the work
+    if (g_server && g_server->notifySignal(signum)) {
+        return;
+    }
+    // Not serving yet (or any more): nothing to hand over or flush
+    if (signum != SIGUSR2) {
+        _exit(128 + signum);
     }
-    exit(signum);
 }
 
 int main(int argc, char* argv[]) {
@@ -35,26 +39,43 @@ int main(int argc, char* argv[]) {
     // Get password
     std::string password = argv[2];
     
-    // Set up signal handling for clean shutdown
+    // Set up signal handling: SIGINT/SIGTERM drain and shut down, SIGUSR2
+    // hands everything over to a fresh copy of this binary
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    signal(SIGUSR2, signalHandler);
+    
+    // Logging goes through the writer thread from here on
+    Logger& logger = Logger::instance();
+    if (!logger.start()) {
+        std::cerr << "Failed to start the logger" << std::endl;
+        return 1;
+    }
     
     // Create and set up server
+    int status = 0;
     try {
-        Server server(port, password);
+        ServerConfig config;
+        config.loadFromEnvironment();
+        logger.setLevel(config.logLevel);
+        
+        Server server(port, password, config);
+        server.setCommandLine(argv);
         g_server = &server;
         
         if (!server.setup()) {
-            std::cerr << "Failed to set up server" << std::endl;
-            return 1;
+            LOG_ERROR("Failed to set up server");
+            status = 1;
+        } else {
+            LOG_INFO("Server started on port " << port);
+            server.run();
         }
-        
-        std::cout << "Server started on port " << port << std::endl;
-        server.run();
+        g_server = NULL;
     } catch (const std::exception& e) {
-        std::cerr << "Server error: " << e.what() << std::endl;
-        return 1;
+        LOG_ERROR("Server error: " << e.what());
+        status = 1;
     }
     
-    return 0;
+    logger.stop();
+    return status;
 }
\ No newline at end of file
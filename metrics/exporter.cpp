@@ -0,0 +1,279 @@
+#include "exporter.hpp"
+#include "metrics.hpp"
+#include "../buffers/payload.hpp"
+#include "../logger/logger.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace {
+
+// Concurrent scrapes; a new one evicts the oldest beyond this
+const size_t MAX_SCRAPES = 16;
+
+// Anything longer than this is not a scrape request
+const size_t MAX_REQUEST = 4096;
+
+void appendCounter(std::string& out, const char* name, const char* type, const char* help,
+                   unsigned long long value) {
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, value);
+    out += line;
+}
+
+void appendGauge(std::string& out, const char* name, const char* help, long value) {
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s gauge\n%s %ld\n", name, help, name, name, value);
+    out += line;
+}
+
+// Samples of one histogram series. Buckets are emitted up to the highest
+// non-empty one; `scale` converts recorded units into exported ones.
+void appendHistogram(std::string& out, const char* name, const std::string& labels,
+                     const Histogram& histogram, double scale) {
+    const char* separator = labels.empty() ? "" : ",";
+    size_t last = 0;
+    for (size_t i = 0; i < Histogram::BUCKETS; i++) {
+        if (histogram.bucket(i)) {
+            last = i;
+        }
+    }
+
+    char line[256];
+    unsigned long long cumulative = 0;
+    for (size_t i = 0; i <= last; i++) {
+        cumulative += histogram.bucket(i);
+        snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels.c_str(), separator,
+                 Histogram::upperBound(i) * scale, cumulative);
+        out += line;
+    }
+    snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels.c_str(), separator, cumulative);
+    out += line;
+    const char* open = labels.empty() ? "" : "{";
+    const char* close = labels.empty() ? "" : "}";
+    snprintf(line, sizeof(line), "%s_sum%s%s%s %.9g\n%s_count%s%s%s %llu\n",
+             name, open, labels.c_str(), close, histogram.sum() * scale,
+             name, open, labels.c_str(), close, cumulative);
+    out += line;
+}
+
+void appendHistogramHeader(std::string& out, const char* name, const char* help) {
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " histogram\n";
+}
+
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1 && fcntl(fd, F_SETFD, FD_CLOEXEC) != -1;
+}
+
+} // namespace
+
+MetricsExporter::MetricsExporter(Poller* poller) : _poller(poller) {
+}
+
+MetricsExporter::~MetricsExporter() {
+    while (!_scrapes.empty()) {
+        closeScrape(_scrapes.back());
+    }
+    if (_listener.valid()) {
+        _poller->remove(_listener.get());
+    }
+}
+
+bool MetricsExporter::listen(const std::string& address, unsigned int port, int backlog) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        LOG_ERROR("Invalid metrics address " << address);
+        return false;
+    }
+
+    _listener.reset(socket(AF_INET, SOCK_STREAM, 0));
+    int opt = 1;
+    if (!_listener.valid() || !setNonBlocking(_listener.get())
+        || setsockopt(_listener.get(), SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1
+        || bind(_listener.get(), reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1
+        || ::listen(_listener.get(), backlog) == -1
+        || !_poller->add(_listener.get(), Poller::READABLE)) {
+        LOG_ERROR("Error setting up metrics listener on " << address << ":" << port << ": " << strerror(errno));
+        _listener.reset();
+        return false;
+    }
+    LOG_INFO("Metrics available at http://" << address << ":" << port << "/metrics");
+    return true;
+}
+
+MetricsExporter::Scrape* MetricsExporter::findScrape(int fd) {
+    for (size_t i = 0; i < _scrapes.size(); i++) {
+        if (_scrapes[i]->socket.get() == fd) {
+            return _scrapes[i];
+        }
+    }
+    return NULL;
+}
+
+void MetricsExporter::handleEvent(int fd, unsigned int events) {
+    if (_listener.valid() && fd == _listener.get()) {
+        acceptScrapes();
+        return;
+    }
+    Scrape* scrape = findScrape(fd);
+    if (!scrape) {
+        return;
+    }
+    if (events & Poller::ERROR) {
+        closeScrape(scrape);
+        return;
+    }
+    if (scrape->responding) {
+        writeResponse(scrape);
+    } else {
+        readRequest(scrape);
+    }
+}
+
+void MetricsExporter::acceptScrapes() {
+    while (true) {
+        int fd = accept(_listener.get(), NULL, NULL);
+        if (fd == -1) {
+            return; // EAGAIN, or an error the next wakeup will report again
+        }
+        Scrape* scrape = new Scrape();
+        scrape->socket.reset(fd);
+        scrape->responding = false;
+        if (!setNonBlocking(fd) || !_poller->add(fd, Poller::READABLE)) {
+            delete scrape;
+            continue;
+        }
+        if (_scrapes.size() >= MAX_SCRAPES) {
+            closeScrape(_scrapes.front());
+        }
+        _scrapes.push_back(scrape);
+    }
+}
+
+void MetricsExporter::readRequest(Scrape* scrape) {
+    char buffer[1024];
+    ssize_t received;
+    while ((received = recv(scrape->socket.get(), buffer, sizeof(buffer), 0)) > 0) {
+        scrape->request.append(buffer, received);
+    }
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        || scrape->request.size() > MAX_REQUEST) {
+        closeScrape(scrape);
+        return;
+    }
+    // Headers are irrelevant; wait until they are complete, then answer
+    if (scrape->request.find("\r\n\r\n") == std::string::npos
+        && scrape->request.find("\n\n") == std::string::npos) {
+        return;
+    }
+
+    std::string body;
+    const char* status = "200 OK";
+    if (scrape->request.compare(0, 13, "GET /metrics ") == 0 || scrape->request.compare(0, 6, "GET / ") == 0) {
+        render(body);
+    } else {
+        status = "404 Not Found";
+        body = "Not found\n";
+    }
+
+    char header[256];
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\n"
+             "Connection: close\r\n\r\n",
+             status, static_cast<unsigned long>(body.size()));
+    scrape->response.push(Payload(std::string(header)));
+    scrape->response.push(Payload(body));
+    scrape->responding = true;
+    writeResponse(scrape);
+}
+
+void MetricsExporter::writeResponse(Scrape* scrape) {
+    switch (scrape->response.flush(scrape->socket.get())) {
+    case OutputQueue::FLUSH_PENDING:
+        _poller->modify(scrape->socket.get(), Poller::WRITABLE);
+        break;
+    case OutputQueue::FLUSH_DONE:
+    case OutputQueue::FLUSH_ERROR:
+        closeScrape(scrape);
+        break;
+    }
+}
+
+void MetricsExporter::closeScrape(Scrape* scrape) {
+    for (size_t i = 0; i < _scrapes.size(); i++) {
+        if (_scrapes[i] == scrape) {
+            _scrapes.erase(_scrapes.begin() + i);
+            break;
+        }
+    }
+    _poller->remove(scrape->socket.get());
+    delete scrape; // Closes the socket
+}
+
+void MetricsExporter::render(std::string& out) {
+    const Metrics& m = Metrics::instance();
+
+    appendCounter(out, "ircserv_bytes_received_total", "counter", "Bytes read from client sockets.",
+                  metricRead(m.bytesReceived));
+    appendCounter(out, "ircserv_bytes_sent_total", "counter", "Bytes written to client sockets.",
+                  metricRead(m.bytesSent));
+    appendCounter(out, "ircserv_lines_parsed_total", "counter", "Complete lines received from clients.",
+                  metricRead(m.linesParsed));
+    appendCounter(out, "ircserv_lines_deferred_total", "counter",
+                  "Times client input was held back by flood control or the per-wakeup line budget.",
+                  metricRead(m.linesDeferred));
+    appendCounter(out, "ircserv_flood_evicted_clients_total", "counter",
+                  "Clients disconnected for excess flood.", metricRead(m.floodEvicted));
+    appendCounter(out, "ircserv_connections_accepted_total", "counter", "Client connections accepted.",
+                  metricRead(m.connectionsAccepted));
+    appendCounter(out, "ircserv_connections_rejected_total", "counter",
+                  "Client connections turned away by the connection throttle.",
+                  metricRead(m.connectionsRejected));
+    appendGauge(out, "ircserv_clients", "Connected clients.", metricRead(m.clients));
+    appendGauge(out, "ircserv_channels", "Existing channels.", metricRead(m.channels));
+    appendCounter(out, "ircserv_dns_lookups_total", "counter", "Reverse hostname lookups started.",
+                  metricRead(m.dnsLookups));
+    appendCounter(out, "ircserv_dns_cache_hits_total", "counter",
+                  "Client hostnames answered from the lookup cache.", metricRead(m.dnsCacheHits));
+    appendCounter(out, "ircserv_dns_unresolved_total", "counter",
+                  "Lookups that found no forward-confirmed hostname in time.", metricRead(m.dnsUnresolved));
+
+    appendCounter(out, "ircserv_poll_wakeups_total", "counter", "Main event loop wakeups.",
+                  metricRead(m.pollWakeups));
+    appendHistogramHeader(out, "ircserv_poll_ready_fds", "Ready descriptors per main loop wakeup.");
+    appendHistogram(out, "ircserv_poll_ready_fds", "", m.pollReadyFds, 1.0);
+
+    appendHistogramHeader(out, "ircserv_command_duration_seconds", "Command handling time, by command.");
+    for (int id = CMD_UNKNOWN; id < CMD_COUNT; id++) {
+        const Histogram& histogram = m.commandNanos[id];
+        if (histogram.count() == 0) {
+            continue;
+        }
+        const char* name = id == CMD_UNKNOWN ? "unknown" : commandSpec(static_cast<CommandId>(id)).name;
+        appendHistogram(out, "ircserv_command_duration_seconds", std::string("command=\"") + name + "\"",
+                        histogram, 1e-9);
+    }
+
+    appendGauge(out, "ircserv_sendq_bytes", "Bytes queued for clients.", metricRead(m.sendqBytes));
+    appendCounter(out, "ircserv_sendq_dropped_lines_total", "counter",
+                  "Low-priority lines dropped past the soft send-queue limit.", metricRead(m.sendqDropped));
+    appendCounter(out, "ircserv_sendq_evicted_clients_total", "counter",
+                  "Clients disconnected past the hard send-queue limit.", metricRead(m.sendqEvicted));
+    appendHistogramHeader(out, "ircserv_sendq_depth_bytes", "Bytes left queued when a socket buffer filled up.");
+    appendHistogram(out, "ircserv_sendq_depth_bytes", "", m.sendqDepth, 1.0);
+}
@@ -0,0 +1,52 @@
+#ifndef EXPORTER_HPP
+#define EXPORTER_HPP
+
+#include <string>
+#include <vector>
+#include "../eventloop/poller.hpp"
+#include "../buffers/outputqueue.hpp"
+#include "../utils/uniquefd.hpp"
+
+// Minimal HTTP/1.0 endpoint serving Metrics in the Prometheus text format
+// on its own port (GET /metrics). It shares the main loop's Poller: the
+// response is rendered from relaxed atomic reads, so scraping never
+// blocks or locks the IRC side. Each scrape is one request on one
+// connection, closed once the response is written.
+class MetricsExporter {
+private:
+    struct Scrape {
+        UniqueFd        socket;
+        std::string     request;    // Bytes received so far
+        OutputQueue     response;
+        bool            responding;
+    };
+
+    Poller*                 _poller;    // Not owned
+    UniqueFd                _listener;
+    std::vector<Scrape*>    _scrapes;   // Few and short-lived: searched linearly
+
+    Scrape* findScrape(int fd);
+    void acceptScrapes();
+    void readRequest(Scrape* scrape);
+    void writeResponse(Scrape* scrape);
+    void closeScrape(Scrape* scrape);
+
+    // Prevent copying
+    MetricsExporter(const MetricsExporter& other);
+    MetricsExporter& operator=(const MetricsExporter& other);
+
+public:
+    explicit MetricsExporter(Poller* poller);
+    ~MetricsExporter();
+
+    // Bind `address` (IPv4 literal) and start listening
+    bool listen(const std::string& address, unsigned int port, int backlog);
+
+    // Readiness for the listener or a scrape connection; unknown fds are ignored
+    void handleEvent(int fd, unsigned int events);
+
+    // Current metrics in the Prometheus text exposition format
+    static void render(std::string& out);
+};
+
+#endif // EXPORTER_HPP
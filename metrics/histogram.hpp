@@ -0,0 +1,56 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <cstddef>
+
+// Log-linear histogram in the style of HdrHistogram: each power of two
+// is split into SUB_BUCKETS equal buckets, so any recorded value is known
+// to within 1/SUB_BUCKETS (25%) of itself over the whole range. Values
+// at or above MAX_VALUE land in the last bucket. record() is a few
+// relaxed atomic adds on a fixed array: no locks, no allocation, safe to
+// call from any thread while another one reads.
+class Histogram {
+public:
+    enum {
+        SUB_BITS    = 2,
+        SUB_BUCKETS = 1 << SUB_BITS,
+        MAX_SHIFT   = 40,                                   // Range: [0, 2^40)
+        BUCKETS     = (MAX_SHIFT - SUB_BITS + 1) * SUB_BUCKETS
+    };
+
+private:
+    unsigned long long  _buckets[BUCKETS];
+    unsigned long long  _count;
+    unsigned long long  _sum;
+
+    static size_t bucketOf(unsigned long long value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        if (value >> MAX_SHIFT) {
+            return BUCKETS - 1;
+        }
+        size_t exponent = 63 - __builtin_clzll(value);
+        size_t mantissa = static_cast<size_t>(value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + mantissa;
+    }
+
+public:
+    Histogram();
+
+    void record(unsigned long long value) {
+        __atomic_add_fetch(&_buckets[bucketOf(value)], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&_count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&_sum, value, __ATOMIC_RELAXED);
+    }
+
+    // Readers; values may be a few records apart from each other
+    unsigned long long bucket(size_t index) const { return __atomic_load_n(&_buckets[index], __ATOMIC_RELAXED); }
+    unsigned long long count() const { return __atomic_load_n(&_count, __ATOMIC_RELAXED); }
+    unsigned long long sum() const { return __atomic_load_n(&_sum, __ATOMIC_RELAXED); }
+
+    // Largest value that falls into bucket `index`
+    static unsigned long long upperBound(size_t index);
+};
+
+#endif // HISTOGRAM_HPP
@@ -0,0 +1,27 @@
+#include "metrics.hpp"
+#include <cstring>
+
+Histogram::Histogram() : _count(0), _sum(0) {
+    memset(_buckets, 0, sizeof(_buckets));
+}
+
+unsigned long long Histogram::upperBound(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    size_t group = index / SUB_BUCKETS;
+    size_t mantissa = index % SUB_BUCKETS;
+    size_t shift = group - 1; // exponent - SUB_BITS
+    unsigned long long lower = static_cast<unsigned long long>(SUB_BUCKETS + mantissa) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+Metrics::Metrics()
+    : bytesReceived(0), bytesSent(0), linesParsed(0), linesDeferred(0), floodEvicted(0), connectionsAccepted(0), connectionsRejected(0),
+      clients(0), channels(0), dnsLookups(0), dnsCacheHits(0), dnsUnresolved(0), pollWakeups(0), sendqBytes(0), sendqDropped(0), sendqEvicted(0) {
+}
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
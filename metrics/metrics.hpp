@@ -0,0 +1,76 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <cstddef>
+#include <time.h>
+#include "histogram.hpp"
+#include "../commands/commands.hpp"
+
+// Process-wide counters, gauges and histograms. Updated with relaxed
+// atomics from the main loop and the I/O workers; readers only need
+// eventually consistent values. Exported by MetricsExporter.
+struct Metrics {
+    // Traffic
+    unsigned long   bytesReceived;  // Read from client sockets
+    unsigned long   bytesSent;      // Written to client sockets
+    unsigned long   linesParsed;    // Complete lines framed from client input
+    unsigned long   linesDeferred;  // Times a client's input was held back (flood control, line budget)
+    unsigned long   floodEvicted;   // Clients disconnected for input piling up while held back
+
+    // Connections
+    unsigned long   connectionsAccepted;
+    unsigned long   connectionsRejected;    // Turned away by the connection throttle
+    long            clients;        // Connected clients
+    long            channels;       // Existing channels
+
+    // Hostname lookups
+    unsigned long   dnsLookups;     // Reverse lookups started
+    unsigned long   dnsCacheHits;   // Connections answered from the cache
+    unsigned long   dnsUnresolved;  // Lookups without a forward-confirmed name (or timed out)
+
+    // Event loop (main loop only)
+    unsigned long   pollWakeups;    // Returns from Poller::wait()
+    Histogram       pollReadyFds;   // Ready descriptors per wakeup
+
+    // Commands, indexed by CommandId (CMD_UNKNOWN counts unregistered ones)
+    Histogram       commandNanos[CMD_COUNT];    // Handler latency; count() is the call count
+
+    // Send queues
+    long            sendqBytes;     // Bytes queued for clients, all connections
+    unsigned long   sendqDropped;   // Low-priority lines dropped past the soft limit
+    unsigned long   sendqEvicted;   // Clients disconnected past the hard limit
+    Histogram       sendqDepth;     // Bytes left queued when a flush hits a full socket
+
+    Metrics();
+
+    static Metrics& instance();
+};
+
+inline void metricAdd(long& metric, long delta) {
+    __atomic_add_fetch(&metric, delta, __ATOMIC_RELAXED);
+}
+
+inline void metricAdd(unsigned long& metric, unsigned long delta) {
+    __atomic_add_fetch(&metric, delta, __ATOMIC_RELAXED);
+}
+
+inline void metricIncrement(unsigned long& metric) {
+    __atomic_add_fetch(&metric, 1, __ATOMIC_RELAXED);
+}
+
+inline unsigned long metricRead(const unsigned long& metric) {
+    return __atomic_load_n(&metric, __ATOMIC_RELAXED);
+}
+
+inline long metricRead(const long& metric) {
+    return __atomic_load_n(&metric, __ATOMIC_RELAXED);
+}
+
+// Clock for latency histograms (vDSO on Linux, no syscall)
+inline unsigned long long monotonicNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif // METRICS_HPP
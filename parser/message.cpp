@@ -0,0 +1,113 @@
+#include "message.hpp"
+#include <cstring>
+#include <ostream>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+namespace {
+
+// First space in [p, end), or end. Scans 16 bytes per step with SSE2;
+// only whole blocks inside the line are loaded, the tail is scalar.
+const char* findSpace(const char* p, const char* end) {
+#ifdef __SSE2__
+    const __m128i spaces = _mm_set1_epi8(' ');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, spaces));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != ' ') {
+        ++p;
+    }
+    return p;
+}
+
+char* skipSpaces(char* p, const char* end) {
+    while (p < end && *p == ' ') {
+        ++p;
+    }
+    return p;
+}
+
+} // namespace
+
+bool StringView::operator==(const char* literal) const {
+    size_t literalLength = strlen(literal);
+    return literalLength == length && memcmp(data, literal, length) == 0;
+}
+
+std::ostream& operator<<(std::ostream& os, const StringView& view) {
+    return os.write(view.data, view.length);
+}
+
+bool parseMessage(char* line, size_t length, IrcMessage& message) {
+    char* p = line;
+    char* end = line + length;
+
+    message.prefix = StringView();
+    message.paramCount = 0;
+
+    // Extract prefix if present; stray leading spaces are tolerated
+    p = skipSpaces(p, end);
+    if (p < end && *p == ':') {
+        char* prefixEnd = const_cast<char*>(findSpace(p + 1, end));
+        if (prefixEnd == end) {
+            return false; // Invalid format
+        }
+        message.prefix = StringView(p + 1, prefixEnd - p - 1);
+        p = skipSpaces(prefixEnd, end);
+    }
+    if (p == end) {
+        return false;
+    }
+
+    // Extract command, upper-cased in place for case-insensitive dispatch
+    char* commandEnd = const_cast<char*>(findSpace(p, end));
+    for (char* c = p; c < commandEnd; ++c) {
+        if (*c >= 'a' && *c <= 'z') {
+            *c = static_cast<char>(*c - 'a' + 'A');
+        }
+    }
+    message.command = StringView(p, commandEnd - p);
+    message.commandId = lookupCommand(p, commandEnd - p);
+    p = commandEnd;
+
+    // Extract parameters; a ':' (or the 15th parameter) starts the trailing one
+    while (p < end) {
+        p = skipSpaces(p, end);
+        if (p == end) {
+            break;
+        }
+        if (*p == ':' || message.paramCount == MAX_PARAMS - 1) {
+            if (*p == ':') {
+                ++p;
+            }
+            message.params[message.paramCount++] = StringView(p, end - p);
+            break;
+        }
+        const char* paramEnd = findSpace(p, end);
+        message.params[message.paramCount++] = StringView(p, paramEnd - p);
+        p = const_cast<char*>(paramEnd);
+    }
+    return true;
+}
+
+void splitList(const StringView& list, std::vector<StringView>& out) {
+    out.clear();
+    const char* p = list.data;
+    const char* end = list.data + list.length;
+    while (p < end) {
+        const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+        const char* entryEnd = comma ? comma : end;
+        if (entryEnd > p) {
+            out.push_back(StringView(p, entryEnd - p));
+        }
+        p = entryEnd + 1;
+    }
+}
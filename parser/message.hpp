@@ -0,0 +1,56 @@
+#ifndef MESSAGE_HPP
+#define MESSAGE_HPP
+
+#include <string>
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+#include "../commands/commands.hpp"
+
+// Non-owning view into a line held by a client's input buffer
+struct StringView {
+    const char* data;
+    size_t      length;
+
+    StringView() : data(""), length(0) {}
+    StringView(const char* d, size_t l) : data(d), length(l) {}
+
+    bool empty() const { return length == 0; }
+    char operator[](size_t i) const { return data[i]; }
+    std::string str() const { return std::string(data, length); }
+    bool operator==(const char* literal) const;
+    bool operator!=(const char* literal) const { return !(*this == literal); }
+};
+
+std::ostream& operator<<(std::ostream& os, const StringView& view);
+
+// RFC 1459: at most 15 parameters per message
+const size_t MAX_PARAMS = 15;
+
+// One parsed IRC line. Every field points into the line that was parsed,
+// so filling it never allocates; the views are valid as long as that line.
+struct IrcMessage {
+    StringView  prefix;                 // Without the leading ':' (empty if none)
+    StringView  command;                // Upper-cased in place
+    CommandId   commandId;              // Interned command, CMD_UNKNOWN if unregistered
+    StringView  params[MAX_PARAMS];     // Trailing parameter without its ':'
+    size_t      paramCount;
+
+    IrcMessage() : commandId(CMD_UNKNOWN), paramCount(0) {}
+
+    // Owned copy of a parameter, for handlers that need to keep it
+    std::string param(size_t index) const {
+        return index < paramCount ? params[index].str() : std::string();
+    }
+};
+
+// Parse a line (without its CRLF) in place: the command is upper-cased
+// inside `line` and interned. Returns false when there is no command to
+// dispatch.
+bool parseMessage(char* line, size_t length, IrcMessage& message);
+
+// Entries of a comma-separated target list ("#a,#b,nick"), empty ones
+// skipped; the views point into `list`
+void splitList(const StringView& list, std::vector<StringView>& out);
+
+#endif // MESSAGE_HPP
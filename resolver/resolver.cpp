@@ -0,0 +1,258 @@
+#include "resolver.hpp"
+#include "../logger/logger.hpp"
+#include "../metrics/metrics.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+namespace {
+
+// Longest hostname put into a message prefix
+const size_t HOSTNAME_MAX = 63;
+
+// Unresolved addresses are retried sooner than names expire
+const TimeMs NEGATIVE_TTL_MS = 60 * 1000;
+
+// A name that cannot break a message: letters, digits, '-' and '.',
+// not starting with a separator
+bool validHostname(const char* name) {
+    size_t length = strlen(name);
+    if (length == 0 || length > HOSTNAME_MAX || name[0] == '-' || name[0] == '.') {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        char c = name[i];
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                  || c == '-' || c == '.';
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sameAddress(const struct sockaddr* a, const struct sockaddr* b) {
+    if (a->sa_family != b->sa_family) {
+        return false;
+    }
+    if (a->sa_family == AF_INET) {
+        return memcmp(&reinterpret_cast<const struct sockaddr_in*>(a)->sin_addr,
+                      &reinterpret_cast<const struct sockaddr_in*>(b)->sin_addr, sizeof(struct in_addr)) == 0;
+    }
+    return a->sa_family == AF_INET6
+           && memcmp(&reinterpret_cast<const struct sockaddr_in6*>(a)->sin6_addr,
+                     &reinterpret_cast<const struct sockaddr_in6*>(b)->sin6_addr, sizeof(struct in6_addr)) == 0;
+}
+
+// PTR lookup of a numeric address, confirmed by resolving the name back to
+// the same address; empty when either step fails. Blocks.
+std::string resolveHost(const std::string& address) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST;
+    struct addrinfo* numeric = NULL;
+    if (getaddrinfo(address.c_str(), NULL, &hints, &numeric) != 0) {
+        return "";
+    }
+
+    char name[NI_MAXHOST];
+    std::string confirmed;
+    if (getnameinfo(numeric->ai_addr, numeric->ai_addrlen, name, sizeof(name), NULL, 0, NI_NAMEREQD) == 0
+        && validHostname(name)) {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = numeric->ai_family;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* forward = NULL;
+        if (getaddrinfo(name, NULL, &hints, &forward) == 0) {
+            for (struct addrinfo* it = forward; it && confirmed.empty(); it = it->ai_next) {
+                if (sameAddress(it->ai_addr, numeric->ai_addr)) {
+                    confirmed = name;
+                }
+            }
+            freeaddrinfo(forward);
+        }
+    }
+    freeaddrinfo(numeric);
+    return confirmed;
+}
+
+} // namespace
+
+HostResolver::HostResolver(size_t cacheLimit, TimeMs ttl, TimeMs timeout)
+    : _stopping(false), _cacheLimit(cacheLimit), _ttl(ttl), _timeout(timeout) {
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_wake, NULL);
+    _notifyPipe[0] = -1;
+    _notifyPipe[1] = -1;
+}
+
+HostResolver::~HostResolver() {
+    // Threads finish the lookup they are in; queued ones are dropped
+    pthread_mutex_lock(&_lock);
+    _stopping = true;
+    pthread_cond_broadcast(&_wake);
+    pthread_mutex_unlock(&_lock);
+    for (size_t i = 0; i < _threads.size(); i++) {
+        pthread_join(_threads[i], NULL);
+    }
+    if (_notifyPipe[0] != -1) {
+        close(_notifyPipe[0]);
+        close(_notifyPipe[1]);
+    }
+    pthread_cond_destroy(&_wake);
+    pthread_mutex_destroy(&_lock);
+}
+
+bool HostResolver::start(size_t threads) {
+    if (pipe(_notifyPipe) == -1) {
+        LOG_ERROR("Error creating resolver notification pipe: " << strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(_notifyPipe[i], F_SETFL, fcntl(_notifyPipe[i], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(_notifyPipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &HostResolver::threadMain, this) != 0) {
+            LOG_ERROR("Error starting resolver thread");
+            return false;
+        }
+        _threads.push_back(thread);
+    }
+    return true;
+}
+
+void* HostResolver::threadMain(void* arg) {
+    static_cast<HostResolver*>(arg)->run();
+    return NULL;
+}
+
+void HostResolver::run() {
+    pthread_mutex_lock(&_lock);
+    while (true) {
+        while (!_stopping && _jobs.empty()) {
+            pthread_cond_wait(&_wake, &_lock);
+        }
+        if (_stopping) {
+            break;
+        }
+        Job job = _jobs.front();
+        _jobs.pop_front();
+        pthread_mutex_unlock(&_lock);
+
+        // Behind a slow lookup for too long: the connection has moved on
+        job.attempted = monotonicMs() < job.deadline;
+        if (job.attempted) {
+            job.hostname = resolveHost(job.address);
+        }
+
+        pthread_mutex_lock(&_lock);
+        _done.push_back(job);
+        if (_done.size() == 1) {
+            ssize_t ret = write(_notifyPipe[1], "x", 1);
+            (void)ret; // A full pipe already guarantees a wakeup
+        }
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+bool HostResolver::lookup(const std::string& address, int fd, unsigned long id, TimeMs now,
+                          std::string& hostname) {
+    Waiter waiter;
+    waiter.fd = fd;
+    waiter.id = id;
+
+    std::map<std::string, Entry>::iterator it = _cache.find(address);
+    if (it != _cache.end() && it->second.expiresAt == 0) {
+        it->second.waiters.push_back(waiter); // Already in flight
+        return false;
+    }
+    if (it != _cache.end() && it->second.expiresAt > now) {
+        metricIncrement(Metrics::instance().dnsCacheHits);
+        hostname = it->second.hostname.empty() ? address : it->second.hostname;
+        return true;
+    }
+
+    if (it == _cache.end()) {
+        expire(now, _cacheLimit ? _cacheLimit - 1 : 0);
+        if (_cache.size() >= _cacheLimit) {
+            // Full of lookups in flight: this one goes without
+            metricIncrement(Metrics::instance().dnsUnresolved);
+            hostname = address;
+            return true;
+        }
+        it = _cache.insert(std::make_pair(address, Entry())).first;
+    }
+    // New, or expired and looked up again in place
+    it->second.hostname.clear();
+    it->second.expiresAt = 0;
+    it->second.waiters.push_back(waiter);
+
+    Job job;
+    job.address = address;
+    job.deadline = now + _timeout;
+    job.attempted = false;
+    metricIncrement(Metrics::instance().dnsLookups);
+    pthread_mutex_lock(&_lock);
+    _jobs.push_back(job);
+    pthread_cond_signal(&_wake);
+    pthread_mutex_unlock(&_lock);
+    return false;
+}
+
+void HostResolver::collect(TimeMs now, std::vector<Answer>& out) {
+    // Drain before taking the results, so a later push wakes us again
+    char buffer[64];
+    while (read(_notifyPipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+    std::vector<Job> done;
+    pthread_mutex_lock(&_lock);
+    done.swap(_done);
+    pthread_mutex_unlock(&_lock);
+
+    for (size_t i = 0; i < done.size(); i++) {
+        const Job& job = done[i];
+        std::map<std::string, Entry>::iterator it = _cache.find(job.address);
+        if (it == _cache.end()) {
+            continue;
+        }
+        Entry& entry = it->second;
+        for (size_t j = 0; j < entry.waiters.size(); j++) {
+            Answer answer;
+            answer.fd = entry.waiters[j].fd;
+            answer.id = entry.waiters[j].id;
+            answer.hostname = job.hostname.empty() ? job.address : job.hostname;
+            out.push_back(answer);
+        }
+        if (job.hostname.empty()) {
+            metricIncrement(Metrics::instance().dnsUnresolved);
+        }
+        if (!job.attempted) {
+            _cache.erase(it); // Never looked up: nothing to remember
+            continue;
+        }
+        entry.waiters.clear();
+        entry.hostname = job.hostname;
+        entry.expiresAt = now + (job.hostname.empty() && NEGATIVE_TTL_MS < _ttl ? NEGATIVE_TTL_MS : _ttl);
+        _order.push_back(std::make_pair(job.address, entry.expiresAt));
+    }
+    expire(now, _cacheLimit);
+}
+
+void HostResolver::expire(TimeMs now, size_t limit) {
+    // Oldest answers first: those that have expired, then as many as it
+    // takes to get down to `limit`. A record whose address was looked up
+    // again since (its expiry differs) is stale and only dropped.
+    while (!_order.empty() && (_order.front().second <= now || _cache.size() > limit)) {
+        std::map<std::string, Entry>::iterator it = _cache.find(_order.front().first);
+        if (it != _cache.end() && it->second.expiresAt == _order.front().second) {
+            _cache.erase(it);
+        }
+        _order.pop_front();
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef RESOLVER_HPP
+#define RESOLVER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <cstddef>
+#include <pthread.h>
+#include "../timers/timerwheel.hpp"
+
+// Reverse DNS for client hostnames, kept off the event loop. The libc
+// resolver blocks, so lookups run on a few helper threads; the main loop
+// posts requests and collects answers through a wakeup pipe it polls.
+//
+// A name is only used once it is forward-confirmed: it must resolve back
+// to the address it came from, otherwise whoever controls the PTR zone
+// could claim any hostname. Answers (names and failures alike) are cached
+// per address for a while, so a reconnect wave from one NAT costs a
+// single lookup; concurrent requests for one address share it.
+class HostResolver {
+public:
+    // A finished lookup for a connection that asked for it
+    struct Answer {
+        int             fd;
+        unsigned long   id;         // Client id, guards against fd reuse
+        std::string     hostname;   // The address itself when unresolved
+    };
+
+private:
+    struct Waiter {
+        int             fd;
+        unsigned long   id;
+    };
+
+    struct Entry {
+        std::string         hostname;   // Empty while pending or when unresolved
+        TimeMs              expiresAt;  // 0 while pending
+        std::vector<Waiter> waiters;    // Pending only
+    };
+
+    // Between the main loop and the helper threads
+    struct Job {
+        std::string     address;
+        std::string     hostname;   // Result: confirmed name, empty on failure
+        TimeMs          deadline;   // Not worth starting past this
+        bool            attempted;  // Result: false when dropped unstarted
+    };
+
+    std::vector<pthread_t>  _threads;
+    pthread_mutex_t         _lock;
+    pthread_cond_t          _wake;      // Jobs queued or stopping
+    std::deque<Job>         _jobs;      // Guarded by _lock
+    std::vector<Job>        _done;      // Guarded by _lock
+    bool                    _stopping;  // Guarded by _lock
+    int                     _notifyPipe[2]; // Helper threads -> main loop
+
+    // Main loop only
+    std::map<std::string, Entry>    _cache;     // Keyed by numeric address
+    std::deque<std::pair<std::string, TimeMs> > _order; // Completed entries, oldest first
+    size_t                          _cacheLimit;
+    TimeMs                          _ttl;
+    TimeMs                          _timeout;
+
+    static void* threadMain(void* arg);
+    void run();
+    void expire(TimeMs now, size_t limit);
+
+    // Prevent copying
+    HostResolver(const HostResolver& other);
+    HostResolver& operator=(const HostResolver& other);
+
+public:
+    HostResolver(size_t cacheLimit, TimeMs ttl, TimeMs timeout);
+    ~HostResolver();
+
+    // Spawn the helper threads; false (logged) on failure
+    bool start(size_t threads);
+    int notifyFd() const { return _notifyPipe[0]; }
+
+    // Main loop side. True with `hostname` set when the cache answers;
+    // otherwise the connection (fd, id) gets an Answer once the lookup
+    // finishes, however late.
+    bool lookup(const std::string& address, int fd, unsigned long id, TimeMs now,
+                std::string& hostname);
+    // Finished lookups since the last call, after the pipe turned readable
+    void collect(TimeMs now, std::vector<Answer>& out);
+};
+
+#endif // RESOLVER_HPP
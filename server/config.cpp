@@ -0,0 +1,88 @@
+#include "config.hpp"
+#include <cstdlib>
+#include "../logger/logger.hpp"
+
+namespace {
+
+// Read a non-negative integer variable, keeping `value` when unset or invalid
+void readSize(const char* name, size_t& value) {
+    const char* raw = std::getenv(name);
+    if (!raw || !*raw) {
+        return;
+    }
+    char* end = NULL;
+    long parsed = std::strtol(raw, &end, 10);
+    if (*end != '\0' || parsed < 0) {
+        LOG_WARNING("Ignoring invalid " << name << "=" << raw);
+        return;
+    }
+    value = static_cast<size_t>(parsed);
+}
+
+void readString(const char* name, std::string& value) {
+    const char* raw = std::getenv(name);
+    if (raw) {
+        value = raw;
+    }
+}
+
+void readLogLevel(const char* name, LogLevel& value) {
+    const char* raw = std::getenv(name);
+    if (!raw || !*raw) {
+        return;
+    }
+    if (!Logger::parseLevel(raw, value)) {
+        LOG_WARNING("Ignoring invalid " << name << "=" << raw);
+    }
+}
+
+} // namespace
+
+ServerConfig::ServerConfig()
+    : workerThreads(0), logLevel(LOG_LEVEL_INFO), registrationTimeout(60), pingInterval(120),
+      pingTimeout(60), idleTimeout(0), sendqSoftLimit(256 * 1024), sendqHardLimit(1024 * 1024),
+      listenBacklog(1024), maxConnectionsPerIp(0), connectRate(0), connectBurst(10),
+      metricsPort(0), metricsAddress("127.0.0.1"), tlsPort(0), serverName("ft_irc"), linkPort(0),
+      floodRate(0), floodBurst(20), linesPerWakeup(0), dnsThreads(2), dnsTimeout(1500),
+      dnsCacheSize(4096), dnsCacheTtl(600), historyLines(100),
+      historyMemory(16 * 1024 * 1024), reusePort(0), restartTimeout(5000),
+      shutdownTimeout(2000) {
+}
+
+void ServerConfig::loadFromEnvironment() {
+    readString("IRCSERV_POLLER", pollerBackend);
+    readSize("IRCSERV_THREADS", workerThreads);
+    readLogLevel("IRCSERV_LOG_LEVEL", logLevel);
+    readSize("IRCSERV_REGISTRATION_TIMEOUT", registrationTimeout);
+    readSize("IRCSERV_PING_INTERVAL", pingInterval);
+    readSize("IRCSERV_PING_TIMEOUT", pingTimeout);
+    readSize("IRCSERV_IDLE_TIMEOUT", idleTimeout);
+    readSize("IRCSERV_SENDQ_SOFT", sendqSoftLimit);
+    readSize("IRCSERV_SENDQ_HARD", sendqHardLimit);
+    readSize("IRCSERV_LISTEN_BACKLOG", listenBacklog);
+    readSize("IRCSERV_MAX_CONNECTIONS_PER_IP", maxConnectionsPerIp);
+    readSize("IRCSERV_CONNECT_RATE", connectRate);
+    readSize("IRCSERV_CONNECT_BURST", connectBurst);
+    readSize("IRCSERV_METRICS_PORT", metricsPort);
+    readString("IRCSERV_METRICS_ADDRESS", metricsAddress);
+    readSize("IRCSERV_TLS_PORT", tlsPort);
+    readString("IRCSERV_TLS_CERT", tlsCertFile);
+    readString("IRCSERV_TLS_KEY", tlsKeyFile);
+    readString("IRCSERV_SERVER_NAME", serverName);
+    readSize("IRCSERV_LINK_PORT", linkPort);
+    readString("IRCSERV_LINK_PASSWORD", linkPassword);
+    readString("IRCSERV_LINK_PEERS", linkPeers);
+    readString("IRCSERV_LISTEN", listen);
+    readSize("IRCSERV_REUSEPORT", reusePort);
+    readSize("IRCSERV_FLOOD_RATE", floodRate);
+    readSize("IRCSERV_FLOOD_BURST", floodBurst);
+    readSize("IRCSERV_DNS_THREADS", dnsThreads);
+    readSize("IRCSERV_DNS_TIMEOUT", dnsTimeout);
+    readSize("IRCSERV_DNS_CACHE_SIZE", dnsCacheSize);
+    readSize("IRCSERV_DNS_CACHE_TTL", dnsCacheTtl);
+    readSize("IRCSERV_HISTORY_LINES", historyLines);
+    readSize("IRCSERV_HISTORY_MEMORY", historyMemory);
+    readSize("IRCSERV_LINES_PER_WAKEUP", linesPerWakeup);
+    readSize("IRCSERV_RESTART_TIMEOUT", restartTimeout);
+    readSize("IRCSERV_SHUTDOWN_TIMEOUT", shutdownTimeout);
+}
@@ -0,0 +1,64 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <cstddef>
+#include "../logger/logger.hpp"
+
+// Tunables that are not part of the `./ircserv <port> <password>` command
+// line; loadFromEnvironment() overrides them from IRCSERV_* variables.
+//
+// Most defaults leave a feature off. A few are on by default because a
+// public server needs them, and they change what the original server did:
+// - registrationTimeout and pingInterval/pingTimeout disconnect clients
+//   that never register or stop answering, which would otherwise hold
+//   their descriptors forever;
+// - the send queue limits drop chatter for, then disconnect, clients
+//   that stop reading, so one slow reader cannot grow memory unbounded;
+// - dnsThreads shows resolved hostnames instead of the fixed "host"
+//   (registration does not wait for them; 0 shows the address);
+// - historyLines records channel messages for CHATHISTORY and
+//   advertises it in 005 (0 = off).
+struct ServerConfig {
+    std::string     pollerBackend;  // IRCSERV_POLLER: "epoll", "kqueue" or "poll" (empty = best available)
+    size_t          workerThreads;  // IRCSERV_THREADS: socket I/O threads (0 = single-threaded loop)
+    LogLevel        logLevel;       // IRCSERV_LOG_LEVEL: "debug", "info", "warning" or "error"
+    size_t          registrationTimeout; // IRCSERV_REGISTRATION_TIMEOUT: seconds to complete PASS/NICK/USER
+    size_t          pingInterval;   // IRCSERV_PING_INTERVAL: seconds of silence before the server PINGs
+    size_t          pingTimeout;    // IRCSERV_PING_TIMEOUT: seconds to answer a PING
+    size_t          idleTimeout;    // IRCSERV_IDLE_TIMEOUT: seconds without a command (0 = never)
+    size_t          sendqSoftLimit; // IRCSERV_SENDQ_SOFT: queued bytes past which channel chatter is dropped
+    size_t          sendqHardLimit; // IRCSERV_SENDQ_HARD: queued bytes past which the client is disconnected
+    size_t          listenBacklog;  // IRCSERV_LISTEN_BACKLOG: pending-connection queue length for listen()
+    size_t          maxConnectionsPerIp; // IRCSERV_MAX_CONNECTIONS_PER_IP: live connections per address (0 = unlimited)
+    size_t          connectRate;    // IRCSERV_CONNECT_RATE: new connections per minute per address (0 = unlimited)
+    size_t          connectBurst;   // IRCSERV_CONNECT_BURST: connections allowed back to back before the rate applies
+    size_t          metricsPort;    // IRCSERV_METRICS_PORT: Prometheus endpoint port (0 = disabled)
+    std::string     metricsAddress; // IRCSERV_METRICS_ADDRESS: IPv4 address the endpoint binds to
+    size_t          tlsPort;        // IRCSERV_TLS_PORT: second listener speaking TLS (0 = none; needs make TLS=1)
+    std::string     tlsCertFile;    // IRCSERV_TLS_CERT: PEM certificate chain for the TLS listener
+    std::string     tlsKeyFile;     // IRCSERV_TLS_KEY: PEM private key for the TLS listener
+    std::string     serverName;     // IRCSERV_SERVER_NAME: this node's name on the server links (unique per network)
+    size_t          linkPort;       // IRCSERV_LINK_PORT: port accepting server links (0 = none)
+    std::string     linkPassword;   // IRCSERV_LINK_PASSWORD: shared secret every linked server presents
+    std::string     linkPeers;      // IRCSERV_LINK_PEERS: "ip:port,[ipv6]:port,..." servers to connect to and keep linked
+    std::string     listen;         // IRCSERV_LISTEN: "[address:]port[/tls],..." client listeners (empty = the CLI port, plus IRCSERV_TLS_PORT)
+    size_t          floodRate;      // IRCSERV_FLOOD_RATE: command cost units a client regains per second (0 = no flood control)
+    size_t          floodBurst;     // IRCSERV_FLOOD_BURST: cost units a client may spend back to back (held lines resume on 100 ms timer ticks, so keep it >= rate / 10)
+    size_t          linesPerWakeup; // IRCSERV_LINES_PER_WAKEUP: lines run per client per loop iteration (0 = unlimited)
+    size_t          dnsThreads;     // IRCSERV_DNS_THREADS: reverse-lookup threads for client hostnames (0 = hostnames are addresses)
+    size_t          dnsTimeout;     // IRCSERV_DNS_TIMEOUT: milliseconds a lookup answer may still replace the address (later ones are only cached)
+    size_t          dnsCacheSize;   // IRCSERV_DNS_CACHE_SIZE: addresses whose lookup result is remembered
+    size_t          dnsCacheTtl;    // IRCSERV_DNS_CACHE_TTL: seconds a result is remembered (failures: at most 60)
+    size_t          historyLines;   // IRCSERV_HISTORY_LINES: PRIVMSG/NOTICE lines kept per channel for CHATHISTORY (0 = none)
+    size_t          historyMemory;  // IRCSERV_HISTORY_MEMORY: bytes of history kept over all channels, oldest lines go first
+    size_t          reusePort;      // IRCSERV_REUSEPORT: 1 = SO_REUSEPORT; with threads, each I/O thread accepts on its own socket
+    size_t          restartTimeout; // IRCSERV_RESTART_TIMEOUT: milliseconds a hot restart (SIGUSR2) waits for the new process at each step
+    size_t          shutdownTimeout; // IRCSERV_SHUTDOWN_TIMEOUT: milliseconds SIGINT/SIGTERM leaves the send queues to drain
+
+    ServerConfig();
+
+    void loadFromEnvironment();
+};
+
+#endif // CONFIG_HPP
@@ -0,0 +1,360 @@
+#include "handoff.hpp"
+#include "../logger/logger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace {
+
+const char* const HANDOFF_ENV = "IRCSERV_HANDOFF_FD";
+
+// Control bytes on the handoff socket
+const char READY = 'R';         // Successor -> old process: send the state
+const char ACK = 'A';           // Successor -> old process: state restored
+const char HEADER = 'H';        // Total sizes, first message
+const char CHUNK = 'C';         // Part of the snapshot, with descriptors
+
+// Per message: well under the default socket buffer, and below the
+// kernel's limit on descriptors per SCM_RIGHTS message (253 on Linux)
+const size_t CHUNK_BYTES = 32 * 1024;
+const size_t CHUNK_FDS = 250;
+
+void encodeU32(char* out, unsigned int value) {
+    for (int i = 3; i >= 0; i--) {
+        out[i] = static_cast<char>(value & 0xff);
+        value >>= 8;
+    }
+}
+
+unsigned int decodeU32(const char* in) {
+    unsigned int value = 0;
+    for (int i = 0; i < 4; i++) {
+        value = value << 8 | static_cast<unsigned char>(in[i]);
+    }
+    return value;
+}
+
+bool waitReadable(int fd, int timeoutMs) {
+    struct pollfd entry;
+    entry.fd = fd;
+    entry.events = POLLIN;
+    entry.revents = 0;
+    int ready;
+    do {
+        ready = poll(&entry, 1, timeoutMs);
+    } while (ready < 0 && errno == EINTR);
+    return ready > 0;
+}
+
+bool sendMessage(int socket, const char* data, size_t length, const int* fds, size_t fdCount) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(data);
+    iov.iov_len = length;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    std::vector<char> control;
+    if (fdCount > 0) {
+        control.resize(CMSG_SPACE(fdCount * sizeof(int)), 0);
+        message.msg_control = &control[0];
+        message.msg_controllen = control.size();
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(fdCount * sizeof(int));
+        memcpy(CMSG_DATA(header), fds, fdCount * sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == static_cast<ssize_t>(length);
+}
+
+} // namespace
+
+void SnapshotWriter::putU8(unsigned int value) {
+    _data.push_back(static_cast<char>(value & 0xff));
+}
+
+void SnapshotWriter::putU32(unsigned int value) {
+    char bytes[4];
+    encodeU32(bytes, value);
+    _data.append(bytes, 4);
+}
+
+void SnapshotWriter::putU64(unsigned long long value) {
+    putU32(static_cast<unsigned int>(value >> 32));
+    putU32(static_cast<unsigned int>(value & 0xffffffffULL));
+}
+
+void SnapshotWriter::putString(const std::string& value) {
+    putBytes(value.data(), value.size());
+}
+
+void SnapshotWriter::putBytes(const char* data, size_t length) {
+    putU32(static_cast<unsigned int>(length));
+    _data.append(data, length);
+}
+
+void SnapshotWriter::putFd(int fd) {
+    putU32(static_cast<unsigned int>(_fds.size()));
+    _fds.push_back(fd);
+}
+
+bool SnapshotWriter::send(int socket) const {
+    char header[9];
+    header[0] = HEADER;
+    encodeU32(header + 1, static_cast<unsigned int>(_data.size()));
+    encodeU32(header + 5, static_cast<unsigned int>(_fds.size()));
+    if (!sendMessage(socket, header, sizeof(header), NULL, 0)) {
+        LOG_ERROR("Error sending the restart snapshot: " << strerror(errno));
+        return false;
+    }
+
+    // Bytes and descriptors are two streams cut into the same messages
+    size_t offset = 0;
+    size_t fdOffset = 0;
+    std::string chunk;
+    while (offset < _data.size() || fdOffset < _fds.size()) {
+        size_t length = std::min(CHUNK_BYTES, _data.size() - offset);
+        size_t fdCount = std::min(CHUNK_FDS, _fds.size() - fdOffset);
+        chunk.assign(1, CHUNK);
+        chunk.append(_data, offset, length);
+        if (!sendMessage(socket, chunk.data(), chunk.size(), fdCount ? &_fds[fdOffset] : NULL, fdCount)) {
+            LOG_ERROR("Error sending the restart snapshot: " << strerror(errno));
+            return false;
+        }
+        offset += length;
+        fdOffset += fdCount;
+    }
+    return true;
+}
+
+SnapshotReader::SnapshotReader() : _offset(0), _failed(false) {
+}
+
+SnapshotReader::~SnapshotReader() {
+    for (size_t i = 0; i < _fds.size(); i++) {
+        if (_fds[i] != -1) {
+            close(_fds[i]);
+        }
+    }
+}
+
+bool SnapshotReader::receive(int socket, int timeoutMs) {
+    std::vector<char> buffer(CHUNK_BYTES + 1);
+    std::vector<char> control(CMSG_SPACE(CHUNK_FDS * sizeof(int)));
+    size_t expectedBytes = 0;
+    size_t expectedFds = 0;
+    bool started = false;
+
+    while (!started || _data.size() < expectedBytes || _fds.size() < expectedFds) {
+        if (!waitReadable(socket, timeoutMs)) {
+            LOG_ERROR("Timed out waiting for the restart snapshot");
+            return false;
+        }
+        struct iovec iov;
+        iov.iov_base = &buffer[0];
+        iov.iov_len = buffer.size();
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = &control[0];
+        message.msg_controllen = control.size();
+        int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+        flags |= MSG_CMSG_CLOEXEC;
+#endif
+        ssize_t length = recvmsg(socket, &message, flags);
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            LOG_ERROR("Restart snapshot cut short" << (length < 0 ? std::string(": ") + strerror(errno) : ""));
+            return false;
+        }
+
+        // Descriptors first: they are ours to close even if the rest fails
+        for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* fds = reinterpret_cast<const int*>(CMSG_DATA(header));
+            for (size_t i = 0; i < count; i++) {
+                fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+                _fds.push_back(fds[i]);
+            }
+        }
+        if (message.msg_flags & (MSG_CTRUNC | MSG_TRUNC)) {
+            LOG_ERROR("Restart snapshot message truncated");
+            return false;
+        }
+
+        if (!started) {
+            if (length != 9 || buffer[0] != HEADER) {
+                LOG_ERROR("Malformed restart snapshot header");
+                return false;
+            }
+            expectedBytes = decodeU32(&buffer[1]);
+            expectedFds = decodeU32(&buffer[5]);
+            started = true;
+            continue;
+        }
+        if (buffer[0] != CHUNK) {
+            LOG_ERROR("Malformed restart snapshot");
+            return false;
+        }
+        _data.append(&buffer[1], length - 1);
+    }
+    return _data.size() == expectedBytes && _fds.size() == expectedFds;
+}
+
+bool SnapshotReader::need(size_t length) {
+    if (_failed || _data.size() - _offset < length) {
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+unsigned int SnapshotReader::getU8() {
+    if (!need(1)) {
+        return 0;
+    }
+    return static_cast<unsigned char>(_data[_offset++]);
+}
+
+unsigned int SnapshotReader::getU32() {
+    if (!need(4)) {
+        return 0;
+    }
+    unsigned int value = decodeU32(_data.data() + _offset);
+    _offset += 4;
+    return value;
+}
+
+unsigned long long SnapshotReader::getU64() {
+    unsigned long long high = getU32();
+    return high << 32 | getU32();
+}
+
+std::string SnapshotReader::getString() {
+    size_t length = getU32();
+    if (!need(length)) {
+        return std::string();
+    }
+    std::string value(_data, _offset, length);
+    _offset += length;
+    return value;
+}
+
+int SnapshotReader::takeFd() {
+    size_t index = getU32();
+    if (_failed || index >= _fds.size() || _fds[index] == -1) {
+        _failed = true;
+        return -1;
+    }
+    int fd = _fds[index];
+    _fds[index] = -1;
+    return fd;
+}
+
+int spawnSuccessor(const std::vector<std::string>& argv, int timeoutMs, pid_t& pid) {
+    int ends[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, ends) == -1) {
+        LOG_ERROR("Error creating the handoff socket: " << strerror(errno));
+        return -1;
+    }
+    // Only the successor's end survives exec
+    fcntl(ends[0], F_SETFD, FD_CLOEXEC);
+
+    // Our environment, plus where the successor finds its end
+    std::ostringstream variable;
+    variable << HANDOFF_ENV << "=" << ends[1];
+    std::vector<std::string> environment;
+    size_t nameLength = strlen(HANDOFF_ENV);
+    for (char** entry = environ; *entry; ++entry) {
+        if (strncmp(*entry, HANDOFF_ENV, nameLength) != 0 || (*entry)[nameLength] != '=') {
+            environment.push_back(*entry);
+        }
+    }
+    environment.push_back(variable.str());
+
+    std::vector<char*> args;
+    for (size_t i = 0; i < argv.size(); i++) {
+        args.push_back(const_cast<char*>(argv[i].c_str()));
+    }
+    args.push_back(NULL);
+    std::vector<char*> envp;
+    for (size_t i = 0; i < environment.size(); i++) {
+        envp.push_back(const_cast<char*>(environment[i].c_str()));
+    }
+    envp.push_back(NULL);
+
+    int status = posix_spawnp(&pid, args[0], NULL, NULL, &args[0], &envp[0]);
+    close(ends[1]);
+    if (status != 0) {
+        LOG_ERROR("Error starting " << argv[0] << ": " << strerror(status));
+        close(ends[0]);
+        return -1;
+    }
+
+    // Asked once its configuration is loaded; nothing was handed over yet,
+    // so a successor that fails before that costs nothing
+    char byte = 0;
+    if (!waitReadable(ends[0], timeoutMs) || recv(ends[0], &byte, 1, 0) != 1 || byte != READY) {
+        LOG_ERROR("New process " << pid << " did not come up, restart abandoned");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(ends[0]);
+        return -1;
+    }
+    return ends[0];
+}
+
+int inheritedHandoffSocket() {
+    const char* raw = std::getenv(HANDOFF_ENV);
+    if (!raw || !*raw) {
+        return -1;
+    }
+    char* end = NULL;
+    long fd = std::strtol(raw, &end, 10);
+    unsetenv(HANDOFF_ENV); // Not inherited by our own successor
+    if (*end != '\0' || fd < 0 || fcntl(static_cast<int>(fd), F_SETFD, FD_CLOEXEC) == -1) {
+        LOG_ERROR("Ignoring invalid " << HANDOFF_ENV);
+        return -1;
+    }
+    if (send(static_cast<int>(fd), &READY, 1, MSG_NOSIGNAL) != 1) {
+        LOG_ERROR("Error contacting the previous process: " << strerror(errno));
+        close(static_cast<int>(fd));
+        return -1;
+    }
+    return static_cast<int>(fd);
+}
+
+void acknowledgeHandoff(int socket) {
+    ssize_t ret = send(socket, &ACK, 1, MSG_NOSIGNAL);
+    (void)ret; // The predecessor exits on its own after a timeout
+}
+
+bool awaitAcknowledgement(int socket, int timeoutMs) {
+    char byte = 0;
+    return waitReadable(socket, timeoutMs) && recv(socket, &byte, 1, 0) == 1 && byte == ACK;
+}
@@ -0,0 +1,91 @@
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <sys/types.h>
+
+// Hot restart: the running process starts its successor (the same command
+// line, so an upgraded binary on disk takes over), and hands it a snapshot
+// of the server state together with the sockets it refers to over a
+// private AF_UNIX socket. Descriptors travel as SCM_RIGHTS; the snapshot
+// refers to them by position.
+//
+// The snapshot is a flat sequence of fixed-width integers and
+// length-prefixed strings, written and read back in the same order by
+// Server, Client and Channel; there is no schema beyond that order and
+// SNAPSHOT_VERSION, which must match on both sides.
+
+const unsigned int SNAPSHOT_VERSION = 1;
+
+class SnapshotWriter {
+private:
+    std::string         _data;
+    std::vector<int>    _fds;   // Not owned: sent as duplicates
+
+public:
+    void putU8(unsigned int value);
+    void putU32(unsigned int value);
+    void putU64(unsigned long long value);
+    void putString(const std::string& value);
+    void putBytes(const char* data, size_t length);
+    // `fd` travels with the snapshot; its position is recorded here
+    void putFd(int fd);
+
+    size_t size() const { return _data.size(); }
+    size_t fdCount() const { return _fds.size(); }
+
+    // Blocking; false (logged) if the successor went away
+    bool send(int socket) const;
+};
+
+// Reads fail soft: past the end or on a bad descriptor index every getter
+// returns zero/empty and failed() turns true, so callers check once per
+// record instead of after each field.
+class SnapshotReader {
+private:
+    std::string         _data;
+    size_t              _offset;
+    std::vector<int>    _fds;   // Owned until taken (-1 once taken)
+    bool                _failed;
+
+    bool need(size_t length);
+
+    // Prevent copying
+    SnapshotReader(const SnapshotReader& other);
+    SnapshotReader& operator=(const SnapshotReader& other);
+
+public:
+    SnapshotReader();
+    ~SnapshotReader();  // Closes the descriptors nobody took
+
+    // Everything the predecessor sends, waiting at most `timeoutMs` per message
+    bool receive(int socket, int timeoutMs);
+
+    unsigned int getU8();
+    unsigned int getU32();
+    unsigned long long getU64();
+    std::string getString();
+    // Ownership of the descriptor goes to the caller; -1 on failure
+    int takeFd();
+
+    bool failed() const { return _failed; }
+    bool done() const { return _offset == _data.size(); }
+};
+
+// Old process: start the successor with `argv`, passing it one end of a
+// socket pair, and wait until it asks for the state. Returns our end, or
+// -1 (logged, successor reaped) if it fails to come up within `timeoutMs`.
+int spawnSuccessor(const std::vector<std::string>& argv, int timeoutMs, pid_t& pid);
+
+// New process: the socket left by spawnSuccessor(), once it has asked for
+// the state; -1 when started normally
+int inheritedHandoffSocket();
+
+// New process: the state arrived and is in use, the predecessor may exit
+void acknowledgeHandoff(int socket);
+// Old process: wait for that, at most `timeoutMs`
+bool awaitAcknowledgement(int socket, int timeoutMs);
+
+#endif // HANDOFF_HPP
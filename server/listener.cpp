@@ -0,0 +1,234 @@
+#include "listener.hpp"
+#include "../logger/logger.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+namespace {
+
+bool parsePort(const std::string& text, unsigned int& port) {
+    char* end = NULL;
+    long value = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || value <= 0 || value > 65535) {
+        return false;
+    }
+    port = static_cast<unsigned int>(value);
+    return true;
+}
+
+} // namespace
+
+bool parseListenerSpec(const std::string& text, ListenerSpec& spec) {
+    std::string entry = text;
+    spec.tls = false;
+    size_t slash = entry.find('/');
+    if (slash != std::string::npos) {
+        if (entry.substr(slash + 1) != "tls") {
+            return false;
+        }
+        spec.tls = true;
+        entry.erase(slash);
+    }
+
+    if (!entry.empty() && entry[0] == '[') {
+        size_t close = entry.find(']');
+        if (close == std::string::npos || close + 1 >= entry.size() || entry[close + 1] != ':') {
+            return false;
+        }
+        spec.address = entry.substr(1, close - 1);
+        return parsePort(entry.substr(close + 2), spec.port);
+    }
+    size_t colon = entry.rfind(':');
+    if (colon == std::string::npos) {
+        spec.address = "0.0.0.0";
+        return parsePort(entry, spec.port);
+    }
+    spec.address = entry.substr(0, colon);
+    return parsePort(entry.substr(colon + 1), spec.port);
+}
+
+std::string ListenerSpec::describe() const {
+    std::ostringstream out;
+    if (address.find(':') != std::string::npos) {
+        out << "[" << address << "]";
+    } else {
+        out << address;
+    }
+    out << ":" << port << (tls ? "/tls" : "");
+    return out.str();
+}
+
+bool parseListenerSpecs(const std::string& list, std::vector<ListenerSpec>& out) {
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string entry = list.substr(start, end - start);
+        start = end + 1;
+        if (entry.empty()) {
+            continue;
+        }
+        ListenerSpec spec;
+        if (!parseListenerSpec(entry, spec)) {
+            LOG_ERROR("Invalid listener " << entry << " (expected [address:]port[/tls])");
+            return false;
+        }
+        out.push_back(spec);
+    }
+    return true;
+}
+
+int openListener(const ListenerSpec& spec, int backlog, bool reusePort) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+    std::ostringstream port;
+    port << spec.port;
+    struct addrinfo* info = NULL;
+    int status = getaddrinfo(spec.address.c_str(), port.str().c_str(), &hints, &info);
+    if (status != 0) {
+        LOG_ERROR("Invalid listener address " << spec.describe() << ": " << gai_strerror(status));
+        return -1;
+    }
+
+    int fd = socket(info->ai_family, SOCK_STREAM, 0);
+    int on = 1;
+    bool ok = fd != -1
+        && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != -1
+        && fcntl(fd, F_SETFD, FD_CLOEXEC) != -1
+        && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != -1;
+#ifdef SO_REUSEPORT
+    if (ok && reusePort) {
+        ok = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != -1;
+    }
+#else
+    if (reusePort) {
+        LOG_WARNING("SO_REUSEPORT is not available, " << spec.describe() << " is not sharded");
+    }
+#endif
+    // Wildcard IPv6 must not swallow IPv4, which has its own listener
+    if (ok && info->ai_family == AF_INET6) {
+        ok = setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on)) != -1;
+    }
+    ok = ok && bind(fd, info->ai_addr, info->ai_addrlen) != -1 && listen(fd, backlog) != -1;
+    freeaddrinfo(info);
+
+    if (!ok) {
+        LOG_ERROR("Error listening on " << spec.describe() << ": " << strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+bool resolveListenerSpec(const ListenerSpec& spec, struct sockaddr_storage& address, socklen_t& length) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    std::ostringstream port;
+    port << spec.port;
+    struct addrinfo* info = NULL;
+    int status = getaddrinfo(spec.address.c_str(), port.str().c_str(), &hints, &info);
+    if (status != 0) {
+        LOG_ERROR("Invalid address " << spec.describe() << ": " << gai_strerror(status));
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    memcpy(&address, info->ai_addr, info->ai_addrlen);
+    length = info->ai_addrlen;
+    freeaddrinfo(info);
+    return true;
+}
+
+bool listenerMatches(int fd, const ListenerSpec& spec) {
+    struct sockaddr_storage bound;
+    socklen_t length = sizeof(bound);
+    if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&bound), &length) == -1) {
+        return false;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+    std::ostringstream port;
+    port << spec.port;
+    struct addrinfo* info = NULL;
+    if (getaddrinfo(spec.address.c_str(), port.str().c_str(), &hints, &info) != 0) {
+        return false;
+    }
+    bool same = info->ai_family == bound.ss_family;
+    if (same && bound.ss_family == AF_INET) {
+        const struct sockaddr_in* a = reinterpret_cast<const struct sockaddr_in*>(&bound);
+        const struct sockaddr_in* b = reinterpret_cast<const struct sockaddr_in*>(info->ai_addr);
+        same = a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+    } else if (same && bound.ss_family == AF_INET6) {
+        const struct sockaddr_in6* a = reinterpret_cast<const struct sockaddr_in6*>(&bound);
+        const struct sockaddr_in6* b = reinterpret_cast<const struct sockaddr_in6*>(info->ai_addr);
+        same = a->sin6_port == b->sin6_port && memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+    }
+    freeaddrinfo(info);
+    return same;
+}
+
+int acceptSocket(int listenFd, struct sockaddr_storage& address) {
+    socklen_t length = sizeof(address);
+#ifdef SOCK_NONBLOCK
+    return accept4(listenFd, reinterpret_cast<struct sockaddr*>(&address), &length,
+                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int fd = accept(listenFd, reinterpret_cast<struct sockaddr*>(&address), &length);
+    if (fd != -1) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return fd;
+#endif
+}
+
+unsigned long sourceKeyOf(const struct sockaddr_storage& address) {
+    if (address.ss_family == AF_INET) {
+        return ntohl(reinterpret_cast<const struct sockaddr_in&>(address).sin_addr.s_addr);
+    }
+    if (address.ss_family != AF_INET6) {
+        return 0;
+    }
+    const unsigned char* bytes = reinterpret_cast<const struct sockaddr_in6&>(address).sin6_addr.s6_addr;
+    static const unsigned char MAPPED[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    if (memcmp(bytes, MAPPED, sizeof(MAPPED)) == 0) {
+        return (static_cast<unsigned long>(bytes[12]) << 24) | (bytes[13] << 16) | (bytes[14] << 8) | bytes[15];
+    }
+    // Fold the /64 and tag it, so it cannot alias an IPv4 key
+    unsigned long key = 0;
+    for (size_t i = 0; i < 8; i++) {
+        key = (key << 8 | key >> (sizeof(key) * 8 - 8)) ^ bytes[i];
+    }
+    return key | ~(~0UL >> 1);
+}
+
+std::string formatAddress(const struct sockaddr_storage& address) {
+    char host[INET6_ADDRSTRLEN];
+    const void* raw = address.ss_family == AF_INET6
+        ? static_cast<const void*>(&reinterpret_cast<const struct sockaddr_in6&>(address).sin6_addr)
+        : static_cast<const void*>(&reinterpret_cast<const struct sockaddr_in&>(address).sin_addr);
+    if (!inet_ntop(address.ss_family, raw, host, sizeof(host))) {
+        return "unknown";
+    }
+    // "::1" would read as a trailing parameter inside a message
+    return host[0] == ':' ? std::string("0") + host : std::string(host);
+}
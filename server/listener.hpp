@@ -0,0 +1,56 @@
+#ifndef LISTENER_HPP
+#define LISTENER_HPP
+
+#include <string>
+#include <cstddef>
+#include <vector>
+#include <sys/socket.h>
+
+// One configured listening endpoint, from IRCSERV_LISTEN:
+//   6667                 every IPv4 address
+//   127.0.0.1:6667       one IPv4 address
+//   [::]:6667            every IPv6 address (IPv6 only, pair it with an IPv4 one)
+//   [::1]:6697/tls       any of the above, speaking TLS
+struct ListenerSpec {
+    std::string     address;    // Numeric host, without brackets
+    unsigned int    port;
+    bool            tls;
+
+    std::string describe() const;   // "[::1]:6697/tls", for logging
+};
+
+// Upper bound on accepts per listener wakeup, so a connection storm cannot
+// starve established clients; the listener stays readable for the rest
+const size_t ACCEPT_BATCH = 1024;
+
+// Comma-separated list; false (logged) on the first malformed entry
+bool parseListenerSpecs(const std::string& list, std::vector<ListenerSpec>& out);
+
+// A single entry of such a list; false if malformed (not logged)
+bool parseListenerSpec(const std::string& entry, ListenerSpec& spec);
+
+// Socket address of `spec`, to connect() to; false (logged) if the
+// address is not numeric
+bool resolveListenerSpec(const ListenerSpec& spec, struct sockaddr_storage& address, socklen_t& length);
+
+// Non-blocking, close-on-exec listening socket, -1 on failure (logged).
+// With `reusePort` several sockets (threads, processes) share the
+// address, each with its own accept queue balanced by the kernel.
+int openListener(const ListenerSpec& spec, int backlog, bool reusePort);
+
+// Whether the listening socket `fd` is bound to the address of `spec`
+// (hot restart: telling inherited listeners apart)
+bool listenerMatches(int fd, const ListenerSpec& spec);
+
+// Accept with the socket already non-blocking and close-on-exec
+int acceptSocket(int listenFd, struct sockaddr_storage& address);
+
+// Throttle key of a peer: the IPv4 address, or the /64 prefix of an IPv6
+// one (a single host usually owns the whole /64). IPv4-mapped IPv6
+// addresses key like the IPv4 address they carry.
+unsigned long sourceKeyOf(const struct sockaddr_storage& address);
+
+// Numeric host of a peer, as used for its hostname
+std::string formatAddress(const struct sockaddr_storage& address);
+
+#endif // LISTENER_HPP
@@ -1,193 +1,539 @@
 #include "server.hpp"
 #include "../client/client.hpp"
 #include "../channels/channels.hpp"
-#include <iostream>
+#include "../eventloop/worker.hpp"
+#include "../logger/logger.hpp"
 #include <cstring>
+#include <cerrno>
+#include <cstdlib>
 #include <fcntl.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "../buffers/outputqueue.hpp"
+#include "../buffers/linebuilder.hpp"
+#include "../metrics/metrics.hpp"
+#include "../metrics/exporter.hpp"
+#include "../links/linkmanager.hpp"
+#include "../tls/tls.hpp"
+#include "../resolver/resolver.hpp"
+#include "../utils/flatmap.hpp"
+#include "listener.hpp"
+#include "handoff.hpp"
 
-Server::Server(unsigned int port, const std::string& password)
-    : _serverSocket(-1), _port(port), _password(password) {
+namespace {
+
+// Timer wheel resolution; deadlines are seconds apart, so this is plenty
+const TimeMs TIMER_TICK_MS = 100;
+
+// Best-effort goodbye for a connection turned away before it got a Client
+void rejectSocket(int fd, const char* reason) {
+    OutputQueue output;
+    output.push(Payload::frame(std::string("ERROR :") + reason));
+    output.flush(fd);
+    close(fd);
+}
+
+} // namespace
+
+Server::Server(unsigned int port, const std::string& password, const ServerConfig& config)
+    : _tlsContext(NULL), _port(port), _password(password), _config(config),
+      _poller(Poller::create(config.pollerBackend.empty() ? NULL : config.pollerBackend.c_str())),
+      _timers(TIMER_TICK_MS, monotonicMs()), _now(monotonicMs()),
+      _throttle(config.maxConnectionsPerIp, config.connectRate, config.connectBurst),
+      _clientCount(0), _deliveryMark(0), _nextClientId(1), _nextWorker(0), _notifyFlag(0), _iteration(0), _exporter(NULL), _links(NULL), _resolver(NULL),
+      _historyBudget(config.historyMemory) {
+    _notifyPipe[0] = -1;
+    _notifyPipe[1] = -1;
+    _signalPipe[0] = -1;
+    _signalPipe[1] = -1;
 }
 
 Server::~Server() {
+    // Remote users first, they sit in the same channels as local ones
+    delete _links;
+    _links = NULL;
+
     // Clean up clients
-    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        delete it->second;
+    for (size_t fd = 0; fd < _clients.size(); ++fd) {
+        delete _clients[fd];
     }
     _clients.clear();
+    _clientCount = 0;
+
+    // Stop I/O threads; they close the sockets they still own
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        delete _workers[i];
+    }
+    _workers.clear();
+    if (_notifyPipe[0] != -1) {
+        close(_notifyPipe[0]);
+        close(_notifyPipe[1]);
+    }
 
     // Clean up channels
-    for (std::map<std::string, Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
-        delete it->second;
+    std::vector<Channel*> channels;
+    _channels.values(channels);
+    for (size_t i = 0; i < channels.size(); ++i) {
+        _channels.erase(channels[i]->getName());
+        delete channels[i];
     }
-    _channels.clear();
 
-    // Close server socket
-    if (_serverSocket != -1) {
-        close(_serverSocket);
+    delete _resolver;
+    if (_signalPipe[0] != -1) {
+        close(_signalPipe[0]);
+        close(_signalPipe[1]);
     }
+
+    // Close the listeners
+    stop();
+    delete _tlsContext;
+    delete _exporter;
+    delete _poller;
+}
+
+bool Server::startExporter() {
+    // Prometheus endpoint, served from this loop
+    if (_config.metricsPort > 0) {
+        _exporter = new MetricsExporter(_poller);
+        if (!_exporter->listen(_config.metricsAddress, _config.metricsPort, 16)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Server::startLinks() {
+    // Server links, also served from this loop
+    if (_config.linkPort > 0 || !_config.linkPeers.empty()) {
+        _links = new LinkManager(this, _poller);
+        if (!_links->setup()) {
+            return false;
+        }
+    }
+    return true;
 }
 
 bool Server::setup() {
-    // Create socket
-    _serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (_serverSocket == -1) {
-        std::cerr << "Error creating socket: " << strerror(errno) << std::endl;
-    return false;
-}
-
-    // Set socket options to reuse address
-    int opt = 1;
-    if (setsockopt(_serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-        std::cerr << "Error setting socket options" << std::endl;
-        close(_serverSocket);
+    std::vector<ListenerSpec> specs;
+    if (!listenerSpecs(specs)) {
         return false;
     }
 
-    // Set non-blocking mode
-    if (!setNonBlocking(_serverSocket)) {
-        std::cerr << "Error setting non-blocking mode" << std::endl;
-        close(_serverSocket);
+    // One certificate for every TLS listener
+    for (size_t i = 0; i < specs.size(); i++) {
+        if (specs[i].tls && !_tlsContext) {
+            _tlsContext = TlsContext::create(_config.tlsCertFile, _config.tlsKeyFile);
+            if (!_tlsContext) {
+                return false;
+            }
+        }
+    }
+
+    // Hot restart: the previous process hands over its listeners, which
+    // stand in for new ones on the same addresses, then its clients
+    SnapshotReader snapshot;
+    std::vector<Listener> inherited;
+    UniqueFd handoff(inheritedHandoffSocket());
+    if (handoff.valid() && !receiveHandoff(handoff.get(), snapshot, inherited)) {
+        return false;
+    }
+
+    // Sharded: every I/O worker opens its own SO_REUSEPORT socket per
+    // listener and the kernel spreads connections over their accept
+    // queues. Otherwise this loop accepts; SO_REUSEPORT then only lets
+    // several processes share the port.
+    bool sharded = _config.reusePort && _config.workerThreads > 0;
+    for (size_t i = 0; !sharded && i < specs.size(); i++) {
+        Listener listener;
+        listener.fd = takeInherited(inherited, specs[i]);
+        if (listener.fd == -1) {
+            listener.fd = openListener(specs[i], static_cast<int>(_config.listenBacklog), _config.reusePort != 0);
+        }
+        listener.tls = specs[i].tls;
+        if (listener.fd == -1) {
+            return false;
+        }
+        _listeners.push_back(listener);
+
+        // Level-triggered: each wakeup accepts a bounded batch, the kernel
+        // keeps notifying while connections are still queued
+        if (!_poller->add(listener.fd, Poller::READABLE)) {
+            LOG_ERROR("Error registering listener " << specs[i].describe() << ": " << strerror(errno));
+            return false;
+        }
+        LOG_INFO("Listening on " << specs[i].describe());
+    }
+
+    // Held in reserve so connections can still be turned away at EMFILE
+    _spareFd.reset(open("/dev/null", O_RDONLY | O_CLOEXEC));
+
+    if (!startExporter() || !startLinks()) {
         return false;
     }
 
-    // Prepare server address
-    memset(&_serverAddr, 0, sizeof(_serverAddr));
-    _serverAddr.sin_family = AF_INET;
-    _serverAddr.sin_addr.s_addr = INADDR_ANY;
-    _serverAddr.sin_port = htons(_port);
+    // Hostname lookups on helper threads, answered through this loop
+    if (_config.dnsThreads > 0) {
+        _resolver = new HostResolver(_config.dnsCacheSize, _config.dnsCacheTtl * 1000, _config.dnsTimeout);
+        if (!_resolver->start(_config.dnsThreads) || !_poller->add(_resolver->notifyFd(), Poller::READABLE)) {
+            LOG_ERROR("Error starting the hostname resolver");
+            return false;
+        }
+    }
 
-    // Bind socket to address
-    if (bind(_serverSocket, (struct sockaddr*)&_serverAddr, sizeof(_serverAddr)) == -1) {
-        std::cerr << "Error binding socket to port " << _port << std::endl;
-        close(_serverSocket);
+    // Threaded mode: client sockets are served by I/O workers
+    if (_config.workerThreads > 0 && !startWorkers(sharded ? specs : std::vector<ListenerSpec>(), inherited)) {
         return false;
     }
 
-    // Start listening
-    if (listen(_serverSocket, 10) == -1) {
-        std::cerr << "Error listening on socket" << std::endl;
-        close(_serverSocket);
+    // Inherited listeners nobody took (the previous process had more
+    // accepting threads) may hold queued connections: accept them here.
+    // Those for addresses no longer configured are closed.
+    for (size_t i = 0; i < inherited.size(); i++) {
+        bool configured = false;
+        for (size_t j = 0; j < specs.size() && !configured; j++) {
+            configured = specs[j].tls == inherited[i].tls && listenerMatches(inherited[i].fd, specs[j]);
+        }
+        if (!configured || !_poller->add(inherited[i].fd, Poller::READABLE)) {
+            close(inherited[i].fd);
+            continue;
+        }
+        _listeners.push_back(inherited[i]);
+    }
+
+    // SIGINT, SIGTERM and SIGUSR2 land here, see notifySignal()
+    if (pipe(_signalPipe) == -1) {
+        LOG_ERROR("Error creating signal pipe: " << strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        setNonBlocking(_signalPipe[i]);
+        fcntl(_signalPipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    if (!_poller->add(_signalPipe[0], Poller::READABLE)) {
+        LOG_ERROR("Error registering signal pipe: " << strerror(errno));
         return false;
     }
 
-    // Add server socket to poll list
-    pollfd serverPollFd;
-    serverPollFd.fd = _serverSocket;
-    serverPollFd.events = POLLIN;
-    _pollfds.push_back(serverPollFd);
+    if (handoff.valid()) {
+        if (!restoreState(snapshot)) {
+            return false;
+        }
+        acknowledgeHandoff(handoff.get());
+        LOG_INFO("Took over " << _clientCount << " client(s) and " << _channels.size()
+                 << " channel(s) from the previous process");
+    }
 
-    std::cout << "Server is listening on port " << _port << std::endl;
+    LOG_INFO("Server is listening on " << specs.size() << " address(es) (" << _poller->name() << " event loop, "
+             << _workers.size() << " I/O threads" << (sharded ? ", accepting in each" : "") << ")");
     return true;
 }
 
-void Server::addClient(int clientFd) {
-    // Create new client and add to map
-    Client* client = new Client(clientFd, this);
-    _clients[clientFd] = client;
-    
-    // Record connection time
-    _connectionTimes[clientFd] = time(NULL);
-    
-    // Add to poll array
-    pollfd clientPollFd;
-    clientPollFd.fd = clientFd;
-    clientPollFd.events = POLLIN;
-    _pollfds.push_back(clientPollFd);
+bool Server::listenerSpecs(std::vector<ListenerSpec>& specs) const {
+    if (!_config.listen.empty()) {
+        if (!parseListenerSpecs(_config.listen, specs)) {
+            return false;
+        }
+        if (specs.empty()) {
+            LOG_ERROR("IRCSERV_LISTEN names no listener");
+            return false;
+        }
+        return true;
+    }
+
+    // Historical setup: the command-line port, plus IRCSERV_TLS_PORT
+    ListenerSpec spec;
+    spec.address = "0.0.0.0";
+    spec.port = _port;
+    spec.tls = false;
+    specs.push_back(spec);
+    if (_config.tlsPort > 0) {
+        spec.port = static_cast<unsigned int>(_config.tlsPort);
+        spec.tls = true;
+        specs.push_back(spec);
+    }
+    return true;
 }
 
-void Server::checkTimeouts() {
-    time_t now = time(NULL);
-    std::vector<int> toRemove;
-    
-    for (std::map<int, time_t>::iterator it = _connectionTimes.begin(); 
-         it != _connectionTimes.end(); ++it) {
-        Client* client = getClient(it->first);
-        if (client && !client->isAuthenticated() && (now - it->second) > 60) {
-            // 60 seconds to complete registration
-            toRemove.push_back(it->first);
+const Server::Listener* Server::findListener(int fd) const {
+    for (size_t i = 0; i < _listeners.size(); i++) {
+        if (_listeners[i].fd == fd) {
+            return &_listeners[i];
         }
     }
-    
-    for (size_t i = 0; i < toRemove.size(); i++) {
-        Client* client = getClient(toRemove[i]);
-        if (client) {
-            client->sendData("ERROR :Registration timeout");
+    return NULL;
+}
+
+bool Server::startWorkers(const std::vector<ListenerSpec>& shards, std::vector<Listener>& inherited) {
+    if (pipe(_notifyPipe) == -1) {
+        LOG_ERROR("Error creating worker notification pipe: " << strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        setNonBlocking(_notifyPipe[i]);
+        fcntl(_notifyPipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    if (!_poller->add(_notifyPipe[0], Poller::READABLE)) {
+        LOG_ERROR("Error registering worker notification pipe: " << strerror(errno));
+        return false;
+    }
+
+    const char* backend = _config.pollerBackend.empty() ? NULL : _config.pollerBackend.c_str();
+    for (size_t i = 0; i < _config.workerThreads; i++) {
+        IoWorker* worker = new IoWorker(static_cast<int>(i), backend, _notifyPipe[1], &_notifyFlag,
+                                        _config.sendqSoftLimit, _config.sendqHardLimit);
+        _workers.push_back(worker);
+        for (size_t j = 0; j < shards.size(); j++) {
+            int fd = takeInherited(inherited, shards[j]);
+            if (fd == -1) {
+                fd = openListener(shards[j], static_cast<int>(_config.listenBacklog), true);
+            }
+            if (fd == -1 || !worker->addListener(fd, shards[j].tls)) {
+                return false;
+            }
+        }
+        if (!worker->start()) {
+            return false;
         }
-        removeClient(toRemove[i]);
     }
+    return true;
 }
 
-// In Server class, add a method to check and remove disconnected clients
-void Server::checkAndRemoveDisconnectedClients() {
-    std::vector<int> clientsToRemove;
+Client* Server::addClient(int clientFd, TlsStream* tls, IoWorker* worker, unsigned long id) {
+    // Create new client and store it in its fd slot (fds are small and
+    // dense, so the table stays compact)
+    if (static_cast<size_t>(clientFd) >= _clients.size()) {
+        _clients.resize(clientFd + 1, NULL);
+    }
+    Client* client = new Client(clientFd, this, id ? id : _nextClientId++);
+    _clients[clientFd] = client;
+    _clientCount++;
+    metricAdd(Metrics::instance().clients, 1);
+    
+    // Dropped unless PASS/NICK/USER complete in time
+    armTimer(client, _now + _config.registrationTimeout * 1000);
     
-    // First, identify clients that need to be removed
-    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->second->isDisconnected()) {
-            clientsToRemove.push_back(it->first);
+    // Threaded mode: hand the socket to the worker that accepted it, or
+    // else to the next one
+    if (!_workers.empty()) {
+        if (!worker) {
+            worker = _workers[_nextWorker];
+            _nextWorker = (_nextWorker + 1) % _workers.size();
         }
+        client->setWorker(worker);
+        worker->attach(clientFd, client->getId(), tls);
+        return client;
     }
+    client->setTls(tls);
     
-    // Then remove them
-    for (size_t i = 0; i < clientsToRemove.size(); i++) {
-        removeClient(clientsToRemove[i]);
+    // Register with the event loop; write interest is only armed while
+    // the client has queued output (see setWriteInterest)
+    if (!_poller->add(clientFd, Poller::READABLE | Poller::EDGE_TRIGGERED)) {
+        LOG_ERROR("Error registering client socket: " << strerror(errno));
+        client->setDisconnected();
     }
+    return client;
+}
+
+void Server::armTimer(Client* client, TimeMs when) {
+    Timer& timer = client->getTimer();
+    timer.context = client;
+    _timers.schedule(&timer, when);
+}
+
+void Server::runTimers() {
+    _expired.clear();
+    _timers.advance(_now, _expired);
+    for (size_t i = 0; i < _expired.size(); i++) {
+        Client* client = static_cast<Client*>(_expired[i]->context);
+        // The client decides what the deadline meant and when to look again
+        TimeMs next = client->onTimer(_now);
+        if (next) {
+            armTimer(client, next);
+        }
+    }
+}
+
+void Server::scheduleRemoval(Client* client) {
+    _dead.push_back(std::make_pair(client->getFd(), client->getId()));
+}
+
+void Server::scheduleBacklog(Client* client) {
+    _backlog.push_back(std::make_pair(client->getFd(), client->getId()));
+}
+
+void Server::runBacklog() {
+    // Clients that used up their line budget go on here, after every
+    // other ready client had its turn; those still over it queue again
+    // for the next iteration
+    std::vector<std::pair<int, unsigned long> > backlog;
+    backlog.swap(_backlog);
+    for (size_t i = 0; i < backlog.size(); i++) {
+        Client* client = getClient(backlog[i].first);
+        if (client && client->getId() == backlog[i].second) {
+            client->resumeInput();
+        }
+    }
+}
+
+void Server::reapDeadClients() {
+    // Clients die during dispatch but are only torn down here, so no
+    // handler ever sees a freed Client or a reused fd mid-iteration.
+    // Removal can kill more clients (QUIT fan-out overflowing a send
+    // queue); they are appended and reaped in the same pass.
+    for (size_t i = 0; i < _dead.size(); i++) {
+        Client* client = getClient(_dead[i].first);
+        if (client && client->getId() == _dead[i].second) {
+            removeClient(_dead[i].first);
+        }
+    }
+    _dead.clear();
 }
 
 void Server::run() {
     while (true) {
-        // Add this block right before poll() to set POLLOUT when needed
-        for (size_t i = 1; i < _pollfds.size(); i++) {
-            Client* client = getClient(_pollfds[i].fd);
-            if (client && client->hasPendingMessages()) {
-                _pollfds[i].events = POLLIN | POLLOUT;  // Enable write notifications
-            } else {
-                _pollfds[i].events = POLLIN;  // Only interested in reads
-            }
+        // Only descriptors with activity are returned by the backend
+        // Sleep no longer than the next timer allows
+        int timeout = _timers.timeoutMs(monotonicMs());
+        if (_links) {
+            timeout = _links->timeoutMs(timeout);
         }
-
-        // Original poll() call remains here
-        int activity = poll(&_pollfds[0], _pollfds.size(), -1);
+        if (!_backlog.empty()) {
+            timeout = 0; // Lines are waiting: only collect what else is ready
+        }
+        int activity = _poller->wait(_events, timeout);
+        _now = monotonicMs();
+        _iteration++;
         
         if (activity < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            std::cerr << "Poll error: " << strerror(errno) << std::endl;
+            LOG_ERROR("Poll error: " << strerror(errno));
             break;
         }
+        metricIncrement(Metrics::instance().pollWakeups);
+        Metrics::instance().pollReadyFds.record(_events.size());
         
-        // Rest of your existing code remains exactly the same
-        if (_pollfds[0].revents & POLLIN) {
-            handleNewConnection();
-        }
-        
-        for (size_t i = 1; i < _pollfds.size(); i++) {
-            int fd = _pollfds[i].fd;
+        bool restart = false;
+        bool shutdown = false;
+        for (size_t i = 0; i < _events.size(); i++) {
+            int fd = _events[i].fd;
+            unsigned int events = _events[i].events;
             
-            if (_pollfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
-                Client* client = getClient(fd);
-                if (client) {
-                    client->setDisconnected();
+            // Not a client: worker, resolver or signal notifications, a
+            // listener, a server link, the metrics listener or one of its scrapes
+            Client* client = getClient(fd);
+            if (!client) {
+                const Listener* listener = findListener(fd);
+                if (fd == _notifyPipe[0]) {
+                    handleWorkerEvents();
+                } else if (fd == _signalPipe[0]) {
+                    char signals[16];
+                    ssize_t count;
+                    while ((count = read(_signalPipe[0], signals, sizeof(signals))) > 0) {
+                        for (ssize_t j = 0; j < count; j++) {
+                            if (signals[j] == SIGUSR2) {
+                                restart = true;
+                            } else {
+                                shutdown = true;
+                            }
+                        }
+                    }
+                } else if (_resolver && fd == _resolver->notifyFd()) {
+                    handleResolverEvents();
+                } else if (listener) {
+                    handleNewConnection(*listener);
+                } else if ((!_links || !_links->handleEvent(fd, events)) && _exporter) {
+                    _exporter->handleEvent(fd, events);
                 }
                 continue;
             }
             
-            if (_pollfds[i].revents & POLLIN) {
+            if (events & Poller::ERROR) {
+                client->setDisconnected();
+                continue;
+            }
+            
+            if (events & Poller::READABLE) {
                 handleClientData(fd);
             }
             
-            if (_pollfds[i].revents & POLLOUT) {
-                Client* client = getClient(fd);
-                if (client) {
-                    client->sendPendingData();
-                }
+            if (events & Poller::WRITABLE) {
+                client->sendPendingData();
             }
         }
         
-        checkAndRemoveDisconnectedClients();
+        runBacklog();
+        runTimers();
+        if (_links) {
+            _links->tick();
+            _links->reap();
+        }
+        reapDeadClients();
+        
+        // Write out everything queued during this iteration
+        flushPendingOutput();
+        if (_links) {
+            _links->flush();
+        }
+        wakeWorkers();
+        
+        // Between iterations, with nothing half done; a restart that fails
+        // at any step leaves this process serving
+        if (shutdown) {
+            shutDown();
+            return;
+        }
+        if (restart && hotRestart()) {
+            return;
+        }
+    }
+}
+
+void Server::handleWorkerEvents() {
+    // Re-arm before draining so a worker posting concurrently wakes us again
+    char buffer[64];
+    while (read(_notifyPipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+    __atomic_store_n(&_notifyFlag, 0, __ATOMIC_RELEASE);
+    
+    WorkerEvent event;
+    for (size_t i = 0; i < _workers.size(); i++) {
+        while (_workers[i]->pollEvent(event)) {
+            if (event.type == WorkerEvent::ACCEPTED) {
+                // Sharded listener: the socket stays with the worker that
+                // accepted it
+                admitConnection(event.fd, event.sourceKey, event.data, event.tls, _workers[i]);
+                continue;
+            }
+            Client* client = getClient(event.fd);
+            if (!client || client->getId() != event.id) {
+                continue; // Stale event for a connection that is already gone
+            }
+            if (event.type == WorkerEvent::DATA) {
+                client->receiveBytes(event.data.data(), event.data.size());
+            } else {
+                client->setDisconnected();
+            }
+        }
+    }
+}
+
+void Server::handleResolverEvents() {
+    std::vector<HostResolver::Answer> answers;
+    _resolver->collect(_now, answers);
+    for (size_t i = 0; i < answers.size(); i++) {
+        Client* client = getClient(answers[i].fd);
+        if (client && client->getId() == answers[i].id) {
+            client->hostnameResolved(answers[i].hostname);
+        }
+    }
+}
+
+void Server::wakeWorkers() {
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->wake();
     }
 }
 
@@ -244,11 +590,12 @@ void Server::run() {
 // }
 
 void Server::stop() {
-    // Close server socket
-    if (_serverSocket != -1) {
-        close(_serverSocket);
-        _serverSocket = -1;
+    // Close the listeners polled by this loop
+    for (size_t i = 0; i < _listeners.size(); i++) {
+        _poller->remove(_listeners[i].fd);
+        close(_listeners[i].fd);
     }
+    _listeners.clear();
 }
 
 // void Server::addClient(int clientFd) {
@@ -264,83 +611,108 @@ void Server::stop() {
 // }
 
 void Server::removeClient(int clientFd) {
-    std::map<int, Client*>::iterator it = _clients.find(clientFd);
-    if (it != _clients.end()) {
-        // Get client's channels before deletion
-        const std::vector<Channel*>& channels = it->second->getChannels();
+    Client* client = getClient(clientFd);
+    if (client) {
+        Payload quit = (LineBuilder() << ":" << client->getPrefix() << " QUIT :Connection closed").frame();
+        detachClient(client, quit);
         
-        // Make a copy since the vector will be modified during channel operations
-        std::vector<Channel*> channelsCopy(channels.begin(), channels.end());
+        // Linked servers only ever heard of registered users
+        if (_links && client->isAuthenticated()) {
+            _links->propagate(quit);
+        }
         
-        // Notify each channel about the client leaving
-        for (std::vector<Channel*>::iterator chanIt = channelsCopy.begin(); 
-             chanIt != channelsCopy.end(); ++chanIt) {
-            
-            Channel* channel = *chanIt;
-            // Broadcast quit message to channel members
-            channel->broadcastMessage(":" + it->second->getNickname() + 
-                                   "!" + it->second->getUsername() + 
-                                   "@host QUIT :Connection closed");
-            
-            // Remove client from channel
-            it->second->leaveChannel(channel);
-            
-            // If channel becomes empty, remove it
-            if (channel->getClients().empty()) {
-                removeChannel(channel->getName());
-            }
+        // Last chance for pending output such as an ERROR line
+        client->flushBeforeClose();
+        
+        // Threaded mode: the owning worker flushes and closes the socket;
+        // otherwise the Client owns it and closes it on deletion
+        IoWorker* worker = client->getWorker();
+        if (worker) {
+            worker->release(clientFd, client->getId());
+        } else {
+            _poller->remove(clientFd);
         }
         
-        // Delete client object
-        delete it->second;
-        _clients.erase(it);
+        // Delete client object and free its slot
+        _throttle.release(client->getSourceKey());
+        delete client;
+        _clients[clientFd] = NULL;
+        _clientCount--;
+        metricAdd(Metrics::instance().clients, -1);
     }
+}
+
+void Server::detachClient(Client* client, const Payload& quit) {
+    // Get client's channels before deletion
+    const std::vector<Channel*>& channels = client->getChannels();
     
-    // Close socket
-    close(clientFd);
+    // Make a copy since the vector will be modified during channel operations
+    std::vector<Channel*> channelsCopy(channels.begin(), channels.end());
     
-    // Remove from poll array
-    for (size_t i = 0; i < _pollfds.size(); i++) {
-        if (_pollfds[i].fd == clientFd) {
-            _pollfds.erase(_pollfds.begin() + i);
-            break;
+    // Notify each channel about the client leaving
+    for (std::vector<Channel*>::iterator chanIt = channelsCopy.begin(); 
+         chanIt != channelsCopy.end(); ++chanIt) {
+        
+        Channel* channel = *chanIt;
+        // Broadcast quit message to channel members
+        channel->broadcastPayload(quit, NULL);
+        
+        // Remove client from channel
+        client->leaveChannel(channel);
+        
+        // If channel becomes empty, remove it
+        if (channel->getClients().empty()) {
+            removeChannel(channel->getName());
         }
     }
+    
+    // Free the nickname for reuse
+    if (!client->getNickname().empty() && findClient(client->getNickname()) == client) {
+        _nicknames.erase(client->getNickname());
+    }
 }
 
-Client* Server::getClient(int clientFd) {
-    std::map<int, Client*>::iterator it = _clients.find(clientFd);
-    if (it != _clients.end()) {
-        return it->second;
+bool Server::claimNickname(Client* client, const std::string& nickname) {
+    Client* owner = findClient(nickname);
+    if (owner && owner != client) {
+        return false;
     }
-    return NULL;
+    // Re-key even for a case-only change, so the index keeps the new spelling
+    if (!client->getNickname().empty()) {
+        _nicknames.erase(client->getNickname());
+    }
+    _nicknames.insert(nickname, client);
+    return true;
 }
 
 Channel* Server::getChannel(const std::string& name) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(name);
-    if (it != _channels.end()) {
-        return it->second;
-    }
-    return NULL;
+    return _channels.find(name);
 }
 
 Channel* Server::createChannel(const std::string& name, Client* creator) {
     // Check if channel already exists
-    if (_channels.find(name) != _channels.end()) {
-        return _channels[name];
+    Channel* channel = _channels.find(name);
+    if (channel) {
+        return channel;
     }
     
     // Create new channel
-    Channel* channel = new Channel(name, creator);
-    _channels[name] = channel;
+    channel = new Channel(name, creator, _config.historyLines);
+    _channels.insert(name, channel);
+    metricAdd(Metrics::instance().channels, 1);
     return channel;
 }
 
+void Server::recordHistory(Channel* channel, const Payload& line) {
+    channel->getHistory().record(line, _historyBudget);
+}
+
 void Server::removeChannel(const std::string& name) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(name);
-    if (it != _channels.end()) {
-        delete it->second;
-        _channels.erase(it);
+    Channel* channel = _channels.find(name);
+    if (channel) {
+        _channels.erase(name);
+        delete channel;
+        metricAdd(Metrics::instance().channels, -1);
     }
 }
 
@@ -348,54 +720,91 @@ bool Server::checkPassword(const std::string& password) const {
     return password == _password;
 }
 
-void Server::handleNewConnection() {
-    struct sockaddr_in clientAddr;
-    socklen_t clientAddrLen = sizeof(clientAddr);
-    
-    // Accept new connection
-    int clientFd = accept(_serverSocket, (struct sockaddr*)&clientAddr, &clientAddrLen);
-    
-    if (clientFd < 0) {
-    // Handle EAGAIN/EWOULDBLOCK separately as they're expected for non-blocking sockets
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        return; // No connections available, not an error
+void Server::handleNewConnection(const Listener& listener) {
+    // Drain the listen queue: under a reconnect storm one accept per
+    // wakeup cannot keep up with the backlog
+    for (size_t accepted = 0; accepted < ACCEPT_BATCH; accepted++) {
+        struct sockaddr_storage clientAddr;
+        int clientFd = acceptSocket(listener.fd, clientAddr);
+        
+        if (clientFd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue; // The peer gave up while queued; try the next one
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return; // Queue drained
+            }
+            if ((errno == EMFILE || errno == ENFILE) && _spareFd.valid()) {
+                // Out of descriptors: shed one queued connection through the
+                // reserve fd rather than spinning on a readable listener
+                LOG_WARNING("Error accepting connection: " << strerror(errno));
+                _spareFd.reset();
+                UniqueFd shed(acceptSocket(listener.fd, clientAddr));
+                shed.reset();
+                _spareFd.reset(open("/dev/null", O_RDONLY | O_CLOEXEC));
+                return;
+            }
+            LOG_ERROR("Error accepting connection: " << strerror(errno));
+            return;
+        }
+        admitConnection(clientFd, sourceKeyOf(clientAddr), formatAddress(clientAddr), listener.tls, NULL);
     }
-    std::cerr << "Error accepting connection: " << strerror(errno) << std::endl;
-    return;
 }
-    
-    // Set non-blocking mode
-    if (!setNonBlocking(clientFd)) {
-        std::cerr << "Error setting client socket to non-blocking mode" << std::endl;
-        close(clientFd);
+
+void Server::admitConnection(int clientFd, unsigned long sourceKey, const std::string& host, bool tls,
+                             IoWorker* worker) {
+    // Checked before any per-client state is allocated
+    ConnectionThrottle::Verdict verdict = _throttle.admit(sourceKey, _now);
+    if (verdict != ConnectionThrottle::ACCEPT) {
+        metricIncrement(Metrics::instance().connectionsRejected);
+        LOG_DEBUG("Throttled connection from " << host);
+        rejectSocket(clientFd, verdict == ConnectionThrottle::REJECT_RATE
+                               ? "Trying to reconnect too fast"
+                               : "Too many connections from your host");
         return;
     }
     
-    std::cout << "New connection accepted" << std::endl;
+    // The handshake runs in the socket's owner, like any other I/O
+    TlsStream* stream = NULL;
+    if (tls) {
+        stream = _tlsContext->accept(clientFd);
+        if (!stream) {
+            _throttle.release(sourceKey);
+            close(clientFd);
+            return;
+        }
+    }
+    
+    LOG_INFO("New connection accepted on fd " << clientFd << " from " << host << (tls ? " (TLS)" : ""));
+    metricIncrement(Metrics::instance().connectionsAccepted);
+    Client* client = addClient(clientFd, stream, worker);
+    client->setSecure(tls);
+    client->setSourceKey(sourceKey);
+    client->setHostname(host);
     
-    // Add new client
-    addClient(clientFd);
+    // Reverse DNS: the cache answers at once, or the client keeps its
+    // address until the lookup does (see Client::awaitHostname)
+    std::string hostname;
+    if (_resolver) {
+        if (_resolver->lookup(host, clientFd, client->getId(), _now, hostname)) {
+            client->setHostname(hostname);
+        } else {
+            client->awaitHostname(_now + _config.dnsTimeout);
+        }
+    }
 }
 
 void Server::handleClientData(int clientFd) {
     Client* client = getClient(clientFd);
     if (!client) {
-        std::cerr << "Client not found" << std::endl;
+        LOG_ERROR("Client not found");
         return;
     }
     
-    // Let client handle incoming data
+    // Let client handle incoming data; a closed or failed socket is
+    // reclaimed with the other dead clients after dispatch
     if (!client->receiveData()) {
-        // Client disconnected or error
-        removeClient(clientFd);
-        
-        // Remove from poll array
-        for (size_t i = 0; i < _pollfds.size(); i++) {
-            if (_pollfds[i].fd == clientFd) {
-                _pollfds.erase(_pollfds.begin() + i);
-                break;
-            }
-        }
+        client->setDisconnected();
     }
 }
 
@@ -405,4 +814,391 @@ bool Server::setNonBlocking(int fd) {
         return false;
     }
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
-}
\ No newline at end of file
+}
+
+void Server::setWriteInterest(int fd, bool enabled) {
+    unsigned int events = Poller::READABLE | Poller::EDGE_TRIGGERED;
+    if (enabled) {
+        events |= Poller::WRITABLE;
+    }
+    _poller->modify(fd, events);
+}
+
+void Server::scheduleFlush(Client* client) {
+    _pendingFlush.push_back(std::make_pair(client->getFd(), client->getId()));
+}
+
+void Server::flushPendingOutput() {
+    // Clients may have been removed since they were scheduled
+    for (size_t i = 0; i < _pendingFlush.size(); i++) {
+        Client* client = getClient(_pendingFlush[i].first);
+        if (client && client->getId() == _pendingFlush[i].second) {
+            client->sendPendingData();
+        }
+    }
+    _pendingFlush.clear();
+}
+void Server::setCommandLine(char* argv[]) {
+    _commandLine.clear();
+    for (size_t i = 0; argv[i]; i++) {
+        _commandLine.push_back(argv[i]);
+    }
+}
+
+bool Server::notifySignal(int signum) {
+    // Signal handler context: the pipe write is all that is safe here
+    if (_signalPipe[1] == -1) {
+        return false;
+    }
+    char byte = static_cast<char>(signum);
+    ssize_t ret = write(_signalPipe[1], &byte, 1);
+    (void)ret; // Full pipe: plenty of signals are pending already
+    return true;
+}
+
+void Server::shutDown() {
+    LOG_INFO("Shutting down, " << _clientCount << " client(s) connected");
+    TimeMs deadline = monotonicMs() + _config.shutdownTimeout;
+
+    // Stop accepting: client listeners here and in the workers (below),
+    // server links, metrics scrapes; lookups still running are not waited for
+    stop();
+    if (_links) {
+        _links->closeAll("Server shutting down");
+        delete _links;
+        _links = NULL;
+    }
+    delete _exporter;
+    _exporter = NULL;
+    if (_resolver) {
+        _poller->remove(_resolver->notifyFd());
+    }
+    _backlog.clear();
+
+    // Everyone gets told, then all queues drain side by side
+    for (size_t fd = 0; fd < _clients.size(); fd++) {
+        Client* client = _clients[fd];
+        if (!client || client->getLink() || client->isDisconnected()) {
+            continue;
+        }
+        if (client->isHandshaking()) {
+            client->setDisconnected();
+            continue;
+        }
+        client->sendData("NOTICE " + (client->isAuthenticated() ? client->getNickname() : std::string("*"))
+                         + " :Server shutting down");
+        client->sendData("ERROR :Closing Link: " + client->getHostname() + " (Server shutting down)");
+    }
+    flushPendingOutput();
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->drain();
+        _workers[i]->wake();
+    }
+
+    while (!outputDrained()) {
+        TimeMs now = monotonicMs();
+        if (now >= deadline) {
+            LOG_WARNING("Shutdown timeout reached, dropping the output still queued");
+            return;
+        }
+        if (_poller->wait(_events, static_cast<int>(deadline - now)) < 0 && errno != EINTR) {
+            LOG_ERROR("Poll error: " << strerror(errno));
+            return;
+        }
+        for (size_t i = 0; i < _events.size(); i++) {
+            int fd = _events[i].fd;
+            unsigned int events = _events[i].events;
+            if (fd == _notifyPipe[0]) {
+                discardWorkerEvents();
+                continue;
+            }
+            if (fd == _signalPipe[0]) {
+                LOG_INFO("Signal received again, not waiting for the send queues");
+                return;
+            }
+            // Only writes are of interest now
+            Client* client = getClient(fd);
+            if (!client) {
+                continue;
+            }
+            if (events & Poller::ERROR) {
+                client->setDisconnected();
+            } else if ((events & Poller::WRITABLE) && client->hasPendingMessages()) {
+                client->sendPendingData();
+            }
+        }
+    }
+    LOG_INFO("All output delivered, shutting down");
+}
+
+bool Server::outputDrained() const {
+    for (size_t i = 0; i < _workers.size(); i++) {
+        if (!_workers[i]->drained()) {
+            return false;
+        }
+    }
+    for (size_t fd = 0; fd < _clients.size(); fd++) {
+        const Client* client = _clients[fd];
+        if (client && !client->isDisconnected() && client->hasPendingMessages()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Server::discardWorkerEvents() {
+    // Draining workers no longer read; what they still report is moot,
+    // except for sockets accepted just before DRAIN, which are ours to close
+    char buffer[64];
+    while (read(_notifyPipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+    __atomic_store_n(&_notifyFlag, 0, __ATOMIC_RELEASE);
+
+    WorkerEvent event;
+    for (size_t i = 0; i < _workers.size(); i++) {
+        while (_workers[i]->pollEvent(event)) {
+            if (event.type == WorkerEvent::ACCEPTED) {
+                close(event.fd);
+            }
+        }
+    }
+}
+
+bool Server::hotRestart() {
+    if (_commandLine.empty()) {
+        LOG_ERROR("Hot restart needs the command line, ignoring the request");
+        return false;
+    }
+    LOG_INFO("Hot restart: starting " << _commandLine[0]);
+    pid_t pid = 0;
+    UniqueFd handoff(spawnSuccessor(_commandLine, static_cast<int>(_config.restartTimeout), pid));
+    if (!handoff.valid()) {
+        return false;
+    }
+
+    // The new process is up and waiting: settle everything in flight.
+    // Workers stop first and hand back their last events, then run what
+    // those queued on this thread. Until the new process confirms, this
+    // one keeps every socket and all of its state, see abandonRestart().
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->stop();
+    }
+    handleWorkerEvents();
+
+    // Links cannot be resumed mid-stream: the new process connects and
+    // bursts again. The metrics port is bound again too.
+    if (_links) {
+        _links->closeAll("Restarting");
+        delete _links;
+        _links = NULL;
+    }
+    delete _exporter;
+    _exporter = NULL;
+
+    // Neither can TLS sessions, whose keys live in this process
+    for (size_t fd = 0; fd < _clients.size(); fd++) {
+        Client* client = _clients[fd];
+        if (client && client->isSecure() && !client->isDisconnected()) {
+            client->sendData("ERROR :Server restarting, please reconnect");
+            client->setDisconnected();
+        }
+    }
+    reapDeadClients();
+    flushPendingOutput();
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->finish();
+    }
+
+    SnapshotWriter snapshot;
+    saveState(snapshot);
+    if (!snapshot.send(handoff.get())) {
+        abandonRestart(pid);
+        return false;
+    }
+    if (!awaitAcknowledgement(handoff.get(), static_cast<int>(_config.restartTimeout))) {
+        LOG_ERROR("Process " << pid << " did not confirm the handoff");
+        abandonRestart(pid);
+        return false;
+    }
+    LOG_INFO("Handed over " << _clientCount << " client(s) and " << _channels.size() << " channel(s) ("
+             << snapshot.size() << " bytes, " << snapshot.fdCount() << " descriptors) to process " << pid);
+    return true;
+}
+
+void Server::abandonRestart(pid_t pid) {
+    // The snapshot only carried duplicates: every socket is still ours.
+    // Whatever the new process read before it died is lost with it.
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    LOG_ERROR("Hot restart abandoned, carrying on in this process");
+
+    for (size_t i = 0; i < _workers.size(); i++) {
+        if (!_workers[i]->start()) {
+            LOG_ERROR("Worker " << i << " could not be restarted");
+        }
+    }
+    // Links reconnect and burst as after startup; a port the new process
+    // held a moment ago may fail to bind, which only loses that service
+    if (!startExporter()) {
+        delete _exporter;
+        _exporter = NULL;
+    }
+    if (!startLinks()) {
+        delete _links;
+        _links = NULL;
+    }
+}
+
+void Server::saveState(SnapshotWriter& out) {
+    out.putU32(SNAPSHOT_VERSION);
+    out.putU64(_nextClientId);
+    out.putU64(_historyBudget.peekEntryId());
+
+    // Listeners, including the ones the workers accept on
+    std::vector<std::pair<int, bool> > listeners;
+    for (size_t i = 0; i < _listeners.size(); i++) {
+        listeners.push_back(std::make_pair(_listeners[i].fd, _listeners[i].tls));
+    }
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->listeners(listeners);
+    }
+    out.putU32(static_cast<unsigned int>(listeners.size()));
+    for (size_t i = 0; i < listeners.size(); i++) {
+        out.putFd(listeners[i].first);
+        out.putU8(listeners[i].second ? 1 : 0);
+    }
+
+    std::vector<Client*> clients;
+    for (size_t fd = 0; fd < _clients.size(); fd++) {
+        if (_clients[fd] && !_clients[fd]->getLink()) {
+            clients.push_back(_clients[fd]);
+        }
+    }
+    out.putU32(static_cast<unsigned int>(clients.size()));
+    for (size_t i = 0; i < clients.size(); i++) {
+        out.putFd(clients[i]->getFd());
+        out.putU64(clients[i]->getId());
+        clients[i]->saveState(out);
+    }
+
+    // Members by client id, in join order; the first one creates the channel
+    std::vector<Channel*> channels;
+    _channels.values(channels);
+    out.putU32(static_cast<unsigned int>(channels.size()));
+    for (size_t i = 0; i < channels.size(); i++) {
+        Channel* channel = channels[i];
+        out.putString(channel->getName());
+        const std::vector<Client*>& members = channel->getClients();
+        out.putU32(static_cast<unsigned int>(members.size()));
+        for (size_t j = 0; j < members.size(); j++) {
+            out.putU64(members[j]->getId());
+            out.putU8(channel->isOperator(members[j]) ? Channel::MEMBER_OPERATOR : 0);
+        }
+        channel->saveState(out);
+    }
+}
+
+bool Server::receiveHandoff(int socket, SnapshotReader& in, std::vector<Listener>& inherited) {
+    if (!in.receive(socket, static_cast<int>(_config.restartTimeout))) {
+        return false;
+    }
+    unsigned int version = in.getU32();
+    if (version != SNAPSHOT_VERSION) {
+        LOG_ERROR("Restart snapshot version " << version << " is not supported (expected "
+                  << SNAPSHOT_VERSION << ")");
+        return false;
+    }
+    _nextClientId = static_cast<unsigned long>(in.getU64());
+    _historyBudget.reserveEntryIds(static_cast<unsigned long>(in.getU64()));
+    size_t count = in.getU32();
+    for (size_t i = 0; i < count && !in.failed(); i++) {
+        Listener listener;
+        listener.fd = in.takeFd();
+        listener.tls = in.getU8() != 0;
+        if (listener.fd != -1) {
+            inherited.push_back(listener);
+        }
+    }
+    if (in.failed()) {
+        LOG_ERROR("Corrupt restart snapshot");
+        return false;
+    }
+    return true;
+}
+
+bool Server::restoreState(SnapshotReader& in) {
+    FlatMap<unsigned long, Client*> byId;
+    std::vector<std::pair<Client*, std::string> > inputs;
+
+    size_t clients = in.getU32();
+    for (size_t i = 0; i < clients && !in.failed(); i++) {
+        int fd = in.takeFd();
+        unsigned long id = static_cast<unsigned long>(in.getU64());
+        if (in.failed()) {
+            break;
+        }
+        Client* client = addClient(fd, NULL, NULL, id);
+        std::string input;
+        if (!client->restoreState(in, input)) {
+            LOG_ERROR("Restart snapshot: cannot restore client " << id);
+            return false;
+        }
+        _throttle.adopt(client->getSourceKey());
+        byId.insert(id, client);
+        if (!input.empty()) {
+            inputs.push_back(std::make_pair(client, input));
+        }
+    }
+
+    size_t channels = in.getU32();
+    for (size_t i = 0; i < channels && !in.failed(); i++) {
+        std::string name = in.getString();
+        size_t members = in.getU32();
+        Channel* channel = NULL;
+        for (size_t j = 0; j < members && !in.failed(); j++) {
+            Client* const* member = byId.find(static_cast<unsigned long>(in.getU64()));
+            unsigned int flags = in.getU8();
+            if (!member || in.failed()) {
+                LOG_ERROR("Restart snapshot: unknown member in " << name);
+                return false;
+            }
+            if (!channel) {
+                channel = createChannel(name, *member);
+            }
+            (*member)->joinChannel(channel);
+            if (flags & Channel::MEMBER_OPERATOR) {
+                channel->addOperator(*member);
+            } else {
+                channel->removeOperator(*member);
+            }
+        }
+        if (!channel || !channel->restoreState(in, _historyBudget)) {
+            break;
+        }
+    }
+    if (in.failed() || !in.done()) {
+        LOG_ERROR("Corrupt restart snapshot");
+        return false;
+    }
+
+    // Lines received but not run yet: now that every client and channel
+    // they may refer to exists
+    for (size_t i = 0; i < inputs.size(); i++) {
+        inputs[i].first->receiveBytes(inputs[i].second.data(), inputs[i].second.size());
+    }
+
+    // Threaded mode: the sockets are only served once attached
+    wakeWorkers();
+    return true;
+}
+
+int Server::takeInherited(std::vector<Listener>& inherited, const ListenerSpec& spec) {
+    for (size_t i = 0; i < inherited.size(); i++) {
+        if (inherited[i].tls == spec.tls && listenerMatches(inherited[i].fd, spec)) {
+            int fd = inherited[i].fd;
+            inherited.erase(inherited.begin() + i);
+            return fd;
+        }
+    }
+    return -1;
+}
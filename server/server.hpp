@@ -11,51 +11,159 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <ctime>
+#include "config.hpp"
+#include "../eventloop/poller.hpp"
+#include "../utils/nametable.hpp"
+#include "../timers/timerwheel.hpp"
+#include "throttle.hpp"
+#include "../utils/uniquefd.hpp"
+#include "../buffers/payload.hpp"
+#include "../history/history.hpp"
 
 class Client;
 class Channel;
+class IoWorker;
+class MetricsExporter;
+class LinkManager;
+class TlsContext;
+class TlsStream;
+class HostResolver;
+class SnapshotWriter;
+class SnapshotReader;
+
+struct ListenerSpec;
 
 class Server {
 private:
-    int                     _serverSocket;      // Server socket fd
-    struct sockaddr_in      _serverAddr;        // Server address
+    // Client listener polled by the main loop (sharded listeners belong
+    // to the I/O workers instead)
+    struct Listener {
+        int         fd;
+        bool        tls;
+    };
+
+    std::vector<Listener>   _listeners;         // Few: searched linearly
+    TlsContext*             _tlsContext;        // Certificate and session settings of the TLS listeners
     unsigned int            _port;              // Server port
     std::string             _password;          // Connection password
-    std::vector<pollfd>     _pollfds;           // Collection of file descriptors for poll()
-    std::map<int, Client*>  _clients;           // Connected clients (fd -> Client)
-    std::map<std::string, Channel*> _channels;  // Available channels (name -> Channel)
-    std::map<int, time_t> _connectionTimes;  // Track when clients connected
+    ServerConfig            _config;            // Startup tunables
+    Poller*                 _poller;            // Event-loop backend (epoll/kqueue/poll)
+    std::vector<PollEvent>  _events;            // Ready descriptors of the current iteration
+    TimerWheel              _timers;            // Registration, keepalive and idle deadlines
+    std::vector<Timer*>     _expired;           // Timers fired in the current iteration
+    TimeMs                  _now;               // Monotonic time of the current iteration
+    UniqueFd                _spareFd;           // Reserve descriptor for shedding connections at EMFILE
+    ConnectionThrottle      _throttle;          // Per-address connection rate and concurrency limits
+    std::vector<Client*>    _clients;           // Connected clients, indexed by fd (NULL = free slot)
+    size_t                  _clientCount;       // Number of occupied slots in _clients
+    NameTable<Client>       _nicknames;         // Nickname index, RFC 1459 case-folded
+    unsigned long           _deliveryMark;      // Last mark handed out by nextDeliveryMark()
+    NameTable<Channel>      _channels;          // Available channels, RFC 1459 case-folded
+    unsigned long           _nextClientId;      // Unique id for the next accepted client
+    std::vector<IoWorker*>  _workers;           // Socket I/O threads (threaded mode only)
+    size_t                  _nextWorker;        // Round-robin cursor for new connections
+    int                     _notifyPipe[2];     // Workers -> main loop wakeup
+    int                     _notifyFlag;        // Set while a wakeup byte is in flight
+    std::vector<std::pair<int, unsigned long> > _pendingFlush; // Clients (fd, id) with corked output
+    std::vector<std::pair<int, unsigned long> > _dead;  // Disconnected clients (fd, id) awaiting removal
+    std::vector<std::pair<int, unsigned long> > _backlog; // Clients (fd, id) with lines past the per-wakeup budget
+    unsigned long           _iteration;         // Event loop iterations so far
+    MetricsExporter*        _exporter;          // Prometheus endpoint (NULL when disabled)
+    LinkManager*            _links;             // Server-to-server links (NULL when disabled)
+    HostResolver*           _resolver;          // Client hostname lookups (NULL when disabled)
+    HistoryBudget           _historyBudget;     // Memory bound over every channel's history
+    std::vector<std::string> _commandLine;      // argv, run again for a hot restart
+    int                     _signalPipe[2];     // Signal handler -> main loop: one byte per signal received
      bool _disconnected;
 
 public:
-    Server(unsigned int port, const std::string& password);
+    Server(unsigned int port, const std::string& password,
+           const ServerConfig& config = ServerConfig());
     ~Server();
 
-    void checkAndRemoveDisconnectedClients();
+    void reapDeadClients();
     // Prevent copying
     Server(const Server& other);
     Server& operator=(const Server& other);
 
     // Server operations
     bool setup();
+    bool startExporter();
+    bool startLinks();
     void run();
     void stop();
+    // Async-signal-safe: hands `signum` to the event loop, which restarts
+    // (SIGUSR2) or shuts down; false if the loop cannot take signals yet
+    bool notifySignal(int signum);
+
+    // Shutdown (SIGINT/SIGTERM): stop accepting, tell every client, and
+    // give the send queues IRCSERV_SHUTDOWN_TIMEOUT to drain; run() then
+    // returns and the destructor tears down the rest
+    void shutDown();
+    bool outputDrained() const;
+    void discardWorkerEvents();
+
+    // Hot restart (SIGUSR2): start `argv` again and hand it every listener,
+    // client and channel; run() returns once the new process took over.
+    void setCommandLine(char* argv[]);
+    bool hotRestart();
+    void abandonRestart(pid_t pid);
+    void saveState(SnapshotWriter& out);
+    bool receiveHandoff(int socket, SnapshotReader& in, std::vector<Listener>& inherited);
+    bool restoreState(SnapshotReader& in);
+    int takeInherited(std::vector<Listener>& inherited, const ListenerSpec& spec);
 
     // Client operations
-    void addClient(int clientFd);
+    // `id` 0 allocates a fresh one; hot restart keeps the previous ones
+    Client* addClient(int clientFd, TlsStream* tls = NULL, IoWorker* worker = NULL, unsigned long id = 0);
     void removeClient(int clientFd);
-    Client* getClient(int clientFd);
+    void detachClient(Client* client, const Payload& quit);
+    Client* getClient(int clientFd) {
+        // Hot path: called for every readiness event
+        if (clientFd < 0 || static_cast<size_t>(clientFd) >= _clients.size()) {
+            return NULL;
+        }
+        return _clients[clientFd];
+    }
+    size_t getClientCount() const { return _clientCount; }
+    Client* findClient(const std::string& nickname) const { return _nicknames.find(nickname); }
+    bool claimNickname(Client* client, const std::string& nickname);
+    unsigned long allocateClientId() { return _nextClientId++; }
+    void listUsers(std::vector<Client*>& out) const { _nicknames.values(out); }
+    // Fresh stamp for de-duplicating the recipients of one fan-out
+    unsigned long nextDeliveryMark() { return ++_deliveryMark; }
     
     // Channel operations
     Channel* getChannel(const std::string& name);
     Channel* createChannel(const std::string& name, Client* creator);
     void removeChannel(const std::string& name);
+    void listChannels(std::vector<Channel*>& out) const { _channels.values(out); }
+    // PRIVMSG/NOTICE broadcast to `channel`, kept for CHATHISTORY
+    void recordHistory(Channel* channel, const Payload& line);
+
+    // Server links, NULL unless configured
+    LinkManager* getLinks() const { return _links; }
 
     // Password verification
     bool checkPassword(const std::string& password) const;
-    void handleNewConnection();
+    bool listenerSpecs(std::vector<ListenerSpec>& specs) const;
+    const Listener* findListener(int fd) const;
+    void handleNewConnection(const Listener& listener);
+    void admitConnection(int clientFd, unsigned long sourceKey, const std::string& host, bool tls,
+                         IoWorker* worker);
     void handleClientData(int clientFd);
     bool setNonBlocking(int fd);
+    void setWriteInterest(int fd, bool enabled);
+    void scheduleFlush(Client* client);
+    void scheduleRemoval(Client* client);
+    void scheduleBacklog(Client* client);
+    void runBacklog();
+    unsigned long iteration() const { return _iteration; }
+    void flushPendingOutput();
+    bool startWorkers(const std::vector<ListenerSpec>& shards, std::vector<Listener>& inherited);
+    void handleWorkerEvents();
+    void handleResolverEvents();
+    void wakeWorkers();
     bool isDisconnected() const {
         return _disconnected;
     }
@@ -63,8 +171,11 @@ public:
     void setDisconnected() {
         _disconnected = true;
     }
-    void checkTimeouts();
-    pollfd* getPollfd(int fd);
+    // Timers
+    TimeMs now() const { return _now; }
+    const ServerConfig& getConfig() const { return _config; }
+    void armTimer(Client* client, TimeMs when);
+    void runTimers();
     // Helper functions
 };
 
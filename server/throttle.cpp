@@ -0,0 +1,103 @@
+#include "throttle.hpp"
+
+namespace {
+
+// How often idle sources are looked at for removal
+const TimeMs SWEEP_INTERVAL_MS = 10000;
+
+} // namespace
+
+ConnectionThrottle::ConnectionThrottle(size_t maxConnections, size_t perMinute, size_t burst)
+    : _maxConnections(maxConnections), _interval(perMinute ? 60000 / perMinute : 0),
+      _tolerance(0), _nextSweep(0) {
+    if (perMinute && _interval == 0) {
+        _interval = 1; // More than one per millisecond: as good as unlimited
+    }
+    if (burst > 1) {
+        _tolerance = _interval * (burst - 1);
+    }
+}
+
+void ConnectionThrottle::markIdle(unsigned long key, Source& source) {
+    if (!source.idleListed) {
+        source.idleListed = true;
+        _idle.push_back(key);
+    }
+}
+
+void ConnectionThrottle::sweep(TimeMs now) {
+    _nextSweep = now + SWEEP_INTERVAL_MS;
+    size_t kept = 0;
+    for (size_t i = 0; i < _idle.size(); i++) {
+        Source* source = _sources.find(_idle[i]);
+        if (!source) {
+            continue;
+        }
+        if (source->connections > 0) {
+            source->idleListed = false; // Re-listed when it drops to zero again
+            continue;
+        }
+        if (source->arrival <= now) {
+            _sources.erase(_idle[i]); // Nothing left to remember
+            continue;
+        }
+        _idle[kept++] = _idle[i]; // Still paying off rate debt
+    }
+    _idle.resize(kept);
+}
+
+ConnectionThrottle::Verdict ConnectionThrottle::admit(unsigned long key, TimeMs now) {
+    if (!enabled()) {
+        return ACCEPT;
+    }
+    if (now >= _nextSweep) {
+        sweep(now);
+    }
+
+    Source* source = _sources.find(key);
+    if (!source) {
+        _sources.insert(key, Source());
+        source = _sources.find(key);
+    }
+
+    if (_maxConnections > 0 && source->connections >= _maxConnections) {
+        return REJECT_CONCURRENCY;
+    }
+    if (_interval > 0) {
+        TimeMs arrival = source->arrival > now ? source->arrival : now;
+        if (arrival - now > _tolerance) {
+            if (source->connections == 0) {
+                markIdle(key, *source);
+            }
+            return REJECT_RATE;
+        }
+        source->arrival = arrival + _interval;
+    }
+    source->connections++;
+    return ACCEPT;
+}
+
+void ConnectionThrottle::adopt(unsigned long key) {
+    if (!enabled()) {
+        return;
+    }
+    Source* source = _sources.find(key);
+    if (!source) {
+        _sources.insert(key, Source());
+        source = _sources.find(key);
+    }
+    source->connections++;
+}
+
+void ConnectionThrottle::release(unsigned long key) {
+    if (!enabled()) {
+        return;
+    }
+    Source* source = _sources.find(key);
+    if (!source || source->connections == 0) {
+        return;
+    }
+    if (--source->connections == 0) {
+        markIdle(key, *source);
+    }
+}
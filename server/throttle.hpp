@@ -0,0 +1,58 @@
+#ifndef THROTTLE_HPP
+#define THROTTLE_HPP
+
+#include <vector>
+#include <cstddef>
+#include "../utils/flatmap.hpp"
+#include "../timers/timerwheel.hpp"
+
+// Per-source-address connection limits, checked right after accept() and
+// before any Client is allocated. Two independent limits, either of which
+// may be disabled with 0:
+//  - concurrency: live connections per address;
+//  - rate: connections per minute per address, with a burst allowance,
+//    enforced as a generic cell rate algorithm (one deadline per source,
+//    no per-connection history).
+// Sources are keyed by a numeric address key (see Server::sourceKey()).
+// Sources with no live connection and no rate debt are swept in batches.
+class ConnectionThrottle {
+public:
+    enum Verdict {
+        ACCEPT,
+        REJECT_CONCURRENCY,     // Too many live connections from the address
+        REJECT_RATE             // Reconnecting too fast
+    };
+
+private:
+    struct Source {
+        size_t  connections;    // Live connections admitted from this address
+        TimeMs  arrival;        // Theoretical arrival time of the next connection
+        bool    idleListed;     // Queued in _idle for the sweeper
+
+        Source() : connections(0), arrival(0), idleListed(false) {}
+    };
+
+    size_t                      _maxConnections;    // 0 = unlimited
+    TimeMs                      _interval;          // Ms per connection at the sustained rate (0 = unlimited)
+    TimeMs                      _tolerance;         // Burst allowance, in ms of rate debt
+    FlatMap<unsigned long, Source> _sources;
+    std::vector<unsigned long>  _idle;              // Sources that dropped to zero connections
+    TimeMs                      _nextSweep;
+
+    void markIdle(unsigned long key, Source& source);
+    void sweep(TimeMs now);
+
+public:
+    ConnectionThrottle(size_t maxConnections, size_t perMinute, size_t burst);
+
+    bool enabled() const { return _maxConnections > 0 || _interval > 0; }
+
+    // Admitted connections are counted until release() is called for them
+    Verdict admit(unsigned long key, TimeMs now);
+    // Count a connection that was established elsewhere (hot restart):
+    // no limit applies to it
+    void adopt(unsigned long key);
+    void release(unsigned long key);
+};
+
+#endif // THROTTLE_HPP
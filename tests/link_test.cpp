@@ -0,0 +1,358 @@
+// Server link tests: nick changes racing across a link, and nicks a peer
+// has no business introducing.
+//
+//   ./tests/linktest
+//
+// Runs ./ircserv on loopback ports 17400-17499, as the real network would
+// see it: once as two linked servers, once against a scripted peer that
+// speaks the link protocol itself. Failures are printed one per line; the
+// exit status is the number of failures.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+int g_failures = 0;
+
+const char* const PASSWORD = "pw";
+const char* const LINK_PASSWORD = "lk";
+// How long a line that should arrive is waited for
+const int WAIT_MS = 2000;
+// How long nothing has to arrive before the network counts as settled
+const int SETTLE_MS = 300;
+
+void expect(bool condition, const std::string& test, const std::string& what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s: %s\n", test.c_str(), what.c_str());
+        g_failures++;
+    }
+}
+
+long nowMs() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000L + now.tv_usec / 1000;
+}
+
+// ./ircserv on `port`, killed when the test is done with it
+class ServerProcess {
+private:
+    pid_t   _pid;
+
+    ServerProcess(const ServerProcess&);
+    ServerProcess& operator=(const ServerProcess&);
+
+public:
+    ServerProcess(const std::string& name, int port, int linkPort, const std::string& peers) : _pid(fork()) {
+        if (_pid != 0) {
+            return;
+        }
+        char number[16];
+        setenv("IRCSERV_SERVER_NAME", name.c_str(), 1);
+        setenv("IRCSERV_LINK_PASSWORD", LINK_PASSWORD, 1);
+        snprintf(number, sizeof(number), "%d", linkPort);
+        setenv("IRCSERV_LINK_PORT", number, 1);
+        setenv("IRCSERV_LINK_PEERS", peers.c_str(), 1);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        snprintf(number, sizeof(number), "%d", port);
+        execl("./ircserv", "ircserv", number, PASSWORD, static_cast<char*>(NULL));
+        _exit(127);
+    }
+
+    ~ServerProcess() {
+        if (_pid > 0) {
+            kill(_pid, SIGKILL);
+            waitpid(_pid, NULL, 0);
+        }
+    }
+};
+
+// A line-oriented loopback connection that remembers everything received
+class Connection {
+private:
+    int         _fd;
+    std::string _received;  // Everything not yet consumed by waitFor()
+
+    Connection(const Connection&);
+    Connection& operator=(const Connection&);
+
+    // Reads what arrives within `timeoutMs`; false if nothing did
+    bool fill(int timeoutMs) {
+        struct pollfd entry;
+        entry.fd = _fd;
+        entry.events = POLLIN;
+        entry.revents = 0;
+        if (_fd < 0 || poll(&entry, 1, timeoutMs) <= 0) {
+            return false;
+        }
+        char chunk[4096];
+        ssize_t count = recv(_fd, chunk, sizeof(chunk), 0);
+        if (count <= 0) {
+            close(_fd);
+            _fd = -1;
+            return false;
+        }
+        _received.append(chunk, count);
+        return true;
+    }
+
+public:
+    // Retries until the server listens on `port`
+    explicit Connection(int port) : _fd(-1) {
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        for (long deadline = nowMs() + WAIT_MS; _fd < 0 && nowMs() < deadline; usleep(20000)) {
+            _fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+                close(_fd);
+                _fd = -1;
+            }
+        }
+    }
+
+    ~Connection() {
+        if (_fd >= 0) {
+            close(_fd);
+        }
+    }
+
+    bool connected() const { return _fd >= 0; }
+
+    void send(const std::string& line) {
+        std::string framed = line + "\r\n";
+        if (_fd >= 0) {
+            ::send(_fd, framed.data(), framed.size(), MSG_NOSIGNAL);
+        }
+    }
+
+    // Waits for `text` to arrive and consumes everything up to the end of
+    // its line; false if it did not come
+    bool waitFor(const std::string& text) {
+        for (long deadline = nowMs() + WAIT_MS;;) {
+            size_t found = _received.find(text);
+            if (found != std::string::npos) {
+                size_t end = _received.find('\n', found);
+                _received.erase(0, end == std::string::npos ? _received.size() : end + 1);
+                return true;
+            }
+            long left = deadline - nowMs();
+            if (left <= 0 || _fd < 0) {
+                return false;
+            }
+            fill(static_cast<int>(left));
+        }
+    }
+
+    // Everything received until the connection stays quiet for SETTLE_MS
+    std::string drain() {
+        while (fill(SETTLE_MS)) {
+        }
+        std::string drained;
+        drained.swap(_received);
+        return drained;
+    }
+};
+
+// Registers as `nick` and joins `channel`
+bool signOn(Connection& client, const std::string& nick, const std::string& channel) {
+    client.send(std::string("PASS ") + PASSWORD);
+    client.send("NICK " + nick);
+    client.send("USER " + nick + " 0 * :" + nick);
+    client.send("JOIN " + channel);
+    return client.waitFor("366 " + nick + " ");
+}
+
+// The member list of `channel`, as seen by `client`
+std::string namesOf(Connection& client, const std::string& channel) {
+    client.drain();
+    client.send("NAMES " + channel);
+    std::string names = client.drain();
+    size_t reply = names.find("353 ");
+    size_t list = reply == std::string::npos ? reply : names.find(" :", reply);
+    if (list == std::string::npos) {
+        return "(no reply)";
+    }
+    return names.substr(list + 2, names.find_first_of("\r\n", list) - list - 2);
+}
+
+// `list` with its names in order, operator marks dropped
+std::string sortedNames(const std::string& list) {
+    std::vector<std::string> names;
+    for (size_t begin = 0; begin < list.size();) {
+        size_t end = list.find(' ', begin);
+        end = end == std::string::npos ? list.size() : end;
+        if (end > begin) {
+            names.push_back(list.substr(list[begin] == '@' ? begin + 1 : begin, end - begin - (list[begin] == '@')));
+        }
+        begin = end + 1;
+    }
+    std::sort(names.begin(), names.end());
+    std::string sorted;
+    for (size_t i = 0; i < names.size(); i++) {
+        sorted += (i ? " " : "") + names[i];
+    }
+    return sorted;
+}
+
+bool contains(const std::string& list, const std::string& nick) {
+    return (" " + list + " ").find(" " + nick + " ") != std::string::npos
+           || (" " + list + " ").find(" @" + nick + " ") != std::string::npos;
+}
+
+// Users on two linked servers rename to the same nick at once: both
+// servers have to end up agreeing on who is left, with no ghost of the
+// remote user on either side
+void testNickRace() {
+    const std::string test = "race";
+    ServerProcess alpha("alpha", 17401, 17411, "");
+    Connection watchA(17401);
+    if (!signOn(watchA, "watcha", "#race")) {
+        expect(false, test, "could not sign on to alpha");
+        return;
+    }
+    ServerProcess beta("beta", 17402, 0, "127.0.0.1:17411");
+    Connection watchB(17402);
+    expect(signOn(watchB, "watchb", "#race"), test, "could not sign on to beta");
+    expect(watchA.waitFor("watchb"), test, "beta never linked");
+
+    Connection x(17401);
+    Connection y(17402);
+    expect(signOn(x, "racex", "#race") && signOn(y, "racey", "#race"), test, "could not sign on the racers");
+    expect(watchA.waitFor("racey") && watchB.waitFor("racex"), test, "the racers were not relayed");
+    watchA.drain();
+    watchB.drain();
+
+    x.send("NICK samenick");
+    y.send("NICK samenick");
+
+    // Either the changes crossed on the link and both racers are gone, or
+    // one got there first and the other was refused the nick
+    std::string namesA = namesOf(watchA, "#race");
+    std::string namesB = namesOf(watchB, "#race");
+    expect(sortedNames(namesA) == sortedNames(namesB), test,
+           "alpha sees \"" + namesA + "\", beta sees \"" + namesB + "\"");
+    bool crossed = !contains(namesA, "samenick");
+    expect(crossed ? !contains(namesA, "racex") && !contains(namesA, "racey")
+                   : contains(namesA, "racex") != contains(namesA, "racey"),
+           test, "a ghost was left behind: \"" + namesA + "\"");
+    expect(contains(namesA, "watcha") && contains(namesA, "watchb"), test,
+           "a bystander was lost: \"" + namesA + "\"");
+
+    // Whoever holds the nick now holds it on both servers
+    bool freeA = false;
+    {
+        Connection claim(17401);
+        claim.send(std::string("PASS ") + PASSWORD + "\r\nNICK samenick\r\nUSER c 0 * :c");
+        freeA = claim.waitFor("001 ");
+    }
+    watchB.drain(); // until the claim has left beta too
+    Connection claim(17402);
+    claim.send(std::string("PASS ") + PASSWORD + "\r\nNICK samenick\r\nUSER c 0 * :c");
+    bool freeB = claim.waitFor("001 ");
+    expect(freeA == crossed, test, freeA ? "the nick is free on alpha" : "the nick is taken on alpha");
+    expect(freeA == freeB, test, freeA ? "the nick is free on alpha only" : "the nick is free on beta only");
+}
+
+// A scripted peer linked to a fresh server: the test plays the other side
+struct ScriptedLink {
+    ServerProcess   server;
+    Connection      client;
+    Connection      peer;
+    bool            ready;
+
+    explicit ScriptedLink(int port, int linkPort)
+        : server("alpha", port, linkPort, ""), client(port), peer(linkPort), ready(false) {
+        if (!signOn(client, "watcher", "#link")) {
+            return;
+        }
+        peer.send(std::string("SERVER scripted ") + LINK_PASSWORD);
+        ready = peer.waitFor("SERVER alpha");
+        peer.drain();
+        client.drain();
+    }
+};
+
+// UNICK and NICK from a link go through the checks a local NICK does
+void testInvalidNicks() {
+    const std::string test = "invalid";
+    ScriptedLink link(17421, 17431);
+    if (!link.ready) {
+        expect(false, test, "could not link the scripted peer");
+        return;
+    }
+
+    const char* bad[] = { "#chan", "a,b", "waytoolongnick", "bad*nick" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        link.peer.send(std::string("UNICK ") + bad[i] + " u h");
+        expect(link.peer.waitFor(std::string("KILL ") + bad[i] + " :Erroneous nickname"), test,
+               std::string("UNICK ") + bad[i] + " was not killed");
+    }
+
+    link.peer.send("UNICK remote u h");
+    link.peer.send("SJOIN #link :remote");
+    expect(link.client.waitFor(":remote!u@h JOIN"), test, "a valid UNICK was refused");
+    link.peer.send(":remote NICK bad,nick");
+    expect(link.peer.waitFor("KILL bad,nick :Erroneous nickname"), test, "NICK to bad,nick was not killed");
+    expect(link.client.waitFor(":remote!u@h QUIT"), test, "the renamed user was not removed");
+    expect(!contains(namesOf(link.client, "#link"), "remote"), test, "the renamed user stayed in the channel");
+}
+
+// A relayed NICK onto a nick a local user just took is settled by the new
+// nick: KILL for it goes back, and the remote user leaves here
+void testNickCollision() {
+    const std::string test = "collision";
+    ScriptedLink link(17441, 17451);
+    if (!link.ready) {
+        expect(false, test, "could not link the scripted peer");
+        return;
+    }
+    Connection local(17441);
+    expect(signOn(local, "local", "#link"), test, "could not sign on");
+    link.peer.send("UNICK remote u h");
+    link.peer.send("SJOIN #link :remote");
+    expect(link.client.waitFor(":remote!u@h JOIN"), test, "the remote user was not introduced");
+
+    local.send("NICK taken");
+    expect(link.peer.waitFor("NICK :taken"), test, "the local NICK was not relayed");
+    link.peer.send(":remote NICK taken");
+    expect(link.peer.waitFor("KILL taken :Nick collision"), test, "KILL was not sent for the new nick");
+    expect(link.client.waitFor(":remote!u@h QUIT"), test, "the remote user was not removed");
+
+    // The peer does the same on its side
+    link.peer.send("KILL taken :Nick collision");
+    expect(local.waitFor("ERROR :Killed"), test, "the local user was not killed");
+    std::string names = namesOf(link.client, "#link");
+    expect(names == "@watcher" || names == "watcher", test, "members left: \"" + names + "\"");
+}
+
+} // namespace
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    testNickRace();
+    testInvalidNicks();
+    testNickCollision();
+    if (g_failures == 0) {
+        printf("links: all tests passed\n");
+    }
+    return g_failures;
+}
@@ -0,0 +1,240 @@
+// Correctness tests for parseMessage() and splitList().
+//
+//   ./tests/parsertest
+//
+// Every case parses a private copy of its line, sized exactly, so the
+// 16-byte SSE2 scan can only see bytes that belong to the line. Failures
+// are printed one per line; the exit status is the number of failures.
+
+#include "../parser/message.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+int g_failures = 0;
+
+void expect(bool condition, const std::string& test, const std::string& what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s: %s\n", test.c_str(), what.c_str());
+        g_failures++;
+    }
+}
+
+void expectView(const StringView& view, const std::string& wanted, const std::string& test,
+                const std::string& what) {
+    expect(view.str() == wanted, test, what + " is \"" + view.str() + "\", wanted \"" + wanted + "\"");
+}
+
+// A parsed copy of `line`; the buffer lives as long as the case,
+// since the message points into it
+class Parsed {
+private:
+    std::vector<char>   _buffer;
+
+public:
+    IrcMessage  message;
+    bool        ok;
+
+    explicit Parsed(const std::string& line) : _buffer(line.begin(), line.end()) {
+        ok = parseMessage(_buffer.empty() ? NULL : &_buffer[0], _buffer.size(), message);
+    }
+
+    std::string buffer() const { return std::string(_buffer.begin(), _buffer.end()); }
+};
+
+// `line` parses into `prefix`, `command` and exactly `params`
+void expectMessage(const std::string& test, const std::string& line, const std::string& prefix,
+                   const std::string& command, const std::vector<std::string>& params) {
+    Parsed parsed(line);
+    expect(parsed.ok, test, "did not parse");
+    if (!parsed.ok) {
+        return;
+    }
+    expectView(parsed.message.prefix, prefix, test, "prefix");
+    expectView(parsed.message.command, command, test, "command");
+    char count[64];
+    snprintf(count, sizeof(count), "%lu parameters, wanted %lu",
+             static_cast<unsigned long>(parsed.message.paramCount), static_cast<unsigned long>(params.size()));
+    expect(parsed.message.paramCount == params.size(), test, count);
+    for (size_t i = 0; i < params.size() && i < parsed.message.paramCount; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "params[%lu]", static_cast<unsigned long>(i));
+        expectView(parsed.message.params[i], params[i], test, name);
+    }
+}
+
+// Builds parameter lists inline: Params() << "a" << "b"
+class Params {
+private:
+    std::vector<std::string>    _items;
+
+public:
+    Params& operator<<(const std::string& item) {
+        _items.push_back(item);
+        return *this;
+    }
+    operator const std::vector<std::string>&() const { return _items; }
+};
+
+void testPrefix() {
+    expectMessage("prefix/absent", "PRIVMSG #chan :hello", "", "PRIVMSG", Params() << "#chan" << "hello");
+    expectMessage("prefix/present", ":nick!user@host PRIVMSG #chan :hello", "nick!user@host", "PRIVMSG",
+                  Params() << "#chan" << "hello");
+    expectMessage("prefix/server", ":irc.example.org PING", "irc.example.org", "PING", Params());
+
+    expect(!Parsed(":nick!user@host").ok, "prefix/only", "a line with only a prefix parsed");
+    expect(!Parsed(":nick!user@host   ").ok, "prefix/only_spaces", "a prefix followed by spaces parsed");
+    expect(!Parsed(":").ok, "prefix/colon", "a lone ':' parsed");
+    expect(!Parsed("").ok, "empty", "an empty line parsed");
+    expect(!Parsed("    ").ok, "spaces_only", "a line of spaces parsed");
+}
+
+void testSpaces() {
+    expectMessage("spaces/runs", "PRIVMSG    #chan     :hello", "", "PRIVMSG", Params() << "#chan" << "hello");
+    expectMessage("spaces/after_prefix", ":nick    JOIN #chan", "nick", "JOIN", Params() << "#chan");
+    expectMessage("spaces/trailing_spaces", "JOIN #chan   ", "", "JOIN", Params() << "#chan");
+    expectMessage("spaces/before_trailing", "TOPIC #chan    : spaced", "", "TOPIC",
+                  Params() << "#chan" << " spaced");
+
+    // Leading spaces are skipped, they do not form an empty command
+    expectMessage("spaces/leading", "   PING token", "", "PING", Params() << "token");
+}
+
+void testTrailing() {
+    expectMessage("trailing/empty", "TOPIC #chan :", "", "TOPIC", Params() << "#chan" << "");
+    expectMessage("trailing/spaces", "PRIVMSG #chan :hello  there, world ", "", "PRIVMSG",
+                  Params() << "#chan" << "hello  there, world ");
+    expectMessage("trailing/colons", "PRIVMSG #chan ::-) a:b", "", "PRIVMSG", Params() << "#chan" << ":-) a:b");
+    expectMessage("trailing/only", "QUIT :Gone fishing", "", "QUIT", Params() << "Gone fishing");
+    // A ':' inside a middle parameter does not start the trailing one
+    expectMessage("trailing/inner_colon", "PRIVMSG a:b :c", "", "PRIVMSG", Params() << "a:b" << "c");
+}
+
+void testParamLimit() {
+    Params fourteen;
+    std::string line = "MODE";
+    for (int i = 1; i <= 14; i++) {
+        char param[8];
+        snprintf(param, sizeof(param), "p%d", i);
+        line += std::string(" ") + param;
+        fourteen << param;
+    }
+
+    // The 15th becomes the trailing parameter without a ':', spaces and all
+    expectMessage("limit/15th_trailing", line + " last one :here", "", "MODE",
+                  Params(fourteen) << "last one :here");
+    expectMessage("limit/15th_colon", line + " :last one", "", "MODE", Params(fourteen) << "last one");
+    expectMessage("limit/15th_single", line + " p15", "", "MODE", Params(fourteen) << "p15");
+    expectMessage("limit/14", line, "", "MODE", fourteen);
+}
+
+void testLongTokens() {
+    // The SSE2 scan covers 16 bytes per step; tokens across, ending at or
+    // running past a block edge check that path, short ones the scalar tail
+    const std::string host = "host.example.org";          // 16 bytes
+    const std::string longNick = std::string(40, 'n');
+    const std::string longChan = "#" + std::string(30, 'c');
+
+    expectMessage("sse/prefix_16", ":" + host + " PING x", host, "PING", Params() << "x");
+    expectMessage("sse/prefix_15", ":" + host.substr(1) + " PING x", host.substr(1), "PING", Params() << "x");
+    expectMessage("sse/prefix_17", ":a" + host + " PING x", "a" + host, "PING", Params() << "x");
+    expectMessage("sse/long_tokens", ":" + longNick + "!u@" + host + " PRIVMSG " + longChan + " " + longNick,
+                  longNick + "!u@" + host, "PRIVMSG", Params() << longChan << longNick);
+    expectMessage("sse/space_at_16", std::string(15, 'a') + " " + std::string(20, 'b') + " c", "",
+                  std::string(15, 'A'), Params() << std::string(20, 'b') << "c");
+    expectMessage("sse/space_at_17", std::string(16, 'a') + " b", "", std::string(16, 'A'), Params() << "b");
+    expectMessage("sse/space_at_32", "PRIVMSG " + std::string(23, 'x') + " " + std::string(40, 'y'), "",
+                  "PRIVMSG", Params() << std::string(23, 'x') << std::string(40, 'y'));
+    expectMessage("sse/long_last", "JOIN " + longChan, "", "JOIN", Params() << longChan);
+    expectMessage("scalar/short", "A b c", "", "A", Params() << "b" << "c");
+    expectMessage("scalar/one_byte", "X", "", "X", Params());
+}
+
+void testCommand() {
+    Parsed parsed("privMsg #chan :Mixed Case");
+    expect(parsed.ok, "command/case", "did not parse");
+    expectView(parsed.message.command, "PRIVMSG", "command/case", "command");
+    expect(parsed.message.commandId == CMD_PRIVMSG, "command/case", "commandId is not CMD_PRIVMSG");
+    // Only the command is upper-cased, in the caller's buffer
+    expect(parsed.buffer() == "PRIVMSG #chan :Mixed Case", "command/case", "buffer is \"" + parsed.buffer() + "\"");
+    expectView(parsed.message.params[1], "Mixed Case", "command/case", "trailing");
+
+    struct {
+        const char* line;
+        CommandId   id;
+    } lookups[] = {
+        { "PASS x", CMD_PASS },
+        { "nick x", CMD_NICK },
+        { "User u 0 * :r", CMD_USER },
+        { "join #a", CMD_JOIN },
+        { "NOTICE a :b", CMD_NOTICE },
+        { "chathistory LATEST #a * 10", CMD_CHATHISTORY },
+        { ":p ping :x", CMD_PING },
+        { "PRIVMSGX a :b", CMD_UNKNOWN },
+        { "PRIV a :b", CMD_UNKNOWN },
+        { "FOO", CMD_UNKNOWN },
+    };
+    for (size_t i = 0; i < sizeof(lookups) / sizeof(lookups[0]); i++) {
+        Parsed lookup(lookups[i].line);
+        expect(lookup.ok && lookup.message.commandId == lookups[i].id, std::string("command/id ") + lookups[i].line,
+               "wrong commandId");
+    }
+}
+
+void testReuse() {
+    // A message reused for a shorter line keeps nothing from the longer one
+    std::string first = ":nick PRIVMSG #a :one";
+    std::string second = "PING";
+    std::vector<char> buffer(first.begin(), first.end());
+    IrcMessage message;
+    parseMessage(&buffer[0], buffer.size(), message);
+    buffer.assign(second.begin(), second.end());
+    expect(parseMessage(&buffer[0], buffer.size(), message), "reuse", "did not parse");
+    expect(message.prefix.empty(), "reuse", "stale prefix");
+    expect(message.paramCount == 0, "reuse", "stale parameters");
+    expect(message.commandId == CMD_PING, "reuse", "wrong commandId");
+}
+
+void expectList(const std::string& test, const std::string& list, const std::vector<std::string>& wanted) {
+    std::vector<StringView> entries;
+    entries.push_back(StringView("stale", 5)); // splitList() clears first
+    splitList(StringView(list.data(), list.size()), entries);
+    char count[64];
+    snprintf(count, sizeof(count), "%lu entries, wanted %lu", static_cast<unsigned long>(entries.size()),
+             static_cast<unsigned long>(wanted.size()));
+    expect(entries.size() == wanted.size(), test, count);
+    for (size_t i = 0; i < wanted.size() && i < entries.size(); i++) {
+        expectView(entries[i], wanted[i], test, "entry");
+        expect(entries[i].data >= list.data() && entries[i].data < list.data() + list.size(), test,
+               "entry does not point into the list");
+    }
+}
+
+void testSplitList() {
+    expectList("list/single", "#a", Params() << "#a");
+    expectList("list/several", "#a,#b,nick", Params() << "#a" << "#b" << "nick");
+    expectList("list/empty_entries", "a,,b,", Params() << "a" << "b");
+    expectList("list/leading_comma", ",a", Params() << "a");
+    expectList("list/commas_only", ",,,", Params());
+    expectList("list/empty", "", Params());
+}
+
+} // namespace
+
+int main() {
+    testPrefix();
+    testSpaces();
+    testTrailing();
+    testParamLimit();
+    testLongTokens();
+    testCommand();
+    testReuse();
+    testSplitList();
+    if (g_failures == 0) {
+        printf("parser: all tests passed\n");
+    }
+    return g_failures;
+}
@@ -0,0 +1,91 @@
+#include "timerwheel.hpp"
+#include <ctime>
+
+TimeMs monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<TimeMs>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+TimerWheel::TimerWheel(TimeMs tickMs, TimeMs now)
+    : _tickMs(tickMs ? tickMs : 1), _tick(now / _tickMs) {
+    for (unsigned int level = 0; level < LEVELS; level++) {
+        for (unsigned int slot = 0; slot < SLOTS; slot++) {
+            _slots[level][slot].prev = &_slots[level][slot];
+            _slots[level][slot].next = &_slots[level][slot];
+        }
+    }
+}
+
+void TimerWheel::place(Timer* timer) {
+    TimeMs delta = timer->expires - _tick;
+    unsigned int level = 0;
+    while (level < LEVELS - 1 && delta >= (static_cast<TimeMs>(1) << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    if (level == LEVELS - 1) {
+        // Beyond the wheel's range: park at its far end, re-placed on cascade
+        TimeMs range = static_cast<TimeMs>(1) << (SLOT_BITS * LEVELS);
+        if (delta >= range) {
+            timer->expires = _tick + range - 1;
+        }
+    }
+    Timer* head = &_slots[level][(timer->expires >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void TimerWheel::schedule(Timer* timer, TimeMs when) {
+    timer->unlink();
+    TimeMs expires = (when + _tickMs - 1) / _tickMs;
+    timer->expires = expires > _tick ? expires : _tick + 1;
+    place(timer);
+}
+
+void TimerWheel::cascade(unsigned int level) {
+    Timer* head = &_slots[level][(_tick >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    while (head->next != head) {
+        Timer* timer = head->next;
+        timer->unlink();
+        place(timer);
+    }
+}
+
+void TimerWheel::advance(TimeMs now, std::vector<Timer*>& expired) {
+    TimeMs target = now / _tickMs;
+    while (_tick < target) {
+        _tick++;
+        // On a level boundary pull the next higher slot down, highest first
+        unsigned int levels = 0;
+        while (levels < LEVELS - 1 && (_tick & ((static_cast<TimeMs>(1) << (SLOT_BITS * (levels + 1))) - 1)) == 0) {
+            levels++;
+        }
+        for (unsigned int level = levels; level > 0; level--) {
+            cascade(level);
+        }
+        Timer* head = &_slots[0][_tick & (SLOTS - 1)];
+        while (head->next != head) {
+            Timer* timer = head->next;
+            timer->unlink();
+            expired.push_back(timer);
+        }
+    }
+}
+
+int TimerWheel::timeoutMs(TimeMs now) const {
+    // Wake for the first non-empty level-0 slot, or at the next cascade
+    // boundary, whichever comes first
+    TimeMs boundary = (_tick | (SLOTS - 1)) + 1;
+    TimeMs wakeTick = boundary;
+    for (TimeMs t = _tick + 1; t < boundary; t++) {
+        const Timer* head = &_slots[0][t & (SLOTS - 1)];
+        if (head->next != head) {
+            wakeTick = t;
+            break;
+        }
+    }
+    TimeMs due = wakeTick * _tickMs;
+    return due > now ? static_cast<int>(due - now) : 0;
+}
@@ -0,0 +1,77 @@
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <vector>
+#include <cstddef>
+
+typedef unsigned long long TimeMs;
+
+// Milliseconds from a monotonic clock (unaffected by wall-clock changes)
+TimeMs monotonicMs();
+
+// Intrusive timer node, embedded in its owner (e.g. a Client). Destroying
+// a pending timer unlinks it, so owners need no explicit cancel on free.
+struct Timer {
+    Timer*      prev;
+    Timer*      next;       // NULL while not scheduled
+    TimeMs      expires;    // In wheel ticks
+    void*       context;    // Owner, for the code handling expirations
+
+    Timer() : prev(NULL), next(NULL), expires(0), context(NULL) {}
+    ~Timer() { unlink(); }
+
+    bool pending() const { return next != NULL; }
+    void unlink() {
+        if (next) {
+            prev->next = next;
+            next->prev = prev;
+            prev = next = NULL;
+        }
+    }
+
+private:
+    // Prevent copying: the wheel points at this node
+    Timer(const Timer& other);
+    Timer& operator=(const Timer& other);
+};
+
+// Hierarchical timing wheel: LEVELS rings of SLOTS lists, level n holding
+// timers due within SLOTS^(n+1) ticks. Schedule and cancel are O(1);
+// advancing by one tick touches one level-0 slot, and every SLOTS ticks
+// one higher-level slot is cascaded down. No per-iteration scan over all
+// timers ever happens, whatever their number.
+class TimerWheel {
+public:
+    static const unsigned int SLOT_BITS = 6;
+    static const unsigned int SLOTS = 1 << SLOT_BITS;
+    static const unsigned int LEVELS = 4;
+
+private:
+    TimeMs  _tickMs;            // Wheel resolution
+    TimeMs  _tick;              // Last tick processed
+    Timer   _slots[LEVELS][SLOTS]; // List heads (circular, self-linked)
+
+    void place(Timer* timer);
+    void cascade(unsigned int level);
+
+    // Prevent copying
+    TimerWheel(const TimerWheel& other);
+    TimerWheel& operator=(const TimerWheel& other);
+
+public:
+    TimerWheel(TimeMs tickMs, TimeMs now);
+
+    // (Re)arm for an absolute monotonic time, rounded up to the next tick
+    void schedule(Timer* timer, TimeMs when);
+    void cancel(Timer* timer) { timer->unlink(); }
+
+    // Run the clock up to `now`, appending timers that fired to `expired`
+    // (already unlinked, so they may be rescheduled right away)
+    void advance(TimeMs now, std::vector<Timer*>& expired);
+
+    // Poller timeout until the next level-0 expiry, bounded by the next
+    // cascade so timers coming down from higher levels are never late
+    int timeoutMs(TimeMs now) const;
+};
+
+#endif // TIMERWHEEL_HPP
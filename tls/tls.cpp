@@ -0,0 +1,237 @@
+#include "tls.hpp"
+#include "../logger/logger.hpp"
+#include "../metrics/metrics.hpp"
+#include <cerrno>
+#include <climits>
+
+#ifdef IRCSERV_TLS
+
+#include <csignal>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+namespace {
+
+// Largest TLS record payload: one SSL_write() per record when gathering
+const size_t TLS_RECORD_SIZE = 16384;
+
+const unsigned char SESSION_CONTEXT[] = "ircserv";
+
+void logErrors(const std::string& what) {
+    unsigned long error = ERR_get_error();
+    if (!error) {
+        LOG_ERROR(what);
+    }
+    for (; error; error = ERR_get_error()) {
+        char text[256];
+        ERR_error_string_n(error, text, sizeof(text));
+        LOG_ERROR(what << ": " << text);
+    }
+}
+
+} // namespace
+
+TlsContext::TlsContext() : _ctx(NULL) {
+}
+
+TlsContext::~TlsContext() {
+    SSL_CTX_free(_ctx);
+}
+
+TlsContext* TlsContext::create(const std::string& certFile, const std::string& keyFile) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+        logErrors("Error creating TLS context");
+        return NULL;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    // A peer vanishing without close_notify is an ordinary disconnect
+    long options = SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF;
+#ifdef SSL_OP_ENABLE_KTLS
+    options |= SSL_OP_ENABLE_KTLS;
+#endif
+    SSL_CTX_set_options(ctx, options);
+
+    // Partial writes let a record go out as soon as it is framed; moving
+    // buffers because a retried write is re-gathered from the queue.
+    // Idle connections give their record buffers back.
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                          | SSL_MODE_RELEASE_BUFFERS);
+
+    // Resumption: TLS 1.2 session ids from the server cache, TLS 1.3 (and
+    // 1.2 ticket-capable clients) from one stateless ticket per handshake
+    SSL_CTX_set_session_id_context(ctx, SESSION_CONTEXT, sizeof(SESSION_CONTEXT) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_num_tickets(ctx, 1);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, certFile.c_str()) != 1
+        || SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(), SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(ctx) != 1) {
+        logErrors("Error loading TLS certificate " + certFile + " / key " + keyFile);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    // OpenSSL writes to the socket itself, without MSG_NOSIGNAL
+    signal(SIGPIPE, SIG_IGN);
+
+    TlsContext* context = new TlsContext();
+    context->_ctx = ctx;
+    return context;
+}
+
+TlsStream* TlsContext::accept(int fd) {
+    SSL* ssl = SSL_new(_ctx);
+    if (!ssl || SSL_set_fd(ssl, fd) != 1) {
+        logErrors("Error creating TLS session");
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return new TlsStream(ssl, fd);
+}
+
+TlsStream::TlsStream(ssl_st* ssl, int fd)
+    : _ssl(ssl), _fd(fd), _established(false), _kernelSend(false), _retryLength(0) {
+}
+
+TlsStream::~TlsStream() {
+    // Best-effort close_notify; the socket is closed right after
+    if (_established) {
+        SSL_shutdown(_ssl);
+    }
+    SSL_free(_ssl);
+}
+
+TlsStream::Handshake TlsStream::handshake() {
+    if (_established) {
+        return HANDSHAKE_DONE;
+    }
+    ERR_clear_error();
+    int ret = SSL_do_handshake(_ssl);
+    if (ret == 1) {
+        _established = true;
+#ifndef OPENSSL_NO_KTLS
+        _kernelSend = BIO_get_ktls_send(SSL_get_wbio(_ssl));
+#endif
+        LOG_DEBUG("TLS established on fd " << _fd << ": " << SSL_get_version(_ssl) << " "
+                  << SSL_get_cipher_name(_ssl) << (SSL_session_reused(_ssl) ? ", resumed" : "")
+                  << (_kernelSend ? ", kTLS send" : ""));
+        return HANDSHAKE_DONE;
+    }
+    switch (SSL_get_error(_ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        return HANDSHAKE_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+        return HANDSHAKE_WANT_WRITE;
+    default:
+        LOG_DEBUG("TLS handshake failed on fd " << _fd << ": "
+                  << ERR_reason_error_string(ERR_peek_last_error()));
+        ERR_clear_error();
+        return HANDSHAKE_FAILED;
+    }
+}
+
+ssize_t TlsStream::recv(char* buffer, size_t length) {
+    ERR_clear_error();
+    int ret = SSL_read(_ssl, buffer, static_cast<int>(length > INT_MAX ? INT_MAX : length));
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(_ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        if (errno == 0) {
+            errno = ECONNRESET;
+        }
+        return -1;
+    default:
+        ERR_clear_error();
+        errno = EPROTO;
+        return -1;
+    }
+}
+
+OutputQueue::FlushResult TlsStream::flush(OutputQueue& queue) {
+    // The kernel frames records: keep the vectored path
+    if (_kernelSend) {
+        return queue.flush(_fd);
+    }
+    if (!_established) {
+        return queue.empty() ? OutputQueue::FLUSH_DONE : OutputQueue::FLUSH_PENDING;
+    }
+
+    char record[TLS_RECORD_SIZE];
+    while (!queue.empty()) {
+        // A write that hit EAGAIN must be retried with the same bytes,
+        // which are still at the head of the queue
+        size_t length = queue.gather(record, _retryLength ? _retryLength : sizeof(record));
+        ERR_clear_error();
+        int ret = SSL_write(_ssl, record, static_cast<int>(length));
+        if (ret > 0) {
+            _retryLength = 0;
+            queue.consume(static_cast<size_t>(ret));
+            continue;
+        }
+        int error = SSL_get_error(_ssl, ret);
+        if (error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ) {
+            _retryLength = length;
+            Metrics::instance().sendqDepth.record(queue.bytes());
+            return OutputQueue::FLUSH_PENDING;
+        }
+        ERR_clear_error();
+        return OutputQueue::FLUSH_ERROR;
+    }
+    return OutputQueue::FLUSH_DONE;
+}
+
+#else // IRCSERV_TLS
+
+TlsContext::TlsContext() : _ctx(NULL) {
+}
+
+TlsContext::~TlsContext() {
+}
+
+TlsContext* TlsContext::create(const std::string& certFile, const std::string& keyFile) {
+    (void)certFile;
+    (void)keyFile;
+    LOG_ERROR("TLS listener requested, but ircserv was built without TLS support (make TLS=1)");
+    return NULL;
+}
+
+TlsStream* TlsContext::accept(int fd) {
+    (void)fd;
+    return NULL;
+}
+
+TlsStream::TlsStream(ssl_st* ssl, int fd)
+    : _ssl(ssl), _fd(fd), _established(false), _kernelSend(false), _retryLength(0) {
+}
+
+TlsStream::~TlsStream() {
+}
+
+TlsStream::Handshake TlsStream::handshake() {
+    return HANDSHAKE_FAILED;
+}
+
+ssize_t TlsStream::recv(char* buffer, size_t length) {
+    (void)buffer;
+    (void)length;
+    errno = EPROTO;
+    return -1;
+}
+
+OutputQueue::FlushResult TlsStream::flush(OutputQueue& queue) {
+    (void)queue;
+    return OutputQueue::FLUSH_ERROR;
+}
+
+#endif // IRCSERV_TLS
@@ -0,0 +1,88 @@
+#ifndef TLS_HPP
+#define TLS_HPP
+
+#include <string>
+#include <cstddef>
+#include <sys/types.h>
+#include "../buffers/outputqueue.hpp"
+
+// OpenSSL handles, kept opaque so only tls.cpp needs the headers
+struct ssl_st;
+struct ssl_ctx_st;
+
+class TlsStream;
+
+// Server-side TLS settings shared by every connection of the TLS listener.
+// Built in with `make TLS=1`; otherwise create() always fails.
+//
+// Reconnect storms resume instead of doing a full handshake: TLS 1.3
+// tickets (stateless, keyed per process) and a server-side session cache
+// for TLS 1.2. kTLS is requested for every connection; the kernel takes
+// over the record layer when it supports the negotiated cipher.
+class TlsContext {
+private:
+    ssl_ctx_st*     _ctx;
+
+    TlsContext();
+
+    // Prevent copying
+    TlsContext(const TlsContext& other);
+    TlsContext& operator=(const TlsContext& other);
+
+public:
+    ~TlsContext();
+
+    // Load a PEM certificate chain and private key; NULL on failure
+    static TlsContext* create(const std::string& certFile, const std::string& keyFile);
+
+    // Server side of a freshly accepted non-blocking socket
+    TlsStream* accept(int fd);
+};
+
+// One TLS connection, owned by whoever owns the socket (the Client in the
+// single-threaded loop, the IoWorker connection in threaded mode). recv()
+// and flush() mirror their plaintext counterparts, so the edge-triggered
+// read loops and the send-queue logic stay the same.
+//
+// With kTLS send offload the queue is flushed with the usual vectored
+// sendmsg() and the kernel frames the records. Otherwise queued lines are
+// gathered into full-sized records and written by OpenSSL: one syscall per
+// 16 KiB record, not one per line.
+class TlsStream {
+public:
+    enum Handshake {
+        HANDSHAKE_DONE,
+        HANDSHAKE_WANT_READ,    // Wait for readability
+        HANDSHAKE_WANT_WRITE,   // Wait for writability
+        HANDSHAKE_FAILED
+    };
+
+private:
+    ssl_st*     _ssl;
+    int         _fd;
+    bool        _established;   // Handshake completed
+    bool        _kernelSend;    // kTLS transmit offload active
+    size_t      _retryLength;   // Bytes of an SSL_write that must be retried as-is
+
+    // Prevent copying
+    TlsStream(const TlsStream& other);
+    TlsStream& operator=(const TlsStream& other);
+
+public:
+    TlsStream(ssl_st* ssl, int fd);
+    ~TlsStream();
+
+    // Drive the non-blocking handshake; safe to call again once done
+    Handshake handshake();
+    bool established() const { return _established; }
+    bool kernelSend() const { return _kernelSend; }
+
+    // recv() semantics on decrypted data: bytes read, 0 on close, -1 with
+    // errno set (EAGAIN when nothing is available yet)
+    ssize_t recv(char* buffer, size_t length);
+
+    // OutputQueue::flush() through the TLS layer
+    OutputQueue::FlushResult flush(OutputQueue& queue);
+};
+
+#endif // TLS_HPP
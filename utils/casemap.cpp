@@ -0,0 +1,47 @@
+#include "casemap.hpp"
+
+// Spelled out so it is usable during static initialization
+const unsigned char IRC_FOLD[256] = {
+#define IRC_ROW(base) \
+    base + 0, base + 1, base + 2, base + 3, base + 4, base + 5, base + 6, base + 7, \
+    base + 8, base + 9, base + 10, base + 11, base + 12, base + 13, base + 14, base + 15
+    IRC_ROW(0), IRC_ROW(16), IRC_ROW(32), IRC_ROW(48),
+    // '@' 'A'..'O' -> '@' 'a'..'o'
+    64, 97, 98, 99, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111,
+    // 'P'..'Z' '[' '\' ']' '^' '_' -> 'p'..'z' '{' '|' '}' '^' '_'
+    112, 113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 94, 95,
+    IRC_ROW(96),
+    // 'p'..'z' '{' '|' '}' '~' DEL -> '~' folds to '^'
+    112, 113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 94, 127,
+    IRC_ROW(128), IRC_ROW(144), IRC_ROW(160), IRC_ROW(176),
+    IRC_ROW(192), IRC_ROW(208), IRC_ROW(224), IRC_ROW(240)
+#undef IRC_ROW
+};
+
+size_t foldedHash(const char* data, size_t length) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ IRC_FOLD[static_cast<unsigned char>(data[i])]) * 16777619u;
+    }
+    return hash;
+}
+
+bool foldedEquals(const char* a, size_t aLength, const char* b, size_t bLength) {
+    if (aLength != bLength) {
+        return false;
+    }
+    for (size_t i = 0; i < aLength; i++) {
+        if (IRC_FOLD[static_cast<unsigned char>(a[i])] != IRC_FOLD[static_cast<unsigned char>(b[i])]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string foldCase(const std::string& name) {
+    std::string folded(name);
+    for (size_t i = 0; i < folded.size(); i++) {
+        folded[i] = foldChar(folded[i]);
+    }
+    return folded;
+}
@@ -0,0 +1,24 @@
+#ifndef CASEMAP_HPP
+#define CASEMAP_HPP
+
+#include <string>
+#include <cstddef>
+
+// RFC 1459 casemapping: ASCII letters plus "[]\~" as the upper-case forms
+// of "{}|^". Nicknames and channel names are compared and hashed through
+// this folding, so "Nick[a]" and "nick{A}" name the same entity.
+
+extern const unsigned char IRC_FOLD[256];
+
+inline char foldChar(char c) {
+    return static_cast<char>(IRC_FOLD[static_cast<unsigned char>(c)]);
+}
+
+// FNV-1a hash of the folded bytes, without building a folded copy
+size_t foldedHash(const char* data, size_t length);
+
+bool foldedEquals(const char* a, size_t aLength, const char* b, size_t bLength);
+
+std::string foldCase(const std::string& name);
+
+#endif // CASEMAP_HPP
@@ -0,0 +1,75 @@
+#ifndef DENSESET_HPP
+#define DENSESET_HPP
+
+#include <vector>
+#include <cstddef>
+#include "flatmap.hpp"
+
+// Set of pointers or ids with O(1) insert/contains/erase that keeps its
+// elements packed in a vector, so iteration (channel broadcasts) walks
+// contiguous memory. Each element carries a word of flag bits. Erase
+// moves the last element into the hole: iteration order is not stable.
+template <typename T>
+class DenseSet {
+private:
+    std::vector<T>              _items;
+    std::vector<unsigned int>   _flags;     // Parallel to _items
+    FlatMap<T, size_t>          _slots;     // Element -> index in _items
+
+public:
+    const std::vector<T>& items() const { return _items; }
+    size_t size() const { return _items.size(); }
+    bool empty() const { return _items.empty(); }
+    bool contains(const T& item) const { return _slots.contains(item); }
+
+    bool insert(const T& item, unsigned int flags = 0) {
+        if (!_slots.insert(item, _items.size())) {
+            return false;
+        }
+        _items.push_back(item);
+        _flags.push_back(flags);
+        return true;
+    }
+
+    bool erase(const T& item) {
+        const size_t* found = _slots.find(item);
+        if (!found) {
+            return false;
+        }
+        size_t index = *found;
+        size_t last = _items.size() - 1;
+        if (index != last) {
+            _items[index] = _items[last];
+            _flags[index] = _flags[last];
+            *_slots.find(_items[index]) = index;
+        }
+        _items.pop_back();
+        _flags.pop_back();
+        _slots.erase(item);
+        return true;
+    }
+
+    // 0 for elements that are not in the set
+    unsigned int flags(const T& item) const {
+        const size_t* found = _slots.find(item);
+        return found ? _flags[*found] : 0;
+    }
+
+    // Index-based access for callers already iterating items()
+    unsigned int flagsAt(size_t index) const { return _flags[index]; }
+
+    void setFlags(const T& item, unsigned int set, unsigned int clear) {
+        const size_t* found = _slots.find(item);
+        if (found) {
+            _flags[*found] = (_flags[*found] & ~clear) | set;
+        }
+    }
+
+    void clear() {
+        _items.clear();
+        _flags.clear();
+        _slots.clear();
+    }
+};
+
+#endif // DENSESET_HPP
@@ -0,0 +1,127 @@
+#ifndef FLATMAP_HPP
+#define FLATMAP_HPP
+
+#include <vector>
+#include <cstddef>
+
+// Key hashing for FlatMap: pointers and integer ids, spread with a
+// multiplicative (Fibonacci) mix so aligned addresses do not cluster
+inline size_t mixHash(size_t value) {
+    return value * static_cast<size_t>(0x9E3779B97F4A7C15ULL);
+}
+inline size_t hashKey(const void* key) {
+    return mixHash(reinterpret_cast<size_t>(key) >> 3);
+}
+inline size_t hashKey(unsigned long key) {
+    return mixHash(static_cast<size_t>(key));
+}
+
+// Open-addressing hash map for small trivially copyable keys (pointers,
+// ids). Linear probing with backward-shift erase, so lookups never walk
+// over tombstones. The table doubles at 3/4 load and never shrinks.
+template <typename K, typename V>
+class FlatMap {
+private:
+    struct Entry {
+        K       key;
+        V       value;
+        bool    used;
+
+        Entry() : key(), value(), used(false) {}
+    };
+
+    std::vector<Entry>  _entries;   // Power-of-two size
+    size_t              _size;
+
+    size_t mask() const { return _entries.size() - 1; }
+
+    size_t home(const K& key) const {
+        // High bits of the multiplicative mix are the well-distributed ones
+        size_t hash = hashKey(key);
+        return (hash ^ (hash >> 29)) & mask();
+    }
+
+    // Slot holding `key`, or the free slot where it would go
+    size_t locate(const K& key) const {
+        size_t slot = home(key);
+        while (_entries[slot].used && !(_entries[slot].key == key)) {
+            slot = (slot + 1) & mask();
+        }
+        return slot;
+    }
+
+    void grow() {
+        std::vector<Entry> old(_entries.size() * 2);
+        old.swap(_entries);
+        for (size_t i = 0; i < old.size(); i++) {
+            if (old[i].used) {
+                _entries[locate(old[i].key)] = old[i];
+            }
+        }
+    }
+
+public:
+    FlatMap() : _entries(8), _size(0) {}
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    // NULL when absent; invalidated by the next insert or erase
+    V* find(const K& key) {
+        Entry& entry = _entries[locate(key)];
+        return entry.used ? &entry.value : NULL;
+    }
+    const V* find(const K& key) const {
+        const Entry& entry = _entries[locate(key)];
+        return entry.used ? &entry.value : NULL;
+    }
+
+    bool contains(const K& key) const { return _entries[locate(key)].used; }
+
+    // False (and no change) when the key is already present
+    bool insert(const K& key, const V& value) {
+        if ((_size + 1) * 4 > _entries.size() * 3) {
+            grow();
+        }
+        Entry& entry = _entries[locate(key)];
+        if (entry.used) {
+            return false;
+        }
+        entry.key = key;
+        entry.value = value;
+        entry.used = true;
+        _size++;
+        return true;
+    }
+
+    bool erase(const K& key) {
+        size_t hole = locate(key);
+        if (!_entries[hole].used) {
+            return false;
+        }
+        size_t next = hole;
+        while (true) {
+            next = (next + 1) & mask();
+            if (!_entries[next].used) {
+                break;
+            }
+            size_t want = home(_entries[next].key);
+            bool stays = (hole <= next) ? (hole < want && want <= next)
+                                        : (hole < want || want <= next);
+            if (!stays) {
+                _entries[hole] = _entries[next];
+                hole = next;
+            }
+        }
+        _entries[hole] = Entry();
+        _size--;
+        return true;
+    }
+
+    void clear() {
+        std::vector<Entry>(8).swap(_entries);
+        _size = 0;
+    }
+};
+
+#endif // FLATMAP_HPP
@@ -0,0 +1,131 @@
+#ifndef NAMETABLE_HPP
+#define NAMETABLE_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "casemap.hpp"
+
+// Hash table from an IRC name (nickname, channel) to an object, compared
+// under RFC 1459 casemapping. Open addressing with linear probing; each
+// entry keeps its folded hash so probes skip most string compares, and
+// erase shifts the following entries back instead of leaving tombstones.
+// Lookups take the raw name and never build a folded copy.
+template <typename T>
+class NameTable {
+private:
+    struct Entry {
+        size_t      hash;
+        std::string name;   // Spelling used on insertion
+        T*          value;  // NULL = free slot
+
+        Entry() : hash(0), value(NULL) {}
+    };
+
+    std::vector<Entry>  _entries;   // Power-of-two size
+    size_t              _size;
+
+    size_t mask() const { return _entries.size() - 1; }
+
+    // Slot holding `name`, or the free slot where it would go
+    size_t locate(const char* name, size_t length, size_t hash) const {
+        size_t slot = hash & mask();
+        while (_entries[slot].value) {
+            const Entry& entry = _entries[slot];
+            if (entry.hash == hash &&
+                foldedEquals(entry.name.data(), entry.name.size(), name, length)) {
+                break;
+            }
+            slot = (slot + 1) & mask();
+        }
+        return slot;
+    }
+
+    void grow() {
+        std::vector<Entry> old(_entries.size() * 2);
+        old.swap(_entries);
+        for (size_t i = 0; i < old.size(); i++) {
+            if (!old[i].value) {
+                continue;
+            }
+            size_t slot = old[i].hash & mask();
+            while (_entries[slot].value) {
+                slot = (slot + 1) & mask();
+            }
+            _entries[slot].hash = old[i].hash;
+            _entries[slot].name.swap(old[i].name);
+            _entries[slot].value = old[i].value;
+        }
+    }
+
+public:
+    NameTable() : _entries(16), _size(0) {}
+
+    size_t size() const { return _size; }
+
+    T* find(const char* name, size_t length) const {
+        return _entries[locate(name, length, foldedHash(name, length))].value;
+    }
+
+    T* find(const std::string& name) const {
+        return find(name.data(), name.size());
+    }
+
+    // False (and no change) when the name is already taken
+    bool insert(const std::string& name, T* value) {
+        if ((_size + 1) * 4 > _entries.size() * 3) {
+            grow();
+        }
+        size_t hash = foldedHash(name.data(), name.size());
+        Entry& entry = _entries[locate(name.data(), name.size(), hash)];
+        if (entry.value) {
+            return false;
+        }
+        entry.hash = hash;
+        entry.name = name;
+        entry.value = value;
+        _size++;
+        return true;
+    }
+
+    bool erase(const std::string& name) {
+        size_t hole = locate(name.data(), name.size(), foldedHash(name.data(), name.size()));
+        if (!_entries[hole].value) {
+            return false;
+        }
+        // Backward-shift: pull up later entries whose probe path crosses the hole
+        size_t next = hole;
+        while (true) {
+            next = (next + 1) & mask();
+            Entry& entry = _entries[next];
+            if (!entry.value) {
+                break;
+            }
+            size_t home = entry.hash & mask();
+            bool stays = (hole <= next) ? (hole < home && home <= next)
+                                        : (hole < home || home <= next);
+            if (stays) {
+                continue;
+            }
+            _entries[hole].hash = entry.hash;
+            _entries[hole].name.swap(entry.name);
+            _entries[hole].value = entry.value;
+            hole = next;
+        }
+        _entries[hole].name.clear();
+        _entries[hole].value = NULL;
+        _size--;
+        return true;
+    }
+
+    // Snapshot of all values, e.g. for teardown
+    void values(std::vector<T*>& out) const {
+        for (size_t i = 0; i < _entries.size(); i++) {
+            if (_entries[i].value) {
+                out.push_back(_entries[i].value);
+            }
+        }
+    }
+};
+
+#endif // NAMETABLE_HPP
@@ -0,0 +1,66 @@
+#include "slabpool.hpp"
+#include <new>
+
+namespace {
+
+// Slots are aligned like the strictest fundamental type
+union MaxAlign {
+    long double     ld;
+    long long       ll;
+    void*           ptr;
+    void            (*fn)();
+};
+
+size_t roundUp(size_t size) {
+    size_t align = sizeof(MaxAlign);
+    return (size + align - 1) / align * align;
+}
+
+} // namespace
+
+SlabPool::SlabPool(size_t objectSize, size_t perSlab)
+    : _slotSize(roundUp(objectSize < sizeof(FreeSlot) ? sizeof(FreeSlot) : objectSize)),
+      _objectSize(objectSize), _perSlab(perSlab), _free(NULL) {
+}
+
+SlabPool::~SlabPool() {
+    for (size_t i = 0; i < _slabs.size(); ++i) {
+        ::operator delete(_slabs[i]);
+    }
+}
+
+void SlabPool::grow() {
+    char* slab = static_cast<char*>(::operator new(_slotSize * _perSlab));
+    _slabs.push_back(slab);
+    // Thread the slots back to front so allocation walks the slab in order
+    for (size_t i = _perSlab; i > 0; --i) {
+        FreeSlot* slot = reinterpret_cast<FreeSlot*>(slab + (i - 1) * _slotSize);
+        slot->next = _free;
+        _free = slot;
+    }
+}
+
+void* SlabPool::allocate(size_t size) {
+    if (size != _objectSize) {
+        return ::operator new(size);
+    }
+    if (!_free) {
+        grow();
+    }
+    FreeSlot* slot = _free;
+    _free = slot->next;
+    return slot;
+}
+
+void SlabPool::deallocate(void* object, size_t size) {
+    if (!object) {
+        return;
+    }
+    if (size != _objectSize) {
+        ::operator delete(object);
+        return;
+    }
+    FreeSlot* slot = static_cast<FreeSlot*>(object);
+    slot->next = _free;
+    _free = slot;
+}
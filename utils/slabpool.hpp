@@ -0,0 +1,42 @@
+#ifndef SLABPOOL_HPP
+#define SLABPOOL_HPP
+
+#include <vector>
+#include <cstddef>
+
+// Fixed-size object allocator for long-lived, frequently churned objects
+// (Client, Channel). Objects are carved out of slabs of `perSlab` slots
+// and freed slots go onto an intrusive free list, so connect/disconnect
+// churn reuses the same memory instead of fragmenting the heap. Slabs are
+// only returned when the pool is destroyed. Not thread-safe: both users
+// are created and destroyed on the main loop only.
+//
+// Hooked in through class-specific operator new/delete; a request for a
+// different size (a derived class) falls back to the global allocator.
+class SlabPool {
+private:
+    struct FreeSlot {
+        FreeSlot*   next;
+    };
+
+    size_t              _slotSize;  // Object size rounded up for alignment
+    size_t              _objectSize;
+    size_t              _perSlab;
+    FreeSlot*           _free;      // Recycled or never-used slots
+    std::vector<char*>  _slabs;
+
+    void grow();
+
+    // Prevent copying
+    SlabPool(const SlabPool& other);
+    SlabPool& operator=(const SlabPool& other);
+
+public:
+    SlabPool(size_t objectSize, size_t perSlab);
+    ~SlabPool();
+
+    void* allocate(size_t size);
+    void deallocate(void* object, size_t size);
+};
+
+#endif // SLABPOOL_HPP
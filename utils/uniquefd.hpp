@@ -0,0 +1,40 @@
+#ifndef UNIQUEFD_HPP
+#define UNIQUEFD_HPP
+
+#include <unistd.h>
+
+// Sole owner of a file descriptor: closes it exactly once, when the owner
+// is destroyed or reset. Ownership is handed over explicitly with
+// release(), e.g. when a socket moves from its Client to an I/O worker.
+class UniqueFd {
+private:
+    int _fd;    // -1 = nothing owned
+
+    // Prevent copying
+    UniqueFd(const UniqueFd& other);
+    UniqueFd& operator=(const UniqueFd& other);
+
+public:
+    explicit UniqueFd(int fd = -1) : _fd(fd) {}
+    ~UniqueFd() { reset(); }
+
+    int get() const { return _fd; }
+    bool valid() const { return _fd != -1; }
+
+    // Give up ownership without closing
+    int release() {
+        int fd = _fd;
+        _fd = -1;
+        return fd;
+    }
+
+    // Close the current descriptor (if any) and take `fd`
+    void reset(int fd = -1) {
+        if (_fd != -1 && _fd != fd) {
+            ::close(_fd);
+        }
+        _fd = fd;
+    }
+};
+
+#endif // UNIQUEFD_HPP